@@ -3,29 +3,15 @@
  */
 
 #include "LC4.h"
+#include "cache.h"
+#include "decode.h"
+#include "devices.h"
+#include "heatmap.h"
+#include "snapshot.h"
+#include "superblock.h"
+#include "trap-hle.h"
 #include <stdio.h>
 
-// Laura's helper functions
-// Common bits of the opcode to retrieve
-
-unsigned char getReg1(unsigned short int instruction)
-{
-    // get the first register in the opcode (bits 9-11)
-    return (instruction >> 9) & 0x7;
-}
-
-unsigned char getReg2(unsigned short int instruction)
-{
-    // get the second register (bits 6-8)
-    return (instruction >> 6) & 0x7;
-}
-
-unsigned char getReg3(unsigned short int instruction)
-{
-    // get the third register (bits 0-2)
-    return instruction & 0x7;
-}
-
 void fputhex1(char input, FILE *output)
 {
     fprintf(output, "%X", (int)input);
@@ -39,66 +25,6 @@ void fputhex4(unsigned short int input, FILE *output)
     fputs(hexStr, output);
 }
 
-short int sign_extend_5_to_16(short int num)
-{
-    // Check if the sign bit (5th bit) is set
-    if (num & 0x10)
-    {
-        // If sign bit is set, extend by setting higher bits to 1
-        return num | 0xFFE0; // 0xFFE0 has the higher 11 bits set to 1
-    }
-    else
-    {
-        // If sign bit is not set, return the number as is
-        return num;
-    }
-}
-
-short int sign_extend_6_to_16(short int num)
-{
-    // Check if the sign bit (6th bit) is set
-    if (num & 0x20)
-    {
-        // If sign bit is set, extend by setting higher bits to 1
-        return num | 0xFFC0; // 0xFFC0 has the higher 10 bits set to 1
-    }
-    else
-    {
-        // If sign bit is not set, return the number as is
-        return num;
-    }
-}
-
-short int sign_extend_9_to_16(short int num)
-{
-    // Check if the sign bit (9th bit) is set
-    if (num & 0x100)
-    {
-        // If sign bit is set, extend by setting higher bits to 1
-        return num | 0xFE00; // 0xFE00 has the higher 7 bits set to 1
-    }
-    else
-    {
-        // If sign bit is not set, return the number as is
-        return num;
-    }
-}
-
-short int sign_extend_11_to_16(short int num)
-{
-    // Check if the sign bit (11th bit) is set
-    if (num & 0x400)
-    {
-        // If sign bit is set, extend by setting higher bits to 1
-        return num | 0xF800; // 0xF800 has the higher 5 bits set to 1
-    }
-    else
-    {
-        // If sign bit is not set, return the number as is
-        return num;
-    }
-}
-
 //////////////////////////
 
 /*
@@ -106,6 +32,9 @@ short int sign_extend_11_to_16(short int num)
  */
 void Reset(MachineState *CPU)
 {
+    // the decode table is shared by every machine; only the first call builds it
+    InitDecodeTable();
+
     CPU->PC = 0x8200;
     CPU->PSR = 0x8002; // set psr[15] to 1 and psr[1] to 1 (https://edstem.org/us/courses/44946/discussion/3961721)
     for (int i = 0; i < 8; i++)
@@ -116,6 +45,33 @@ void Reset(MachineState *CPU)
     {
         CPU->memory[i] = 0;
     }
+
+    CPU->instructionCount = 0;
+    CPU->storeGeneration = 0;
+    CPU->exception = LC4_OK;
+    CPU->faultPC = 0;
+    CPU->faultAddr = 0;
+
+    // no devices attached
+    for (int i = 0; i < 256; i++)
+    {
+        CPU->mmioPage[i] = 0;
+    }
+    CPU->numDevices = 0;
+
+    CPU->icache = NULL;
+    CPU->dcache = NULL;
+    CPU->heatmap = NULL;
+    CPU->superblocks = NULL;
+    CPU->snapshot = NULL;
+    CPU->coverage = NULL;
+
+    // default simulator options: run the real OS code
+    CPU->hleTraps = 0;
+    CPU->verbosity = VERBOSITY_EXCEPTIONS;
+    CPU->eventHandler = NULL;
+    CPU->traceSink = NULL;
+    CPU->traceContext = NULL;
 }
 
 /*
@@ -141,6 +97,21 @@ void ClearSignals(MachineState *CPU)
  */
 void WriteOut(MachineState *CPU, FILE *output)
 {
+    // the data signals of instructions that don't store are cleared even when nothing is written
+    if (CPU->DATA_WE == 0)
+    {
+        CPU->dmemAddr = 0;
+        CPU->dmemValue = 0;
+    }
+    if (CPU->traceSink != NULL)
+    {
+        CPU->traceSink(CPU, CPU->traceContext);
+    }
+    if (output == NULL)
+    {
+        return;
+    }
+
     // write pc in hex
     fputhex4(CPU->PC, output);
     fputs(" ", output);
@@ -166,11 +137,6 @@ void WriteOut(MachineState *CPU, FILE *output)
     fputs(" ", output);
 
     // data WE/addr/value
-    if (CPU->DATA_WE == 0)
-    {
-        CPU->dmemAddr = 0;
-        CPU->dmemValue = 0;
-    }
     fputhex1(CPU->DATA_WE, output);
     fputs(" ", output);
     fputhex4(CPU->dmemAddr, output);
@@ -180,27 +146,110 @@ void WriteOut(MachineState *CPU, FILE *output)
     fputs("\n", output);
 }
 
+const char *LC4StatusMessage(LC4Status status)
+{
+    switch (status)
+    {
+    case LC4_OK:
+        return "ok";
+    case LC4_HALT:
+        return "halted";
+    case LC4_EXEC_DATA:
+        return "attempted to execute data";
+    case LC4_EXEC_OS_IN_USER:
+        return "attempted to execute OS code while in user mode";
+    case LC4_LOAD_OS_DATA_IN_USER:
+        return "attempted to load OS data while in user mode";
+    case LC4_LOAD_FROM_CODE:
+        return "attempted to load data from a code address";
+    case LC4_STORE_OS_DATA_IN_USER:
+        return "attempted to write to OS data while in user mode";
+    case LC4_STORE_TO_CODE:
+        return "attempted to store to a code address";
+    case LC4_INVALID_OPCODE:
+        return "invalid opcode";
+    case LC4_STEP_LIMIT:
+        return "step limit reached";
+    case LC4_TIME_LIMIT:
+        return "time limit reached";
+    case LC4_INFINITE_LOOP:
+        return "stuck in an infinite loop";
+    case LC4_ABORTED:
+        return "aborted";
+    }
+    return "unknown status";
+}
+
+/*
+ * Pass an event to the event handler, or print it to stderr when there is none.
+ */
+void raise_event(MachineState *CPU, const LC4Event *event)
+{
+    if (CPU->eventHandler != NULL)
+    {
+        CPU->eventHandler(CPU, event);
+    }
+    else if (event->type == EVENT_EXCEPTION)
+    {
+        fprintf(stderr, "Exception: %s. PC: %04X Instruction: %04X Address: %04X\n", LC4StatusMessage(event->status),
+                event->pc, CPU->memory[event->pc], event->address);
+    }
+    else
+    {
+        fprintf(stderr, "STR Address: %04X Value: %04X PC: %04X\n", event->address, event->value, event->pc);
+    }
+}
+
+/*
+ * Record an exception at the current PC and report it. Returns status for UpdateMachineState to return.
+ */
+int raise_exception(MachineState *CPU, LC4Status status, unsigned short int address)
+{
+    CPU->exception = status;
+    CPU->faultPC = CPU->PC;
+    CPU->faultAddr = address;
+    if (CPU->verbosity >= VERBOSITY_EXCEPTIONS)
+    {
+        LC4Event event = {EVENT_EXCEPTION, status, CPU->PC, address, 0};
+        raise_event(CPU, &event);
+    }
+    return status;
+}
+
+/*
+ * Count a control flow edge in CPU->coverage (AFL style: a hash of both ends picks the counter).
+ */
+void record_edge(MachineState *CPU, unsigned short int from, unsigned short int to)
+{
+    CPU->coverage[((from * 40503u) ^ to) & (COVERAGE_MAP_SIZE - 1)]++;
+}
+
 /*
  * This function should execute one LC4 datapath cycle.
  */
 int UpdateMachineState(MachineState *CPU, FILE *output)
 {
-    // if the PC is in data then return 1
+    // untraced steps run whole superblocks of hot loops at once when possible
+    if (CPU->superblocks && output == NULL && RunSuperblock(CPU))
+    {
+        return LC4_OK;
+    }
+    unsigned short int pc = CPU->PC;
+
+    // if the PC is in data then stop
     // data is 0x2000 to 0x7FFF and 0xA000 to 0xFFFF
     if ((CPU->PC >= 0x2000 && CPU->PC <= 0x7FFF) || (CPU->PC >= 0xA000 && CPU->PC <= 0xFFFF))
     {
-        printf("Exception: Attempted to execute data\n");
-        return 1;
+        return raise_exception(CPU, LC4_EXEC_DATA, CPU->PC);
     }
-    // If we are in OS code and the most significant bit of the PSR is 0, then we throw exception and return 1
+    // If we are in OS code and the most significant bit of the PSR is 0, then we throw exception and stop
     if (CPU->PC >= 0x8000 && CPU->PC <= 0x9FFF)
     {
         // if the most significant bit of the PSR is 0, then we are in OS code
-        // if it's 1, then we are in user code and we return 1
+        // if it's 0, then we are in user code and we stop
         if (!(CPU->PSR & 0x8000))
         {
-            printf("Exception: Attempted to execute OS code while in user mode\n");
-            return 1;
+            return raise_exception(CPU, LC4_EXEC_OS_IN_USER, CPU->PC);
         }
     }
 
@@ -217,33 +266,38 @@ int UpdateMachineState(MachineState *CPU, FILE *output)
     // if PC is 0x80FF, then we are done
     if (CPU->PC == 0x80FF)
     {
-        return 1;
+        return LC4_HALT;
+    }
+    if (CPU->icache)
+    {
+        CacheAccess(CPU->icache, CPU->PC, CPU->PC, 0);
     }
     // extrac the opcode from the instruction and set cases based on it
     unsigned short int opcode = instruction >> 12;
-    // print opcode and print instruction in binaryu
+    // the operands were extracted once, when the decode table was built
+    const DecodedInsn *d = &DecodeTable[instruction];
 
     switch (opcode)
     {
     case 0:
         // branch
-        BranchOp(CPU, output);
+        BranchOp(CPU, d, output);
         break;
     case 1:
         // arithmetic
-        ArithmeticOp(CPU, output);
+        ArithmeticOp(CPU, d, output);
         break;
     case 2:
         // cmp
-        ComparativeOp(CPU, output);
+        ComparativeOp(CPU, d, output);
         break;
     case 4:
         // jsr
-        JSROp(CPU, output);
+        JSROp(CPU, d, output);
         break;
     case 5:
         // and/not/or/xor
-        LogicalOp(CPU, output);
+        LogicalOp(CPU, d, output);
         break;
     case 6:
         // LDR
@@ -252,31 +306,37 @@ int UpdateMachineState(MachineState *CPU, FILE *output)
         CPU->DATA_WE = 0;
         CPU->regFile_WE = 1;
 
-        CPU->rdMux_CTL = getReg1(instruction);
-        CPU->rsMux_CTL = getReg2(instruction);
-        short int imm6 = instruction & 0x3F;
-        imm6 = sign_extend_6_to_16(imm6);
-        unsigned short int address = CPU->R[CPU->rsMux_CTL] + imm6;
-        CPU->R[CPU->rdMux_CTL] = CPU->memory[address];
-        CPU->regInputVal = CPU->R[CPU->rdMux_CTL];
+        CPU->rdMux_CTL = d->rd;
+        CPU->rsMux_CTL = d->rs;
+        unsigned short int address = CPU->R[CPU->rsMux_CTL] + d->imm;
 
-        // If the address is in OS data then we throw exception and return 1
+        // If the address is in OS data then we throw exception and stop
         if (address >= 0xA000 && address <= 0xFFFF)
         {
             // if the most significant bit of the PSR is 1, then we are in OS code
-            // if it's 0, then we are in user code and we return 1
+            // if it's 0, then we are in user code and we stop
             if (!(CPU->PSR & 0x8000))
             {
-                printf("Exception: Attempted to write to OS code or data while in user mode\n");
-                return 1;
+                return raise_exception(CPU, LC4_LOAD_OS_DATA_IN_USER, address);
             }
         }
 
-        // If the address is in code then we throw exception and return 1
+        // If the address is in code then we throw exception and stop
         if (address < 0x2000 || (address >= 0x8000 && address <= 0x9FFF))
         {
-            printf("Exception: Attempted to load data from a code address\n");
-            return 1;
+            return raise_exception(CPU, LC4_LOAD_FROM_CODE, address);
+        }
+
+        // only a load that passed the checks may have device side effects (reading KBDR, TSR, ...)
+        CPU->R[CPU->rdMux_CTL] = CPU->mmioPage[address >> 8] ? DeviceRead(CPU, address) : CPU->memory[address];
+        CPU->regInputVal = CPU->R[CPU->rdMux_CTL];
+        if (CPU->dcache)
+        {
+            CacheAccess(CPU->dcache, address, CPU->PC, 0);
+        }
+        if (CPU->heatmap)
+        {
+            HeatmapAccess(CPU->heatmap, CPU, address, 0);
         }
 
         WriteOut(CPU, output);
@@ -289,41 +349,57 @@ int UpdateMachineState(MachineState *CPU, FILE *output)
         CPU->DATA_WE = 1;
         CPU->regFile_WE = 0;
 
-        CPU->rtMux_CTL = getReg1(instruction);
-        CPU->rsMux_CTL = getReg2(instruction);
-        imm6 = instruction & 0x3F;
-        imm6 = sign_extend_6_to_16(imm6);
-        CPU->dmemAddr = CPU->R[CPU->rsMux_CTL] + imm6;
+        CPU->rtMux_CTL = d->rd;
+        CPU->rsMux_CTL = d->rs;
+        CPU->dmemAddr = CPU->R[CPU->rsMux_CTL] + d->imm;
         CPU->dmemValue = CPU->R[CPU->rtMux_CTL];
 
-        // If the address is in OS data then we throw exception and return 1
+        // If the address is in OS data then we throw exception and stop
         if (CPU->dmemAddr >= 0xA000 && CPU->dmemAddr <= 0xFFFF)
         {
             // if the most significant bit of the PSR is 1, then we are in OS code
-            // if it's 0, then we are in user code and we return 1
+            // if it's 0, then we are in user code and we stop
             if (!(CPU->PSR & 0x8000))
             {
-                printf("Exception: Attempted to write to OS data while in user mode. Address: %04X\n", CPU->dmemAddr);
-                return 1;
+                return raise_exception(CPU, LC4_STORE_OS_DATA_IN_USER, CPU->dmemAddr);
             }
         }
 
-        // If the address is in code then we throw exception and return 1
+        // If the address is in code then we throw exception and stop
         if (CPU->dmemAddr < 0x2000 || (CPU->dmemAddr >= 0x8000 && CPU->dmemAddr <= 0x9FFF))
         {
-            printf("Exception: Attempted to store to code address %04X\n", CPU->dmemAddr);
-            // print instruction, immediate, and rsmux ctl
-            printf("Instruction: %016b\n", instruction);
-            printf("Immediate: %016b\n", imm6);
-            printf("Rs: %016b\n", CPU->R[CPU->rsMux_CTL]);
+            return raise_exception(CPU, LC4_STORE_TO_CODE, CPU->dmemAddr);
+        }
 
-            return 1;
+        // report the store only when asked to; by default the hot path does no I/O
+        if (CPU->verbosity >= VERBOSITY_STORES)
+        {
+            LC4Event event = {EVENT_STORE, LC4_OK, CPU->PC, CPU->dmemAddr, CPU->dmemValue};
+            raise_event(CPU, &event);
         }
 
-        // print the address
-        printf("STR Address: %04X\n", CPU->dmemAddr);
+        if (CPU->dcache)
+        {
+            CacheAccess(CPU->dcache, CPU->dmemAddr, CPU->PC, 1);
+        }
+        if (CPU->heatmap)
+        {
+            HeatmapAccess(CPU->heatmap, CPU, CPU->dmemAddr, 1);
+        }
+        if (CPU->snapshot)
+        {
+            MarkSnapshotDirty(CPU->snapshot, CPU->dmemAddr);
+        }
+        CPU->storeGeneration++;
 
-        CPU->memory[CPU->dmemAddr] = CPU->dmemValue;
+        if (CPU->mmioPage[CPU->dmemAddr >> 8])
+        {
+            DeviceWrite(CPU, CPU->dmemAddr, CPU->dmemValue);
+        }
+        else
+        {
+            CPU->memory[CPU->dmemAddr] = CPU->dmemValue;
+        }
 
         WriteOut(CPU, output);
         CPU->PC++;
@@ -343,27 +419,25 @@ int UpdateMachineState(MachineState *CPU, FILE *output)
         break;
     case 9:
         // CONST Rd IMM9
-        CPU->rdMux_CTL = getReg1(instruction);
-        short int imm9 = instruction & 0x1FF;
-        imm9 = sign_extend_9_to_16(imm9);
-        CPU->R[CPU->rdMux_CTL] = imm9;
+        CPU->rdMux_CTL = d->rd;
+        CPU->R[CPU->rdMux_CTL] = d->imm;
 
         CPU->DATA_WE = 0;
         CPU->regFile_WE = 1;
         CPU->NZP_WE = 1;
-        CPU->regInputVal = imm9;
-        SetNZP(CPU, imm9);
+        CPU->regInputVal = d->imm;
+        SetNZP(CPU, d->imm);
 
         WriteOut(CPU, output);
         CPU->PC++;
         break;
     case 10:
         // shift
-        ShiftModOp(CPU, output);
+        ShiftModOp(CPU, d, output);
         break;
     case 12:
         // jmp
-        JumpOp(CPU, output);
+        JumpOp(CPU, d, output);
         break;
     case 13:
         // HICONST Rd, UIMM8
@@ -374,9 +448,8 @@ int UpdateMachineState(MachineState *CPU, FILE *output)
         CPU->DATA_WE = 0;
         CPU->regFile_WE = 1;
 
-        CPU->rdMux_CTL = getReg1(CPU->memory[CPU->PC]);
-        short int UIMM8 = CPU->memory[CPU->PC] & 0xFF;
-        CPU->regInputVal = (CPU->R[CPU->rdMux_CTL] & 0xFF) | (UIMM8 << 8);
+        CPU->rdMux_CTL = d->rd;
+        CPU->regInputVal = (CPU->R[CPU->rdMux_CTL] & 0xFF) | (d->imm << 8);
         CPU->R[CPU->rdMux_CTL] = CPU->regInputVal;
 
         SetNZP(CPU, CPU->regInputVal);
@@ -397,7 +470,7 @@ int UpdateMachineState(MachineState *CPU, FILE *output)
         CPU->rdMux_CTL = 7;
         CPU->R[CPU->rdMux_CTL] = CPU->regInputVal;
         // get the trap vector (bits 0-7)
-        unsigned short int trapVector = CPU->memory[CPU->PC] & 0xFF;
+        unsigned short int trapVector = d->imm;
 
         // set psr[15] to 1
         CPU->PSR |= 0x8000;
@@ -405,13 +478,32 @@ int UpdateMachineState(MachineState *CPU, FILE *output)
         WriteOut(CPU, output);
         // PC = (x8000 | trapVector)
         CPU->PC = 0x8000 | trapVector;
+
+        // in HLE mode, service the trap natively and return to R7 like the handler's RTI would
+        unsigned short int faultAddr;
+        int serviced = CPU->hleTraps ? ServiceTrapHLE(CPU, trapVector, &faultAddr) : 0;
+        if (serviced < 0)
+        {
+            CPU->storeGeneration++;
+            return raise_exception(CPU, LC4_STORE_TO_CODE, faultAddr);
+        }
+        if (serviced)
+        {
+            CPU->storeGeneration++;
+            CPU->PSR &= 0x7FFF;
+            CPU->PC = CPU->R[7];
+        }
         break;
     default:
         // invalid opcode
-        printf("Invalid opcode: %d\n", opcode);
-        return 1;
+        return raise_exception(CPU, LC4_INVALID_OPCODE, CPU->PC);
     }
-    return 0;
+    if (CPU->superblocks && output == NULL)
+    {
+        ProfileSuperblocks(CPU, pc, d);
+    }
+    CPU->instructionCount++;
+    return LC4_OK;
 }
 
 //////////////// PARSING HELPER FUNCTIONS ///////////////////////////
@@ -419,23 +511,19 @@ int UpdateMachineState(MachineState *CPU, FILE *output)
 /*
  * Parses rest of branch operation and updates state of machine.
  */
-void BranchOp(MachineState *CPU, FILE *output)
+void BranchOp(MachineState *CPU, const DecodedInsn *d, FILE *output)
 {
     // set control signals
     CPU->NZP_WE = 0;
     CPU->DATA_WE = 0;
     CPU->regFile_WE = 0;
 
-    // extract the condition bits. any 000-111 is valid representing nzp respectively
+    // the condition bits. any 000-111 is valid representing nzp respectively
     // (bits 9, 10, 11)
-    unsigned short int condition = getReg1(CPU->memory[CPU->PC]);
-    // extract the PCoffset9
-    short int PCoffset9 = CPU->memory[CPU->PC] & 0x1FF;
-    // sign extend to 16 bits
-    PCoffset9 = sign_extend_9_to_16(PCoffset9);
+    unsigned short int condition = d->rd;
 
-    // calculate the new PC
-    unsigned short int newPC = CPU->PC + PCoffset9 + 1;
+    // calculate the new PC from the sign extended PCoffset9
+    unsigned short int newPC = CPU->PC + d->imm + 1;
 
     // print the machine state before updating the PC
     WriteOut(CPU, output);
@@ -443,6 +531,10 @@ void BranchOp(MachineState *CPU, FILE *output)
     // check if the condition is met
     unsigned short int nzp = CPU->PSR & 0x7;
     unsigned short int conditionMet = nzp & condition;
+    if (CPU->coverage)
+    {
+        record_edge(CPU, CPU->PC, conditionMet ? newPC : CPU->PC + 1);
+    }
     if (conditionMet)
     {
         // set the PC to the new PC
@@ -458,55 +550,33 @@ void BranchOp(MachineState *CPU, FILE *output)
 /*
  * Parses rest of arithmetic operation and prints out.
  */
-void ArithmeticOp(MachineState *CPU, FILE *output)
+void ArithmeticOp(MachineState *CPU, const DecodedInsn *d, FILE *output)
 {
-
-    // get bit 5 of the instruction
-    short int bit5 = (CPU->memory[CPU->PC] >> 5) & 0x1;
-
-    CPU->rdMux_CTL = getReg1(CPU->memory[CPU->PC]);
-    CPU->rsMux_CTL = getReg2(CPU->memory[CPU->PC]);
+    CPU->rdMux_CTL = d->rd;
+    CPU->rsMux_CTL = d->rs;
     short int result;
-    short int immediate;
 
-    switch (bit5)
+    switch (d->op)
     {
-    case 0:
-        // get the second operand (bits 0-2) (Rt)
-        CPU->rtMux_CTL = getReg3(CPU->memory[CPU->PC]);
-        // get the opcode (bits 3-4)
-        short int opcode = (CPU->memory[CPU->PC] >> 3) & 0x3;
-        // calculate the result
-        switch (opcode)
-        {
-        case 0:
-            // ADD
-            result = CPU->R[CPU->rsMux_CTL] + CPU->R[CPU->rtMux_CTL];
-            break;
-        case 1:
-            // MUL
-            result = CPU->R[CPU->rsMux_CTL] * CPU->R[CPU->rtMux_CTL];
-            break;
-        case 2:
-            // SUB
-            result = CPU->R[CPU->rsMux_CTL] - CPU->R[CPU->rtMux_CTL];
-            break;
-        case 3:
-            // DIV
-            result = CPU->R[CPU->rsMux_CTL] / CPU->R[CPU->rtMux_CTL];
-            break;
-        default:
-            // invalid opcode
-            printf("Invalid opcode: %d\n", opcode);
-            break;
-        }
+    case OP_ADD:
+        CPU->rtMux_CTL = d->rt;
+        result = CPU->R[CPU->rsMux_CTL] + CPU->R[CPU->rtMux_CTL];
         break;
-    case 1:
-        // get the immediate value (bits 0-4)
-        immediate = CPU->memory[CPU->PC] & 0x1F;
-        immediate = sign_extend_5_to_16(immediate);
-        // perform addition
-        result = CPU->R[CPU->rsMux_CTL] + immediate;
+    case OP_MUL:
+        CPU->rtMux_CTL = d->rt;
+        result = CPU->R[CPU->rsMux_CTL] * CPU->R[CPU->rtMux_CTL];
+        break;
+    case OP_SUB:
+        CPU->rtMux_CTL = d->rt;
+        result = CPU->R[CPU->rsMux_CTL] - CPU->R[CPU->rtMux_CTL];
+        break;
+    case OP_DIV:
+        CPU->rtMux_CTL = d->rt;
+        result = CPU->R[CPU->rsMux_CTL] / CPU->R[CPU->rtMux_CTL];
+        break;
+    default:
+        // ADD with the sign extended IMM5
+        result = CPU->R[CPU->rsMux_CTL] + d->imm;
         break;
     }
 
@@ -530,55 +600,39 @@ void ArithmeticOp(MachineState *CPU, FILE *output)
 /*
  * Parses rest of comparative operation and prints out.
  */
-void ComparativeOp(MachineState *CPU, FILE *output)
+void ComparativeOp(MachineState *CPU, const DecodedInsn *d, FILE *output)
 {
-    unsigned short int instruction = CPU->memory[CPU->PC];
     // set control signals
-    CPU->rsMux_CTL = getReg1(instruction);
+    CPU->rsMux_CTL = d->rd;
     CPU->NZP_WE = 1;
     CPU->DATA_WE = 0;
     CPU->regFile_WE = 0;
 
-    // get the sub opcode (bits 7-8)
-    short int subOpcode = (CPU->memory[CPU->PC] >> 7) & 0x3;
     unsigned short int result;
-    short int immediate;
 
-    switch (subOpcode)
+    switch (d->op)
     {
-    case 0:
-        // CMP
-        CPU->rtMux_CTL = getReg3(instruction);
+    case OP_CMP:
+        CPU->rtMux_CTL = d->rt;
         // subtract the two registers and set the NZP bits (signed)
         // we have to interpret the registers as signed bits
         // please
         SetNZP(CPU, CPU->R[CPU->rsMux_CTL] - CPU->R[CPU->rtMux_CTL]);
         break;
-    case 1:
-        // CMPU
-        CPU->rtMux_CTL = getReg3(instruction);
+    case OP_CMPU:
+        CPU->rtMux_CTL = d->rt;
         // subtract the two registers and set the NZP bits (but do it unsigned)
         result = (unsigned short int)(CPU->R[CPU->rsMux_CTL] - CPU->R[CPU->rtMux_CTL]);
         SetNZP(CPU, result);
         break;
-    case 2:
-        // CMPI
-        // get the immediate (bits 0-6)
-        immediate = CPU->memory[CPU->PC] & 0x7F;
+    case OP_CMPI:
         // subtract the register and the immediate and set the NZP bits (signed)
-        SetNZP(CPU, CPU->R[CPU->rsMux_CTL] - immediate);
-        break;
-    case 3:
-        // CMPIU
-        // get immediate
-        immediate = CPU->memory[CPU->PC] & 0x7F;
-        // subtract the register and the immediate and set the NZP bits (unsigned)
-        result = (unsigned short int)(CPU->R[CPU->rsMux_CTL] - immediate);
-        SetNZP(CPU, result);
+        SetNZP(CPU, CPU->R[CPU->rsMux_CTL] - d->imm);
         break;
     default:
-        // invalid sub opcode
-        printf("Invalid sub opcode: %d\n", subOpcode);
+        // CMPIU: subtract the register and the immediate and set the NZP bits (unsigned)
+        result = (unsigned short int)(CPU->R[CPU->rsMux_CTL] - d->imm);
+        SetNZP(CPU, result);
         break;
     }
     WriteOut(CPU, output);
@@ -588,63 +642,46 @@ void ComparativeOp(MachineState *CPU, FILE *output)
 /*
  * Parses rest of logical operation and prints out.
  */
-void LogicalOp(MachineState *CPU, FILE *output)
+void LogicalOp(MachineState *CPU, const DecodedInsn *d, FILE *output)
 {
-    unsigned short int instruction = CPU->memory[CPU->PC];
-
     // set control signals
     CPU->NZP_WE = 1;
     CPU->DATA_WE = 0;
     CPU->regFile_WE = 1;
 
     // set Rd
-    CPU->rdMux_CTL = getReg1(instruction);
+    CPU->rdMux_CTL = d->rd;
     // set Rs
-    CPU->rsMux_CTL = getReg2(instruction);
-    // get bit 5
-    short int bit5 = (CPU->memory[CPU->PC] >> 5) & 0x1;
+    CPU->rsMux_CTL = d->rs;
 
-    short int immediate;
     short int result;
-    if (bit5 == 1)
+    if (d->op == OP_ANDI)
     {
         // AND Rd Rs IMM5
-        // get the immediate (bits 0-4)
-        immediate = CPU->memory[CPU->PC] & 0x1F;
-        immediate = sign_extend_5_to_16(immediate);
-        // perform the AND operation
-        result = CPU->R[CPU->rsMux_CTL] & immediate;
+        result = CPU->R[CPU->rsMux_CTL] & d->imm;
     }
     else
     {
-        // get bits 4-3
-        short int bits43 = (CPU->memory[CPU->PC] >> 3) & 0x3;
-
         // set Rt
-        CPU->rtMux_CTL = getReg3(instruction);
-        switch (bits43)
+        CPU->rtMux_CTL = d->rt;
+        switch (d->op)
         {
-
-        case 1:
+        case OP_NOT:
             // NOT Rd Rs
             result = ~CPU->R[CPU->rsMux_CTL];
             break;
-        case 2:
+        case OP_OR:
             // OR Rd Rs Rt
             result = CPU->R[CPU->rsMux_CTL] | CPU->R[CPU->rtMux_CTL];
             break;
-        case 3:
+        case OP_XOR:
             // XOR Rd Rs Rt
             result = CPU->R[CPU->rsMux_CTL] ^ CPU->R[CPU->rtMux_CTL];
             break;
-        case 0:
+        default:
             // AND Rd Rs Rt
             result = CPU->R[CPU->rsMux_CTL] & CPU->R[CPU->rtMux_CTL];
             break;
-        default:
-            // invalid bits 4-3
-            printf("Invalid bits 4-3 in logic op: %d\n", bits43);
-            break;
         }
     }
 
@@ -661,7 +698,7 @@ void LogicalOp(MachineState *CPU, FILE *output)
 /*
  * Parses rest of jump operation and prints out.
  */
-void JumpOp(MachineState *CPU, FILE *output)
+void JumpOp(MachineState *CPU, const DecodedInsn *d, FILE *output)
 {
     // set control signals
     CPU->NZP_WE = 0;
@@ -670,38 +707,30 @@ void JumpOp(MachineState *CPU, FILE *output)
 
     unsigned short int newPC;
 
-    // bit 11 tells you if this is a jmp or jmpr
-    short int bit11 = (CPU->memory[CPU->PC] >> 11) & 0x1;
-    short int PCoffset11;
-    switch (bit11)
+    if (d->op == OP_JMPR)
     {
-    case 0:
-        // JMPR
-        // get the base register (bits 6-8)
-        CPU->rsMux_CTL = getReg2(CPU->memory[CPU->PC]);
-        // set the PC to the base register
+        // JMPR: set the PC to the base register (bits 6-8)
+        CPU->rsMux_CTL = d->rs;
         newPC = CPU->R[CPU->rsMux_CTL];
-        break;
-    case 1:
-        // JMP
-        // get the PCoffset11 (bits 0-10)
-        PCoffset11 = CPU->memory[CPU->PC] & 0x7FF;
-        PCoffset11 = sign_extend_11_to_16(PCoffset11);
-        // set the PC to the PCoffset11
-        newPC = CPU->PC + 1 + PCoffset11;
-        break;
+    }
+    else
+    {
+        // JMP: PC + 1 + the sign extended PCoffset11
+        newPC = CPU->PC + 1 + d->imm;
     }
     WriteOut(CPU, output);
+    if (CPU->coverage)
+    {
+        record_edge(CPU, CPU->PC, newPC);
+    }
     CPU->PC = newPC;
 }
 
 /*
  * Parses rest of JSR operation and prints out.
  */
-void JSROp(MachineState *CPU, FILE *output)
+void JSROp(MachineState *CPU, const DecodedInsn *d, FILE *output)
 {
-    unsigned short int instruction = CPU->memory[CPU->PC];
-
     // set control signals
     CPU->NZP_WE = 0;
     CPU->DATA_WE = 0;
@@ -711,87 +740,58 @@ void JSROp(MachineState *CPU, FILE *output)
 
     // set R7 to PC + 1
     CPU->R[7] = CPU->PC + 1;
-    // bit 11 tells you if this is a jsr or jsrr
-    short int bit11 = (instruction >> 11) & 0x1;
-    short int PCoffset11;
-    switch (bit11)
+    if (d->op == OP_JSRR)
     {
-    case 0:
-        // JSRR
-        // get the base register (bits 6-8)
-        CPU->rsMux_CTL = getReg2(instruction);
-        // set the PC to the base register
+        // JSRR: set the PC to the base register (bits 6-8)
+        CPU->rsMux_CTL = d->rs;
         newPC = CPU->R[CPU->rsMux_CTL];
-        break;
-    case 1:
-        // JSR
-        // get the PCoffset11 (bits 0-10)
-        PCoffset11 = instruction & 0x7FF;
-        PCoffset11 = sign_extend_11_to_16(PCoffset11);
-        // set the PC to the PCoffset11
-        newPC = CPU->PC + 1 + PCoffset11;
-        break;
+    }
+    else
+    {
+        // JSR: PC + 1 + the sign extended PCoffset11
+        newPC = CPU->PC + 1 + d->imm;
     }
     WriteOut(CPU, output);
+    if (CPU->coverage)
+    {
+        record_edge(CPU, CPU->PC, newPC);
+    }
     CPU->PC = newPC;
 }
 
 /*
  * Parses rest of shift/mod operations and prints out.
  */
-void ShiftModOp(MachineState *CPU, FILE *output)
+void ShiftModOp(MachineState *CPU, const DecodedInsn *d, FILE *output)
 {
-    unsigned short int instruction = CPU->memory[CPU->PC];
-
     // set control signals
     CPU->NZP_WE = 1;
     CPU->DATA_WE = 0;
     CPU->regFile_WE = 1;
 
-    // get sub opcode (bits 4-5)
-    short int subOpcode = (instruction >> 4) & 0x3;
     // get the first register (bits 9-11)
-    CPU->rdMux_CTL = getReg1(instruction);
+    CPU->rdMux_CTL = d->rd;
     // get the second register (bits 6-8)
-    CPU->rsMux_CTL = getReg2(instruction);
-
-    short int immediate;
+    CPU->rsMux_CTL = d->rs;
 
-    switch (subOpcode)
+    switch (d->op)
     {
-    case 0:
-        // <<
-        // get the immediate (bits 0-3)
-        immediate = instruction & 0xF;
-        // shift the register left by the immediate
-        CPU->R[CPU->rdMux_CTL] = CPU->R[CPU->rsMux_CTL] << immediate;
+    case OP_SLL:
+        // << by the immediate (bits 0-3)
+        CPU->R[CPU->rdMux_CTL] = CPU->R[CPU->rsMux_CTL] << d->imm;
         break;
-    case 1:
-        // >>> (unsigned right shift)
-        // get the immediate (bits 0-3)
-        immediate = instruction & 0xF;
-        // cast to unsigned
-        unsigned short int unsigned_immediate = (unsigned short int)immediate;
-        // shift the register right by the immediate
-        CPU->R[CPU->rdMux_CTL] = CPU->R[CPU->rsMux_CTL] >> unsigned_immediate;
+    case OP_SRL:
+        // >>> (unsigned right shift) by the immediate (bits 0-3)
+        CPU->R[CPU->rdMux_CTL] = CPU->R[CPU->rsMux_CTL] >> (unsigned short int)d->imm;
         break;
-    case 2:
-        // >>
-        // get the immediate (bits 0-3)
-        immediate = instruction & 0xF;
-        // shift the register right by the immediate
-        CPU->R[CPU->rdMux_CTL] = CPU->R[CPU->rsMux_CTL] >> immediate;
-        break;
-    case 3:
-        // MOD
-        // get Rt
-        CPU->rtMux_CTL = getReg3(instruction);
-        // get the remainder of the division of Rs and Rt
-        CPU->R[CPU->rdMux_CTL] = CPU->R[CPU->rsMux_CTL] % CPU->R[CPU->rtMux_CTL];
+    case OP_SRA:
+        // >> by the immediate (bits 0-3)
+        CPU->R[CPU->rdMux_CTL] = CPU->R[CPU->rsMux_CTL] >> d->imm;
         break;
     default:
-        // invalid sub opcode
-        printf("Invalid sub opcode: %d\n", subOpcode);
+        // MOD: get Rt, then the remainder of the division of Rs and Rt
+        CPU->rtMux_CTL = d->rt;
+        CPU->R[CPU->rdMux_CTL] = CPU->R[CPU->rsMux_CTL] % CPU->R[CPU->rtMux_CTL];
         break;
     }
 
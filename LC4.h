@@ -1,11 +1,81 @@
 // This file specifies the datatype of our MachineState object.
 // The MachineState object is a simulator of the internal state of an LC4 computer.
 
+#ifndef LC4_H
+#define LC4_H
+
+#include "decode.h"
 #include "string.h"
 #include <stdio.h>
 #include <stdlib.h>
 
+// memory-mapped devices are defined in devices.h
+struct MMIODevice;
+#define MAX_DEVICES 8
+
+// cache simulators are defined in cache.h
+struct CacheSim;
+
+// the superblock cache is defined in superblock.h
+struct SuperblockCache;
+
+// the data access heatmap is defined in heatmap.h
+struct Heatmap;
+
+// snapshots with dirty page tracking are defined in snapshot.h
+struct Snapshot;
+
+// size of the control flow edge coverage map (a power of 2)
+#define COVERAGE_MAP_SIZE (1 << 14)
+
+// Why UpdateMachineState stopped. It returns one of these; LC4_OK (0) means keep running.
+typedef enum
+{
+    LC4_OK = 0,
+    LC4_HALT = 1,                 // reached x80FF
+    LC4_EXEC_DATA,                // PC in a data region
+    LC4_EXEC_OS_IN_USER,          // PC in OS code with PSR[15] clear
+    LC4_LOAD_OS_DATA_IN_USER,     // LDR from xA000-xFFFF with PSR[15] clear
+    LC4_LOAD_FROM_CODE,           // LDR from a code region
+    LC4_STORE_OS_DATA_IN_USER,    // STR to xA000-xFFFF with PSR[15] clear
+    LC4_STORE_TO_CODE,            // STR to a code region
+    LC4_INVALID_OPCODE,
+    // never returned by UpdateMachineState; a watchdog (see watchdog.h) stops the machine with these
+    LC4_STEP_LIMIT,               // ran out of steps
+    LC4_TIME_LIMIT,               // ran out of time
+    LC4_INFINITE_LOOP,            // came back to the same state with no store in between
+    LC4_ABORTED,                  // stopped from outside, e.g. by a server shutting down
+} LC4Status;
+
+// Diagnostic events. An event is only raised when CPU->verbosity is at least its level.
+typedef enum
+{
+    EVENT_EXCEPTION, // level VERBOSITY_EXCEPTIONS: the machine stopped on an exception
+    EVENT_STORE      // level VERBOSITY_STORES: an STR wrote memory or a device
+} LC4EventType;
+
+#define VERBOSITY_QUIET 0
+#define VERBOSITY_EXCEPTIONS 1
+#define VERBOSITY_STORES 2
+
 typedef struct
+{
+    LC4EventType type;
+    LC4Status status; // for EVENT_EXCEPTION
+    unsigned short int pc;
+    unsigned short int address;
+    unsigned short int value; // for EVENT_STORE
+} LC4Event;
+
+struct MachineState;
+
+// receives the events that pass the verbosity level. NULL prints them to stderr.
+typedef void (*LC4EventHandler)(struct MachineState *CPU, const LC4Event *event);
+
+// called by WriteOut for every traced instruction, whether or not a trace file is written
+typedef void (*LC4TraceSink)(struct MachineState *CPU, void *context);
+
+typedef struct MachineState
 {
     // program counter register -- stores current memory address we are running.
     unsigned short int PC;
@@ -34,24 +104,75 @@ typedef struct
     unsigned short int dmemAddr;
     unsigned short int dmemValue;
 
+    // number of instructions executed since Reset
+    unsigned long long instructionCount;
+
+    // bumped by every store, device access and HLE trap: while it is unchanged, memory and the
+    // outside world are too, so the registers alone decide what happens next
+    unsigned long long storeGeneration;
+
+    // the last exception: its code, the PC of the instruction and the address it faulted on
+    // (the PC itself for fetch faults and invalid opcodes)
+    LC4Status exception;
+    unsigned short int faultPC;
+    unsigned short int faultAddr;
+
+    // memory-mapped devices. mmioPage[address >> 8] is nonzero when a device maps part of that
+    // 256-word page, so LDR/STR to ordinary pages never look at the device list.
+    unsigned char mmioPage[256];
+    struct MMIODevice *devices[MAX_DEVICES];
+    int numDevices;
+
+    // optional cache simulators fed with every instruction fetch / LDR and STR (NULL when off)
+    struct CacheSim *icache;
+    struct CacheSim *dcache;
+
+    // optional heatmap fed with every LDR and STR address (NULL when off)
+    struct Heatmap *heatmap;
+
+    // optional superblock cache, used by untraced steps (output == NULL) only
+    struct SuperblockCache *superblocks;
+
+    // optional snapshot; while attached, every store marks its page dirty (NULL when off)
+    struct Snapshot *snapshot;
+
+    // optional hit counts of the edges taken by BR, JMP(R), JSR(R), COVERAGE_MAP_SIZE bytes indexed
+    // by a hash of the edge's source and target PC (NULL when off)
+    unsigned char *coverage;
+
+    // simulator options. Reset sets these to their defaults, so set them after calling Reset.
+    // when nonzero, common OS traps are serviced natively in C instead of running the OS handler
+    unsigned char hleTraps;
+    // which diagnostic events are raised (VERBOSITY_*), and where they go
+    unsigned char verbosity;
+    LC4EventHandler eventHandler;
+    // optional consumer of every WriteOut record (see trace-record.h), NULL when off
+    LC4TraceSink traceSink;
+    void *traceContext;
+
     // 2^16 x 16 bit machine memory
     unsigned short int memory[65536];
 } MachineState;
 
-// Executes one LC4 datapath cycle
+// Executes one LC4 datapath cycle. output may be NULL to run without writing a trace.
+// Returns LC4_OK to keep going, LC4_HALT, or the exception that stopped the machine.
 int UpdateMachineState(MachineState *CPU, FILE *output);
 
+// Short description of a status code
+const char *LC4StatusMessage(LC4Status status);
+
 // Write out current CPU state to file output
 void WriteOut(MachineState *CPU, FILE *output);
 
 // various instructions:
-void BranchOp(MachineState *CPU, FILE *output);
-void ArithmeticOp(MachineState *CPU, FILE *output);
-void ComparativeOp(MachineState *CPU, FILE *output);
-void LogicalOp(MachineState *CPU, FILE *output);
-void JumpOp(MachineState *CPU, FILE *output);
-void JSROp(MachineState *CPU, FILE *output);
-void ShiftModOp(MachineState *CPU, FILE *output);
+// d is the instruction's entry in DecodeTable
+void BranchOp(MachineState *CPU, const DecodedInsn *d, FILE *output);
+void ArithmeticOp(MachineState *CPU, const DecodedInsn *d, FILE *output);
+void ComparativeOp(MachineState *CPU, const DecodedInsn *d, FILE *output);
+void LogicalOp(MachineState *CPU, const DecodedInsn *d, FILE *output);
+void JumpOp(MachineState *CPU, const DecodedInsn *d, FILE *output);
+void JSROp(MachineState *CPU, const DecodedInsn *d, FILE *output);
+void ShiftModOp(MachineState *CPU, const DecodedInsn *d, FILE *output);
 
 // Sets NZP bits in the PSR
 void SetNZP(MachineState *CPU, short result);
@@ -61,3 +182,5 @@ void Reset(MachineState *CPU);
 
 // set internal values to 0.
 void ClearSignals(MachineState *CPU);
+
+#endif
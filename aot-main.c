@@ -0,0 +1,165 @@
+/*
+ * aot-main.c: main() of a program translated by lc4aot. Load the same object files the
+ * translation was made from; blocks whose code doesn't match are left to the interpreter.
+ */
+
+#include "loader.h"
+#include "aot-runtime.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Global variable defining the current state of the machine
+MachineState *CPU;
+
+// the translation, linked in from the lc4aot output
+extern const AOTProgram LC4AOTProgram;
+
+void PrintUsage(const char *name)
+{
+    printf("Usage: %s [options] <file1.obj> [file2.obj] ...\n", name);
+    printf("  -steps <N>  stop after N steps\n");
+    printf("  -hle        service common OS traps natively (NZP and OS scratch registers are left as they were)\n");
+    printf("  -compare    also run the interpreter and check it ends in the same state\n");
+}
+
+double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// first difference between the machines a and b, or NULL
+const char *compare_machines(MachineState *a, MachineState *b, int *where)
+{
+    *where = -1;
+    if (a->PC != b->PC)
+        return "PC";
+    if (a->PSR != b->PSR)
+        return "PSR";
+    if (a->instructionCount != b->instructionCount)
+        return "instruction count";
+    for (int i = 0; i < 8; i++)
+    {
+        if (a->R[i] != b->R[i])
+        {
+            *where = i;
+            return "register";
+        }
+    }
+    for (int i = 0; i < 65536; i++)
+    {
+        if (a->memory[i] != b->memory[i])
+        {
+            *where = i;
+            return "memory";
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long long steps = ULLONG_MAX;
+    int hleTraps = 0;
+    int compare = 0;
+    int argi = 1;
+    while (argi < argc && argv[argi][0] == '-')
+    {
+        if (strcmp(argv[argi], "-steps") == 0 && argi + 1 < argc)
+        {
+            steps = strtoull(argv[++argi], NULL, 0);
+        }
+        else if (strcmp(argv[argi], "-hle") == 0)
+        {
+            hleTraps = 1;
+        }
+        else if (strcmp(argv[argi], "-compare") == 0)
+        {
+            compare = 1;
+        }
+        else
+        {
+            PrintUsage(argv[0]);
+            return -1;
+        }
+        argi++;
+    }
+    if (argi >= argc)
+    {
+        PrintUsage(argv[0]);
+        return -1;
+    }
+
+    CPU = (MachineState *)malloc(sizeof(MachineState));
+    Reset(CPU);
+    ClearSignals(CPU);
+    CPU->hleTraps = hleTraps;
+
+    if (LoadObjectFiles(argv + argi, argc - argi, CPU) != 0)
+    {
+        return 1;
+    }
+
+    MachineState *reference = NULL;
+    if (compare)
+    {
+        reference = (MachineState *)malloc(sizeof(MachineState));
+        memcpy(reference, CPU, sizeof(MachineState));
+    }
+
+    AOTRuntime *runtime = CreateAOTRuntime(&LC4AOTProgram, CPU);
+    if (runtime->mismatched > 0)
+    {
+        printf("%d of %d blocks don't match the loaded code and will be interpreted\n", runtime->mismatched,
+               LC4AOTProgram.numBlocks);
+    }
+
+    double start = now_seconds();
+    int status = RunAOT(runtime, CPU, steps);
+    double seconds = now_seconds() - start;
+    printf("Stopped at PC x%04X after %llu steps: %s\n", CPU->PC, CPU->instructionCount,
+           status == LC4_OK ? "step limit" : LC4StatusMessage(status));
+    printf("%.3f s, %.1f M steps/s; %llu steps in %llu translated blocks, %llu interpreted\n", seconds,
+           seconds > 0 ? CPU->instructionCount / seconds / 1e6 : 0, runtime->translatedSteps, runtime->blocksRun,
+           runtime->interpretedSteps);
+
+    if (compare)
+    {
+        start = now_seconds();
+        int referenceStatus = LC4_OK;
+        while (reference->instructionCount < steps && referenceStatus == LC4_OK)
+        {
+            referenceStatus = UpdateMachineState(reference, NULL);
+        }
+        double referenceSeconds = now_seconds() - start;
+        printf("interpreter: %.3f s, %.1f M steps/s\n", referenceSeconds,
+               referenceSeconds > 0 ? reference->instructionCount / referenceSeconds / 1e6 : 0);
+
+        int where;
+        const char *difference = compare_machines(CPU, reference, &where);
+        if (difference == NULL && status != referenceStatus)
+        {
+            difference = "status";
+        }
+        if (difference != NULL)
+        {
+            printf("Differs from the interpreter: %s", difference);
+            if (where >= 0)
+            {
+                printf(strcmp(difference, "memory") == 0 ? " x%04X" : " R%d", where);
+            }
+            printf("\n");
+            return 1;
+        }
+        printf("Same state as the interpreter\n");
+        free(reference);
+    }
+
+    FreeAOTRuntime(runtime);
+    free(CPU);
+    return status == LC4_OK || status == LC4_HALT ? 0 : 2;
+}
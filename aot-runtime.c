@@ -0,0 +1,74 @@
+/*
+ * aot-runtime.c: dispatch between translated blocks, and the interpreter for everything else
+ */
+
+#include "aot-runtime.h"
+#include <limits.h>
+
+AOTRuntime *CreateAOTRuntime(const AOTProgram *program, MachineState *CPU)
+{
+    AOTRuntime *runtime = (AOTRuntime *)calloc(1, sizeof(AOTRuntime));
+    for (int i = 0; i < program->numBlocks; i++)
+    {
+        const AOTBlock *block = &program->blocks[i];
+        if (memcmp(&CPU->memory[block->start], &program->code[block->code], block->length * sizeof(unsigned short int)) == 0)
+        {
+            runtime->blockAt[block->start] = block;
+        }
+        else
+        {
+            runtime->mismatched++;
+        }
+    }
+    return runtime;
+}
+
+void FreeAOTRuntime(AOTRuntime *runtime)
+{
+    free(runtime);
+}
+
+void InvalidateAOT(AOTRuntime *runtime, unsigned short int lo, unsigned short int hi)
+{
+    for (int pc = 0; pc < 65536; pc++)
+    {
+        const AOTBlock *block = runtime->blockAt[pc];
+        if (block != NULL && block->start <= hi && block->start + block->length - 1 >= lo)
+        {
+            runtime->blockAt[pc] = NULL;
+        }
+    }
+}
+
+int RunAOT(AOTRuntime *runtime, MachineState *CPU, unsigned long long stepLimit)
+{
+    // per-instruction observers, and store events, need the interpreter
+    int translated = !(CPU->icache || CPU->dcache || CPU->heatmap || CPU->snapshot || CPU->coverage ||
+                       CPU->traceSink || CPU->verbosity >= VERBOSITY_STORES);
+
+    while (CPU->instructionCount < stepLimit)
+    {
+        const AOTBlock *block = translated ? runtime->blockAt[CPU->PC] : NULL;
+        unsigned long long left = stepLimit - CPU->instructionCount;
+
+        // OS blocks need PSR[15]: without it, the interpreter raises the exception
+        if (block != NULL && block->length <= left && (block->start < 0x8000 || (CPU->PSR & 0x8000)))
+        {
+            int executed = block->run(CPU, left < INT_MAX ? (int)left : INT_MAX);
+            if (executed > 0)
+            {
+                runtime->blocksRun++;
+                runtime->translatedSteps += executed;
+                continue;
+            }
+        }
+
+        int status = UpdateMachineState(CPU, NULL);
+        if (status != LC4_OK)
+        {
+            return status;
+        }
+        runtime->interpretedSteps++;
+    }
+    return LC4_OK;
+}
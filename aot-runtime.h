@@ -0,0 +1,128 @@
+// aot-runtime.h: runtime of programs translated ahead of time by lc4aot. The translation is C with
+// one function per basic block (see disasm.h), the registers, PSR and control signals held in
+// locals and written back when the block exits. A block function returns the number of
+// instructions it executed, with CPU->PC at the next one; the machine is then exactly as the
+// interpreter would have left it.
+//
+// Whatever the translation can't do at full speed leaves the block and is run by the interpreter:
+// TRAPs, invalid opcodes, DIV or MOD by zero, and loads and stores that would fault or touch a
+// device (which includes every store to code, so code can't change under the translation). A
+// block ending in JMPR, JSRR or RTI goes where the register says; if no block was translated
+// there, the interpreter runs until the PC reaches one again.
+
+#ifndef AOT_RUNTIME_H
+#define AOT_RUNTIME_H
+
+#include "LC4.h"
+
+// Run the block at CPU->PC, at most budget instructions. Returns the number executed, 0 if the
+// first instruction has to be interpreted.
+typedef int (*AOTBlockFunction)(MachineState *CPU, int budget);
+
+typedef struct
+{
+    unsigned short int start;
+    unsigned short int length;
+    // the block's words, as they were when it was translated, are code[code ... code + length - 1]
+    unsigned int code;
+    AOTBlockFunction run;
+} AOTBlock;
+
+// the translation of a program; lc4aot names it LC4AOTProgram
+typedef struct
+{
+    const AOTBlock *blocks;
+    int numBlocks;
+    const unsigned short int *code;
+} AOTProgram;
+
+typedef struct
+{
+    // the block starting at each address, or NULL
+    const AOTBlock *blockAt[65536];
+
+    // blocks left out because memory doesn't hold the code they were translated from
+    int mismatched;
+
+    unsigned long long blocksRun;
+    unsigned long long translatedSteps;
+    unsigned long long interpretedSteps;
+} AOTRuntime;
+
+// Install the blocks of program whose code matches what is loaded in CPU
+AOTRuntime *CreateAOTRuntime(const AOTProgram *program, MachineState *CPU);
+void FreeAOTRuntime(AOTRuntime *runtime);
+
+// Drop every block with an instruction in lo..hi; call after anything but STR rewrites code memory
+void InvalidateAOT(AOTRuntime *runtime, unsigned short int lo, unsigned short int hi);
+
+// Run until the machine stops or instructionCount reaches stepLimit. Returns what
+// UpdateMachineState returned (LC4_OK at the step limit).
+int RunAOT(AOTRuntime *runtime, MachineState *CPU, unsigned long long stepLimit);
+
+/*
+ * The rest is used by the generated code.
+ */
+
+// the machine state a block keeps in locals
+#define AOT_LOCALS                                                                                       \
+    unsigned short int R0 = CPU->R[0], R1 = CPU->R[1], R2 = CPU->R[2], R3 = CPU->R[3], R4 = CPU->R[4], \
+                       R5 = CPU->R[5], R6 = CPU->R[6], R7 = CPU->R[7];                                   \
+    unsigned short int PSR = CPU->PSR, NZPVal = CPU->NZPVal, regInputVal = CPU->regInputVal;             \
+    unsigned short int dmemAddr = CPU->dmemAddr, dmemValue = CPU->dmemValue;                             \
+    unsigned char rsMux_CTL = CPU->rsMux_CTL, rtMux_CTL = CPU->rtMux_CTL, rdMux_CTL = CPU->rdMux_CTL;    \
+    unsigned char regFile_WE = CPU->regFile_WE, NZP_WE = CPU->NZP_WE, DATA_WE = CPU->DATA_WE;            \
+    int executed = 0
+
+// SetNZP of a 16-bit result
+#define AOT_SET_NZP(value)                                                                              \
+    do                                                                                                  \
+    {                                                                                                   \
+        NZPVal = (unsigned short int)(value) == 0 ? 2 : (((value) & 0x8000) ? 4 : 1);                   \
+        PSR = (PSR & 0xFFF8) | NZPVal;                                                                  \
+    } while (0)
+
+// would a load or store of address fault or need a device
+#define AOT_DATA_NEEDS_INTERPRETER(address)                                                             \
+    (((address) >= 0xA000 && !(PSR & 0x8000)) || (address) < 0x2000 ||                                 \
+     ((address) >= 0x8000 && (address) <= 0x9FFF) || CPU->mmioPage[(address) >> 8])
+
+// write the locals back and leave the block with the PC at next. Like WriteOut, the data signals
+// are cleared unless the last instruction stored.
+#define AOT_EXIT(next)                                                                                  \
+    do                                                                                                  \
+    {                                                                                                   \
+        CPU->R[0] = R0;                                                                                 \
+        CPU->R[1] = R1;                                                                                 \
+        CPU->R[2] = R2;                                                                                 \
+        CPU->R[3] = R3;                                                                                 \
+        CPU->R[4] = R4;                                                                                 \
+        CPU->R[5] = R5;                                                                                 \
+        CPU->R[6] = R6;                                                                                 \
+        CPU->R[7] = R7;                                                                                 \
+        CPU->PSR = PSR;                                                                                 \
+        CPU->NZPVal = NZPVal;                                                                           \
+        CPU->regInputVal = regInputVal;                                                                 \
+        CPU->dmemAddr = DATA_WE ? dmemAddr : 0;                                                         \
+        CPU->dmemValue = DATA_WE ? dmemValue : 0;                                                       \
+        CPU->rsMux_CTL = rsMux_CTL;                                                                     \
+        CPU->rtMux_CTL = rtMux_CTL;                                                                     \
+        CPU->rdMux_CTL = rdMux_CTL;                                                                     \
+        CPU->regFile_WE = regFile_WE;                                                                   \
+        CPU->NZP_WE = NZP_WE;                                                                           \
+        CPU->DATA_WE = DATA_WE;                                                                         \
+        CPU->PC = (next);                                                                               \
+        CPU->instructionCount += executed;                                                              \
+        return executed;                                                                                \
+    } while (0)
+
+// leave the block for the interpreter to run the instruction at pc
+#define AOT_SIDE_EXIT(pc)                                                                               \
+    do                                                                                                  \
+    {                                                                                                   \
+        if (executed == 0)                                                                              \
+            return 0;                                                                                   \
+        AOT_EXIT(pc);                                                                                   \
+    } while (0)
+
+#endif
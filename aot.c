@@ -0,0 +1,288 @@
+/*
+ * aot.c: translates basic blocks to C for aot-runtime.c
+ */
+
+#include "aot.h"
+#include "loader.h"
+
+// the control signals every instruction sets, as the interpreter sets them
+void emit_signals(FILE *output, int nzpWE, int dataWE, int regFileWE)
+{
+    fprintf(output, "    NZP_WE = %d;\n    DATA_WE = %d;\n    regFile_WE = %d;\n", nzpWE, dataWE, regFileWE);
+}
+
+/*
+ * Leave the block for target: straight back to the top if the block loops to itself and the
+ * budget allows another round.
+ */
+void emit_transfer(FILE *output, const BasicBlock *block, unsigned short int target, const char *indent)
+{
+    if (target == block->start)
+    {
+        fprintf(output, "%sif (executed + %d <= budget)\n%s    goto top;\n", indent, block->end - block->start + 1,
+                indent);
+    }
+    fprintf(output, "%sAOT_EXIT(0x%04X);\n", indent, target);
+}
+
+// result of an ALU instruction into Rd, with the NZP bits
+void emit_result(FILE *output, int rd, const char *format, int a, int b)
+{
+    fprintf(output, "    regInputVal = (unsigned short int)(");
+    fprintf(output, format, a, b);
+    fprintf(output, ");\n    R%d = regInputVal;\n    AOT_SET_NZP(R%d);\n", rd, rd);
+}
+
+/*
+ * One instruction. Returns 1 if it ended the block.
+ */
+int emit_instruction(FILE *output, const BasicBlock *block, unsigned short int pc, unsigned short int instruction)
+{
+    const DecodedInsn *d = &DecodeTable[instruction];
+    char text[DISASM_TEXT_LENGTH];
+    DisassembleInstruction(pc, instruction, text);
+    fprintf(output, "    // x%04X  %s\n", pc, text);
+
+    unsigned short int target = pc + 1 + d->imm;
+    switch (d->op)
+    {
+    case OP_BR:
+        emit_signals(output, 0, 0, 0);
+        fprintf(output, "    executed++;\n");
+        if (d->rd == 0)
+        {
+            return 0;
+        }
+        if (d->rd == 7)
+        {
+            emit_transfer(output, block, target, "    ");
+            return 1;
+        }
+        fprintf(output, "    if (PSR & %d)\n    {\n", d->rd);
+        emit_transfer(output, block, target, "        ");
+        fprintf(output, "    }\n    AOT_EXIT(0x%04X);\n", (unsigned short int)(pc + 1));
+        return 1;
+    case OP_ADD:
+    case OP_MUL:
+    case OP_SUB:
+    case OP_DIV:
+    case OP_ADDI:
+        if (d->op == OP_DIV)
+        {
+            // the interpreter does whatever it does with a zero divisor
+            fprintf(output, "    if (R%d == 0)\n        AOT_SIDE_EXIT(0x%04X);\n", d->rt, pc);
+        }
+        fprintf(output, "    rdMux_CTL = %d;\n    rsMux_CTL = %d;\n", d->rd, d->rs);
+        if (d->op == OP_ADDI)
+        {
+            emit_result(output, d->rd, "R%d + %d", d->rs, d->imm);
+        }
+        else
+        {
+            fprintf(output, "    rtMux_CTL = %d;\n", d->rt);
+            emit_result(output, d->rd,
+                        d->op == OP_ADD   ? "R%d + R%d"
+                        : d->op == OP_MUL ? "(unsigned int)R%d * R%d"
+                        : d->op == OP_SUB ? "R%d - R%d"
+                                          : "R%d / R%d",
+                        d->rs, d->rt);
+        }
+        emit_signals(output, 1, 0, 1);
+        break;
+    case OP_CMP:
+    case OP_CMPU:
+    case OP_CMPI:
+    case OP_CMPIU:
+        // signed and unsigned compares set the same bits in the interpreter
+        fprintf(output, "    rsMux_CTL = %d;\n", d->rd);
+        if (d->op == OP_CMP || d->op == OP_CMPU)
+        {
+            fprintf(output, "    rtMux_CTL = %d;\n    AOT_SET_NZP((unsigned short int)(R%d - R%d));\n", d->rt, d->rd, d->rt);
+        }
+        else
+        {
+            fprintf(output, "    AOT_SET_NZP((unsigned short int)(R%d - %d));\n", d->rd, d->imm);
+        }
+        emit_signals(output, 1, 0, 0);
+        break;
+    case OP_JSR:
+    case OP_JSRR:
+        emit_signals(output, 0, 0, 0);
+        // R7 is written first, so JSRR R7 jumps to the new R7 like in the interpreter
+        fprintf(output, "    R7 = 0x%04X;\n    executed++;\n", (unsigned short int)(pc + 1));
+        if (d->op == OP_JSR)
+        {
+            fprintf(output, "    AOT_EXIT(0x%04X);\n", target);
+        }
+        else
+        {
+            fprintf(output, "    rsMux_CTL = %d;\n    AOT_EXIT(R%d);\n", d->rs, d->rs);
+        }
+        return 1;
+    case OP_AND:
+    case OP_NOT:
+    case OP_OR:
+    case OP_XOR:
+    case OP_ANDI:
+        emit_signals(output, 1, 0, 1);
+        fprintf(output, "    rdMux_CTL = %d;\n    rsMux_CTL = %d;\n", d->rd, d->rs);
+        if (d->op == OP_ANDI)
+        {
+            emit_result(output, d->rd, "R%d & %d", d->rs, d->imm);
+        }
+        else
+        {
+            fprintf(output, "    rtMux_CTL = %d;\n", d->rt);
+            emit_result(output, d->rd,
+                        d->op == OP_NOT  ? "~R%d"
+                        : d->op == OP_OR ? "R%d | R%d"
+                        : d->op == OP_XOR ? "R%d ^ R%d"
+                                          : "R%d & R%d",
+                        d->rs, d->rt);
+        }
+        break;
+    case OP_LDR:
+    case OP_STR:
+        fprintf(output, "    address = (unsigned short int)(R%d + %d);\n", d->rs, d->imm);
+        fprintf(output, "    if (AOT_DATA_NEEDS_INTERPRETER(address))\n        AOT_SIDE_EXIT(0x%04X);\n", pc);
+        fprintf(output, "    rsMux_CTL = %d;\n", d->rs);
+        if (d->op == OP_LDR)
+        {
+            // like the interpreter, a load doesn't set the NZP bits despite NZP_WE
+            emit_signals(output, 1, 0, 1);
+            fprintf(output, "    rdMux_CTL = %d;\n    R%d = CPU->memory[address];\n    regInputVal = R%d;\n", d->rd,
+                    d->rd, d->rd);
+        }
+        else
+        {
+            emit_signals(output, 0, 1, 0);
+            fprintf(output,
+                    "    rtMux_CTL = %d;\n    dmemAddr = address;\n    dmemValue = R%d;\n"
+                    "    CPU->memory[address] = dmemValue;\n    CPU->storeGeneration++;\n",
+                    d->rd, d->rd);
+        }
+        break;
+    case OP_RTI:
+        fprintf(output, "    PSR &= 0x7FFF;\n");
+        emit_signals(output, 0, 0, 0);
+        fprintf(output, "    executed++;\n    AOT_EXIT(R7);\n");
+        return 1;
+    case OP_CONST:
+        emit_signals(output, 1, 0, 1);
+        fprintf(output, "    rdMux_CTL = %d;\n    R%d = 0x%04X;\n    regInputVal = R%d;\n    AOT_SET_NZP(R%d);\n", d->rd,
+                d->rd, (unsigned short int)d->imm, d->rd, d->rd);
+        break;
+    case OP_SLL:
+    case OP_SRL:
+    case OP_SRA:
+    case OP_MOD:
+        if (d->op == OP_MOD)
+        {
+            fprintf(output, "    if (R%d == 0)\n        AOT_SIDE_EXIT(0x%04X);\n", d->rt, pc);
+        }
+        emit_signals(output, 1, 0, 1);
+        fprintf(output, "    rdMux_CTL = %d;\n    rsMux_CTL = %d;\n", d->rd, d->rs);
+        if (d->op == OP_MOD)
+        {
+            fprintf(output, "    rtMux_CTL = %d;\n", d->rt);
+            emit_result(output, d->rd, "R%d %% R%d", d->rs, d->rt);
+        }
+        else
+        {
+            // SRA shifts in zeros too: the registers are unsigned in the interpreter
+            emit_result(output, d->rd, d->op == OP_SLL ? "R%d << %d" : "R%d >> %d", d->rs, d->imm);
+        }
+        break;
+    case OP_JMPR:
+        emit_signals(output, 0, 0, 0);
+        fprintf(output, "    rsMux_CTL = %d;\n    executed++;\n    AOT_EXIT(R%d);\n", d->rs, d->rs);
+        return 1;
+    case OP_JMP:
+        emit_signals(output, 0, 0, 0);
+        fprintf(output, "    executed++;\n");
+        emit_transfer(output, block, target, "    ");
+        return 1;
+    case OP_HICONST:
+        emit_signals(output, 1, 0, 1);
+        fprintf(output, "    rdMux_CTL = %d;\n    regInputVal = (R%d & 0xFF) | 0x%04X;\n    R%d = regInputVal;\n"
+                        "    AOT_SET_NZP(R%d);\n",
+                d->rd, d->rd, d->imm << 8, d->rd, d->rd);
+        break;
+    default:
+        // TRAP (privilege change, maybe HLE) and invalid opcodes
+        fprintf(output, "    AOT_SIDE_EXIT(0x%04X);\n", pc);
+        return 1;
+    }
+    fprintf(output, "    executed++;\n");
+    return 0;
+}
+
+void emit_block(FILE *output, const BasicBlock *block, MachineState *CPU)
+{
+    // a block whose branch or jump goes back to its own start loops in C (see emit_transfer)
+    const DecodedInsn *last = &DecodeTable[CPU->memory[block->end]];
+    int loops = (last->op == OP_JMP || (last->op == OP_BR && last->rd != 0)) &&
+                (unsigned short int)(block->end + 1 + last->imm) == block->start;
+    int accessesMemory = 0;
+    for (unsigned int pc = block->start; pc <= block->end; pc++)
+    {
+        unsigned char op = DecodeTable[CPU->memory[pc]].op;
+        accessesMemory |= op == OP_LDR || op == OP_STR;
+    }
+
+    fprintf(output, "\nint aot_x%04X(MachineState *CPU, int budget)\n{\n    AOT_LOCALS;\n", block->start);
+    if (accessesMemory)
+    {
+        fprintf(output, "    unsigned short int address;\n");
+    }
+    if (loops)
+    {
+        fprintf(output, "top:\n");
+    }
+    for (unsigned int pc = block->start; pc <= block->end; pc++)
+    {
+        if (emit_instruction(output, block, pc, CPU->memory[pc]))
+        {
+            fprintf(output, "}\n");
+            return;
+        }
+    }
+    // the next word starts another block
+    fprintf(output, "    AOT_EXIT(0x%04X);\n}\n", (unsigned short int)(block->end + 1));
+}
+
+int TranslateProgram(ControlFlowGraph *cfg, MachineState *CPU, const char *source, FILE *output)
+{
+    InitDecodeTable();
+    fprintf(output, "/*\n * Translated by lc4aot from %s\n */\n\n#include \"aot-runtime.h\"\n", source);
+
+    int instructions = 0;
+    for (int i = 0; i < cfg->numBlocks; i++)
+    {
+        emit_block(output, &cfg->blocks[i], CPU);
+        instructions += cfg->blocks[i].end - cfg->blocks[i].start + 1;
+    }
+
+    // the words each block was translated from, for the runtime to check against memory
+    fprintf(output, "\nconst unsigned short int aot_code[] = {");
+    int n = 0;
+    for (int i = 0; i < cfg->numBlocks; i++)
+    {
+        for (unsigned int pc = cfg->blocks[i].start; pc <= cfg->blocks[i].end; pc++, n++)
+        {
+            fprintf(output, "%s0x%04X,", n % 12 == 0 ? "\n    " : " ", CPU->memory[pc]);
+        }
+    }
+    fprintf(output, "\n    0};\n\nconst AOTBlock aot_blocks[] = {\n");
+    n = 0;
+    for (int i = 0; i < cfg->numBlocks; i++)
+    {
+        const BasicBlock *block = &cfg->blocks[i];
+        fprintf(output, "    {0x%04X, %d, %d, aot_x%04X},\n", block->start, block->end - block->start + 1, n,
+                block->start);
+        n += block->end - block->start + 1;
+    }
+    fprintf(output, "    {0, 0, 0, NULL}};\n\nconst AOTProgram LC4AOTProgram = {aot_blocks, %d, aot_code};\n",
+            cfg->numBlocks);
+    return instructions;
+}
@@ -0,0 +1,15 @@
+// aot.h: ahead-of-time translation of the loaded code to C. Every basic block of the control flow
+// graph (see disasm.h) becomes one C function with the same effect on the machine as the
+// interpreter, and the translation ends with the table of blocks the runtime needs (see
+// aot-runtime.h), named LC4AOTProgram.
+
+#ifndef AOT_H
+#define AOT_H
+
+#include "disasm.h"
+
+// Write the translation of every block in cfg to output. source goes in the header comment.
+// Returns the number of instructions translated.
+int TranslateProgram(ControlFlowGraph *cfg, MachineState *CPU, const char *source, FILE *output);
+
+#endif
@@ -0,0 +1,258 @@
+/*
+ * bench.c: benchmark harness for the simulator's engines.
+ * Runs a program several times per engine and reports what each phase costs the host per LC4
+ * instruction: wall time plus, where perf_event_open is allowed, cycles, instructions, IPC,
+ * branch mispredicts and cache misses.
+ */
+
+#include "LC4.h"
+#include "loader.h"
+#include "perf-counters.h"
+#include "superblock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+MachineState *CPU;
+
+typedef enum
+{
+    ENGINE_INTERPRETER, // UpdateMachineState, no trace
+    ENGINE_SUPERBLOCKS, // with the superblock cache
+    ENGINE_HLE,         // with OS traps serviced natively
+    ENGINE_TRACED,      // UpdateMachineState writing the text trace to /dev/null
+    NUM_ENGINES
+} Engine;
+
+const char *EngineNames[NUM_ENGINES] = {"interp", "superblocks", "hle", "traced"};
+
+typedef struct
+{
+    PerfSample sample;
+    unsigned long long instructions; // LC4 instructions over all runs
+    int status;
+} EngineResult;
+
+void PrintUsage()
+{
+    printf("Usage: ./bench [options] <object files>\n");
+    printf("  -runs <N>        runs per engine (default 5)\n");
+    printf("  -steps <N>       stop each run after N LC4 instructions (default 10000000)\n");
+    printf("  -engines <list>  engines to run, from interp,superblocks,hle,traced (default all)\n");
+}
+
+/*
+ * Load the object files into a fresh machine, without the loader's progress messages.
+ */
+int load_program(char **files, int numFiles)
+{
+    Reset(CPU);
+    ClearSignals(CPU);
+    NumSymbols = 0;
+    return LoadObjectFiles(files, numFiles, CPU);
+}
+
+/*
+ * One run of engine on a copy of the loaded machine, counted into result
+ */
+void run_engine(Engine engine, MachineState *loaded, unsigned long long steps, PerfCounters *counters, FILE *devnull,
+                EngineResult *result)
+{
+    memcpy(CPU, loaded, sizeof(MachineState));
+    CPU->verbosity = VERBOSITY_QUIET;
+    FILE *output = engine == ENGINE_TRACED ? devnull : NULL;
+    if (engine == ENGINE_SUPERBLOCKS)
+    {
+        CPU->superblocks = CreateSuperblockCache();
+        CPU->superblocks->stepLimit = steps;
+    }
+    if (engine == ENGINE_HLE)
+    {
+        CPU->hleTraps = 1;
+    }
+
+    int status = LC4_OK;
+    StartPerfCounters(counters);
+    while (status == LC4_OK && CPU->instructionCount < steps)
+    {
+        status = UpdateMachineState(CPU, output);
+    }
+    StopPerfCounters(counters, &result->sample);
+
+    result->instructions += CPU->instructionCount;
+    result->status = status;
+    if (CPU->superblocks != NULL)
+    {
+        FreeSuperblockCache(CPU->superblocks);
+        CPU->superblocks = NULL;
+    }
+}
+
+void print_header()
+{
+    printf("%-24s %10s %12s %12s %8s", "", "ns", "cycles", "insns", "IPC");
+    for (int i = PERF_BRANCH_MISSES; i < PERF_NUM_COUNTERS; i++)
+    {
+        printf(" %14s", PerfCounterNames[i]);
+    }
+    printf("\n");
+}
+
+/*
+ * One line of costs: sample divided by per (LC4 instructions, or loads for the loader)
+ */
+void print_costs(const char *name, PerfCounters *counters, const PerfSample *sample, double per)
+{
+    printf("%-24s %10.2f", name, per > 0 ? sample->seconds * 1e9 / per : 0);
+    for (int i = PERF_CYCLES; i < PERF_NUM_COUNTERS; i++)
+    {
+        if (i == PERF_BRANCH_MISSES)
+        {
+            if (PerfCounterAvailable(counters, PERF_CYCLES) && PerfCounterAvailable(counters, PERF_INSTRUCTIONS) &&
+                sample->value[PERF_CYCLES] > 0)
+                printf(" %8.2f", sample->value[PERF_INSTRUCTIONS] / sample->value[PERF_CYCLES]);
+            else
+                printf(" %8s", "-");
+        }
+        int width = i < PERF_BRANCH_MISSES ? 12 : 14;
+        if (PerfCounterAvailable(counters, i) && per > 0)
+            printf(" %*.3f", width, sample->value[i] / per);
+        else
+            printf(" %*s", width, "-");
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+    int runs = 5;
+    unsigned long long steps = 10000000;
+    int enabled[NUM_ENGINES] = {1, 1, 1, 1};
+    int argi = 1;
+    while (argi < argc && argv[argi][0] == '-')
+    {
+        if (strcmp(argv[argi], "-runs") == 0 && argi + 1 < argc)
+        {
+            runs = atoi(argv[++argi]);
+        }
+        else if (strcmp(argv[argi], "-steps") == 0 && argi + 1 < argc)
+        {
+            steps = strtoull(argv[++argi], NULL, 0);
+        }
+        else if (strcmp(argv[argi], "-engines") == 0 && argi + 1 < argc)
+        {
+            char *list = argv[++argi];
+            for (int e = 0; e < NUM_ENGINES; e++)
+            {
+                enabled[e] = 0;
+            }
+            for (char *name = strtok(list, ","); name != NULL; name = strtok(NULL, ","))
+            {
+                int e = 0;
+                while (e < NUM_ENGINES && strcmp(name, EngineNames[e]) != 0)
+                    e++;
+                if (e == NUM_ENGINES)
+                {
+                    printf("Unknown engine %s\n", name);
+                    return -1;
+                }
+                enabled[e] = 1;
+            }
+        }
+        else
+        {
+            printf("Unknown option %s\n", argv[argi]);
+            PrintUsage();
+            return -1;
+        }
+        argi++;
+    }
+    if (argi >= argc || runs < 1)
+    {
+        PrintUsage();
+        return -1;
+    }
+
+    CPU = (MachineState *)malloc(sizeof(MachineState));
+    MachineState *loaded = (MachineState *)malloc(sizeof(MachineState));
+    PerfCounters *counters = OpenPerfCounters();
+    FILE *devnull = fopen("/dev/null", "w");
+
+    // loader phase, which also leaves the machine to start every run from
+    PerfSample loader;
+    memset(&loader, 0, sizeof(loader));
+    for (int r = 0; r < runs; r++)
+    {
+        StartPerfCounters(counters);
+        int out = load_program(argv + argi, argc - argi);
+        StopPerfCounters(counters, &loader);
+        if (out != 0)
+        {
+            printf("Could not open %s\n", argv[argi]);
+            return 1;
+        }
+    }
+    memcpy(loaded, CPU, sizeof(MachineState));
+
+    EngineResult results[NUM_ENGINES];
+    memset(results, 0, sizeof(results));
+    for (int e = 0; e < NUM_ENGINES; e++)
+    {
+        for (int r = 0; r < runs && enabled[e]; r++)
+        {
+            run_engine(e, loaded, steps, counters, devnull, &results[e]);
+        }
+    }
+
+    int anyCounters = 0;
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+    {
+        anyCounters |= PerfCounterAvailable(counters, i);
+    }
+    printf("%d runs of at most %llu instructions each%s\n", runs, steps,
+           anyCounters ? "" : " (perf_event_open not permitted, wall time only)");
+
+    printf("\nper LC4 instruction:\n");
+    print_header();
+    for (int e = 0; e < NUM_ENGINES; e++)
+    {
+        if (enabled[e])
+        {
+            print_costs(EngineNames[e], counters, &results[e].sample, results[e].instructions);
+        }
+    }
+
+    // the text trace runs the same interpreter, so the difference is what WriteOut costs
+    if (enabled[ENGINE_INTERPRETER] && enabled[ENGINE_TRACED] &&
+        results[ENGINE_INTERPRETER].instructions == results[ENGINE_TRACED].instructions)
+    {
+        PerfSample writeOut;
+        double per = results[ENGINE_TRACED].instructions;
+        writeOut.seconds = results[ENGINE_TRACED].sample.seconds - results[ENGINE_INTERPRETER].sample.seconds;
+        for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+        {
+            writeOut.value[i] = results[ENGINE_TRACED].sample.value[i] - results[ENGINE_INTERPRETER].sample.value[i];
+        }
+        print_costs("WriteOut (traced-interp)", counters, &writeOut, per);
+    }
+
+    printf("\nper load:\n");
+    print_header();
+    print_costs("loader", counters, &loader, runs);
+
+    printf("\n");
+    for (int e = 0; e < NUM_ENGINES; e++)
+    {
+        if (enabled[e])
+        {
+            printf("%-12s %llu instructions per run, ended with: %s\n", EngineNames[e], results[e].instructions / runs,
+                   results[e].status == LC4_OK ? "step limit" : LC4StatusMessage(results[e].status));
+        }
+    }
+
+    fclose(devnull);
+    ClosePerfCounters(counters);
+    free(loaded);
+    free(CPU);
+    return 0;
+}
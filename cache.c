@@ -0,0 +1,237 @@
+/*
+ * cache.c: set-associative cache simulator
+ */
+
+#include "cache.h"
+
+// region of each 8K-word slice of memory
+static const unsigned char regionOf[8] = {
+    REGION_USER_CODE, REGION_USER_DATA, REGION_USER_DATA, REGION_USER_DATA,
+    REGION_OS_CODE, REGION_OS_DATA, REGION_OS_DATA, REGION_OS_DATA};
+
+static const char *regionNames[NUM_REGIONS] = {"user code", "user data", "OS code", "OS data"};
+
+// log2 of a power of 2, or -1 if x isn't one
+int log2_exact(unsigned int x)
+{
+    if (x == 0 || (x & (x - 1)) != 0)
+    {
+        return -1;
+    }
+    int n = 0;
+    while ((1u << n) != x)
+    {
+        n++;
+    }
+    return n;
+}
+
+CacheSim *CreateCache(const char *name, unsigned int sizeWords, unsigned int ways, unsigned int blockWords, ReplacementPolicy policy)
+{
+    if (log2_exact(sizeWords) < 0 || log2_exact(ways) < 0 || log2_exact(blockWords) < 0 ||
+        sizeWords > 65536 || ways > sizeWords || blockWords > sizeWords / ways)
+    {
+        return NULL;
+    }
+
+    CacheSim *cache = (CacheSim *)calloc(1, sizeof(CacheSim));
+    cache->name = name;
+    cache->sizeWords = sizeWords;
+    cache->ways = ways;
+    cache->blockWords = blockWords;
+    cache->policy = policy;
+    cache->blockShift = log2_exact(blockWords);
+    cache->sets = sizeWords / (ways * blockWords);
+    cache->setMask = cache->sets - 1;
+
+    int lines = cache->sets * ways;
+    cache->tags = (unsigned short int *)calloc(lines, sizeof(unsigned short int));
+    cache->valid = (unsigned char *)calloc(lines, 1);
+    cache->dirty = (unsigned char *)calloc(lines, 1);
+    cache->stamps = (unsigned long long *)calloc(lines, sizeof(unsigned long long));
+    cache->random = 0x2545F491;
+    cache->lastBlock = -1;
+
+    cache->pcHits = (unsigned long long *)calloc(65536, sizeof(unsigned long long));
+    cache->pcMisses = (unsigned long long *)calloc(65536, sizeof(unsigned long long));
+    return cache;
+}
+
+CacheSim *ParseCache(const char *name, const char *description)
+{
+    unsigned int sizeWords, ways, blockWords;
+    char policyName[16] = "lru";
+    if (sscanf(description, "%u:%u:%u:%15s", &sizeWords, &ways, &blockWords, policyName) < 3)
+    {
+        return NULL;
+    }
+
+    ReplacementPolicy policy;
+    if (strcmp(policyName, "lru") == 0)
+        policy = REPLACE_LRU;
+    else if (strcmp(policyName, "fifo") == 0)
+        policy = REPLACE_FIFO;
+    else if (strcmp(policyName, "random") == 0)
+        policy = REPLACE_RANDOM;
+    else
+        return NULL;
+
+    return CreateCache(name, sizeWords, ways, blockWords, policy);
+}
+
+void FreeCache(CacheSim *cache)
+{
+    free(cache->tags);
+    free(cache->valid);
+    free(cache->dirty);
+    free(cache->stamps);
+    free(cache->pcHits);
+    free(cache->pcMisses);
+    free(cache);
+}
+
+/*
+ * Look up address; on a miss, fill it into the set (write-allocate, write-back).
+ */
+int CacheAccess(CacheSim *cache, unsigned short int address, unsigned short int pc, int isWrite)
+{
+    int block = address >> cache->blockShift;
+    int region = regionOf[address >> 13];
+
+    // same block as the last access: it is still the most recently used line of its set
+    if (block == cache->lastBlock)
+    {
+        cache->dirty[cache->lastLine] |= isWrite;
+        cache->hits[region]++;
+        cache->pcHits[pc]++;
+        return 1;
+    }
+
+    unsigned int first = (block & cache->setMask) * cache->ways;
+    unsigned short int tag = block;
+    cache->clock++;
+
+    for (unsigned int line = first; line < first + cache->ways; line++)
+    {
+        if (cache->valid[line] && cache->tags[line] == tag)
+        {
+            if (cache->policy == REPLACE_LRU)
+            {
+                cache->stamps[line] = cache->clock;
+            }
+            cache->dirty[line] |= isWrite;
+            cache->lastBlock = block;
+            cache->lastLine = line;
+            cache->hits[region]++;
+            cache->pcHits[pc]++;
+            return 1;
+        }
+    }
+
+    // miss: use an empty line if there is one, otherwise pick a victim
+    unsigned int victim = first;
+    int found = 0;
+    for (unsigned int line = first; line < first + cache->ways; line++)
+    {
+        if (!cache->valid[line])
+        {
+            victim = line;
+            found = 1;
+            break;
+        }
+    }
+    if (!found)
+    {
+        if (cache->policy == REPLACE_RANDOM)
+        {
+            // xorshift32
+            cache->random ^= cache->random << 13;
+            cache->random ^= cache->random >> 17;
+            cache->random ^= cache->random << 5;
+            victim = first + (cache->random & (cache->ways - 1));
+        }
+        else
+        {
+            // LRU and FIFO both evict the oldest stamp
+            for (unsigned int line = first + 1; line < first + cache->ways; line++)
+            {
+                if (cache->stamps[line] < cache->stamps[victim])
+                {
+                    victim = line;
+                }
+            }
+        }
+        if (cache->dirty[victim])
+        {
+            cache->writebacks++;
+        }
+    }
+
+    cache->valid[victim] = 1;
+    cache->tags[victim] = tag;
+    cache->dirty[victim] = isWrite;
+    cache->stamps[victim] = cache->clock;
+    cache->lastBlock = block;
+    cache->lastLine = victim;
+    cache->misses[region]++;
+    cache->pcMisses[pc]++;
+    return 0;
+}
+
+// cache being reported, for compare_misses
+CacheSim *sortCache;
+
+// most misses first
+int compare_misses(const void *a, const void *b)
+{
+    unsigned long long x = sortCache->pcMisses[*(const unsigned short int *)a];
+    unsigned long long y = sortCache->pcMisses[*(const unsigned short int *)b];
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+void print_rate(FILE *output, const char *label, unsigned long long hits, unsigned long long misses)
+{
+    unsigned long long total = hits + misses;
+    fprintf(output, "%-10s %14llu %14llu %14llu %8.2f%%\n", label, total, hits, misses,
+            total ? 100.0 * misses / total : 0.0);
+}
+
+void WriteCacheReport(CacheSim *cache, FILE *output)
+{
+    static const char *policyNames[] = {"lru", "fifo", "random"};
+    fprintf(output, "%s: %u words, %u-way, %u-word blocks, %u sets, %s\n", cache->name, cache->sizeWords,
+            cache->ways, cache->blockWords, cache->sets, policyNames[cache->policy]);
+
+    fprintf(output, "%-10s %14s %14s %14s %9s\n", "region", "accesses", "hits", "misses", "miss rate");
+    unsigned long long hits = 0, misses = 0;
+    for (int region = 0; region < NUM_REGIONS; region++)
+    {
+        print_rate(output, regionNames[region], cache->hits[region], cache->misses[region]);
+        hits += cache->hits[region];
+        misses += cache->misses[region];
+    }
+    print_rate(output, "total", hits, misses);
+    fprintf(output, "writebacks: %llu\n", cache->writebacks);
+
+    unsigned short int *pcs = (unsigned short int *)malloc(65536 * sizeof(unsigned short int));
+    int n = 0;
+    for (int pc = 0; pc < 65536; pc++)
+    {
+        if (cache->pcHits[pc] + cache->pcMisses[pc] != 0)
+        {
+            pcs[n++] = pc;
+        }
+    }
+    sortCache = cache;
+    qsort(pcs, n, sizeof(unsigned short int), compare_misses);
+
+    fprintf(output, "\n%-10s %14s %14s %14s %9s\n", "PC", "accesses", "hits", "misses", "miss rate");
+    for (int i = 0; i < n; i++)
+    {
+        char label[8];
+        sprintf(label, "%04X", pcs[i]);
+        print_rate(output, label, cache->pcHits[pcs[i]], cache->pcMisses[pcs[i]]);
+    }
+    fprintf(output, "\n");
+    free(pcs);
+}
@@ -0,0 +1,72 @@
+// cache.h: set-associative cache simulator for the instruction fetch and LDR/STR streams.
+// Attach one as CPU->icache and/or CPU->dcache; UpdateMachineState then reports every fetch and
+// data access to it. Addresses and sizes are in 16-bit words.
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "LC4.h"
+
+typedef enum
+{
+    REPLACE_LRU,
+    REPLACE_FIFO,
+    REPLACE_RANDOM
+} ReplacementPolicy;
+
+// memory regions, for the per-region breakdown
+#define REGION_USER_CODE 0 // x0000-x1FFF
+#define REGION_USER_DATA 1 // x2000-x7FFF
+#define REGION_OS_CODE 2   // x8000-x9FFF
+#define REGION_OS_DATA 3   // xA000-xFFFF
+#define NUM_REGIONS 4
+
+typedef struct CacheSim
+{
+    const char *name;
+    unsigned int sizeWords;
+    unsigned int ways;
+    unsigned int blockWords;
+    ReplacementPolicy policy;
+
+    // derived geometry: block = address >> blockShift, set = block & setMask
+    unsigned int blockShift;
+    unsigned int sets;
+    unsigned int setMask;
+
+    // sets * ways lines; stamp is the last use (LRU) or fill time (FIFO)
+    unsigned short int *tags;
+    unsigned char *valid;
+    unsigned char *dirty;
+    unsigned long long *stamps;
+    unsigned long long clock;
+    unsigned int random;
+
+    // block of the most recent hit, so runs of accesses to one block skip the set search
+    int lastBlock;
+    int lastLine;
+
+    unsigned long long hits[NUM_REGIONS];
+    unsigned long long misses[NUM_REGIONS];
+    unsigned long long writebacks;
+
+    // per-PC counts (the PC of the instruction doing the access)
+    unsigned long long *pcHits;
+    unsigned long long *pcMisses;
+} CacheSim;
+
+// Create a cache. sizeWords, ways and blockWords must be powers of 2. Returns NULL if the geometry is invalid.
+CacheSim *CreateCache(const char *name, unsigned int sizeWords, unsigned int ways, unsigned int blockWords, ReplacementPolicy policy);
+
+// Create a cache from a "size:ways:block[:lru|fifo|random]" description, e.g. "1024:2:4:lru".
+CacheSim *ParseCache(const char *name, const char *description);
+
+void FreeCache(CacheSim *cache);
+
+// Simulate one access to address by the instruction at pc. Returns 1 on a hit.
+int CacheAccess(CacheSim *cache, unsigned short int address, unsigned short int pc, int isWrite);
+
+// Write hit/miss rates per region and per PC (most misses first).
+void WriteCacheReport(CacheSim *cache, FILE *output);
+
+#endif
@@ -0,0 +1,224 @@
+/*
+ * decode.c: builds the shared table of decoded instructions
+ */
+
+#include "decode.h"
+#include <pthread.h>
+
+DecodedInsn DecodeTable[65536];
+
+const char *DecodedOpNames[OP_INVALID + 1] = {
+    "BR", "ADD", "MUL", "SUB", "DIV", "ADD", "CMP", "CMPU", "CMPI", "CMPIU", "JSRR", "JSR", "AND", "NOT", "OR",
+    "XOR", "AND", "LDR", "STR", "RTI", "CONST", "SLL", "SRL", "SRA", "MOD", "JMPR", "JMP", "HICONST", "TRAP",
+    "INVALID"};
+
+// Laura's helper functions
+// Common bits of the opcode to retrieve
+
+unsigned char getReg1(unsigned short int instruction)
+{
+    // get the first register in the opcode (bits 9-11)
+    return (instruction >> 9) & 0x7;
+}
+
+unsigned char getReg2(unsigned short int instruction)
+{
+    // get the second register (bits 6-8)
+    return (instruction >> 6) & 0x7;
+}
+
+unsigned char getReg3(unsigned short int instruction)
+{
+    // get the third register (bits 0-2)
+    return instruction & 0x7;
+}
+
+short int sign_extend_5_to_16(short int num)
+{
+    // Check if the sign bit (5th bit) is set
+    if (num & 0x10)
+    {
+        // If sign bit is set, extend by setting higher bits to 1
+        return num | 0xFFE0; // 0xFFE0 has the higher 11 bits set to 1
+    }
+    else
+    {
+        // If sign bit is not set, return the number as is
+        return num;
+    }
+}
+
+short int sign_extend_6_to_16(short int num)
+{
+    // Check if the sign bit (6th bit) is set
+    if (num & 0x20)
+    {
+        // If sign bit is set, extend by setting higher bits to 1
+        return num | 0xFFC0; // 0xFFC0 has the higher 10 bits set to 1
+    }
+    else
+    {
+        // If sign bit is not set, return the number as is
+        return num;
+    }
+}
+
+short int sign_extend_9_to_16(short int num)
+{
+    // Check if the sign bit (9th bit) is set
+    if (num & 0x100)
+    {
+        // If sign bit is set, extend by setting higher bits to 1
+        return num | 0xFE00; // 0xFE00 has the higher 7 bits set to 1
+    }
+    else
+    {
+        // If sign bit is not set, return the number as is
+        return num;
+    }
+}
+
+short int sign_extend_11_to_16(short int num)
+{
+    // Check if the sign bit (11th bit) is set
+    if (num & 0x400)
+    {
+        // If sign bit is set, extend by setting higher bits to 1
+        return num | 0xF800; // 0xF800 has the higher 5 bits set to 1
+    }
+    else
+    {
+        // If sign bit is not set, return the number as is
+        return num;
+    }
+}
+
+//////////////////////////
+
+/*
+ * Decode one instruction word into its operation and operands.
+ */
+DecodedInsn decode(unsigned short int instruction)
+{
+    DecodedInsn d;
+    d.rd = getReg1(instruction);
+    d.rs = getReg2(instruction);
+    d.rt = getReg3(instruction);
+    d.imm = 0;
+
+    switch (instruction >> 12)
+    {
+    case 0:
+        // BR: condition in bits 9-11, PCoffset9
+        d.op = OP_BR;
+        d.imm = sign_extend_9_to_16(instruction & 0x1FF);
+        break;
+    case 1:
+        // ADD/MUL/SUB/DIV Rd Rs Rt, or ADD Rd Rs IMM5 when bit 5 is set
+        if ((instruction >> 5) & 0x1)
+        {
+            d.op = OP_ADDI;
+            d.imm = sign_extend_5_to_16(instruction & 0x1F);
+        }
+        else
+        {
+            static const unsigned char ops[4] = {OP_ADD, OP_MUL, OP_SUB, OP_DIV};
+            d.op = ops[(instruction >> 3) & 0x3];
+        }
+        break;
+    case 2:
+        // CMP/CMPU Rs Rt, CMPI/CMPIU Rs IMM7 (sub-opcode in bits 7-8)
+        {
+            static const unsigned char ops[4] = {OP_CMP, OP_CMPU, OP_CMPI, OP_CMPIU};
+            d.op = ops[(instruction >> 7) & 0x3];
+            d.imm = instruction & 0x7F;
+        }
+        break;
+    case 4:
+        // JSRR Rs, or JSR PCoffset11 when bit 11 is set
+        if ((instruction >> 11) & 0x1)
+        {
+            d.op = OP_JSR;
+            d.imm = sign_extend_11_to_16(instruction & 0x7FF);
+        }
+        else
+        {
+            d.op = OP_JSRR;
+        }
+        break;
+    case 5:
+        // AND Rd Rs IMM5 when bit 5 is set, otherwise AND/NOT/OR/XOR by bits 3-4
+        if ((instruction >> 5) & 0x1)
+        {
+            d.op = OP_ANDI;
+            d.imm = sign_extend_5_to_16(instruction & 0x1F);
+        }
+        else
+        {
+            static const unsigned char ops[4] = {OP_AND, OP_NOT, OP_OR, OP_XOR};
+            d.op = ops[(instruction >> 3) & 0x3];
+        }
+        break;
+    case 6:
+        d.op = OP_LDR;
+        d.imm = sign_extend_6_to_16(instruction & 0x3F);
+        break;
+    case 7:
+        d.op = OP_STR;
+        d.imm = sign_extend_6_to_16(instruction & 0x3F);
+        break;
+    case 8:
+        d.op = OP_RTI;
+        break;
+    case 9:
+        d.op = OP_CONST;
+        d.imm = sign_extend_9_to_16(instruction & 0x1FF);
+        break;
+    case 10:
+        // SLL/SRL/SRA Rd Rs UIMM4, MOD Rd Rs Rt (sub-opcode in bits 4-5)
+        {
+            static const unsigned char ops[4] = {OP_SLL, OP_SRL, OP_SRA, OP_MOD};
+            d.op = ops[(instruction >> 4) & 0x3];
+            d.imm = instruction & 0xF;
+        }
+        break;
+    case 12:
+        // JMPR Rs, or JMP PCoffset11 when bit 11 is set
+        if ((instruction >> 11) & 0x1)
+        {
+            d.op = OP_JMP;
+            d.imm = sign_extend_11_to_16(instruction & 0x7FF);
+        }
+        else
+        {
+            d.op = OP_JMPR;
+        }
+        break;
+    case 13:
+        d.op = OP_HICONST;
+        d.imm = instruction & 0xFF;
+        break;
+    case 15:
+        d.op = OP_TRAP;
+        d.imm = instruction & 0xFF;
+        break;
+    default:
+        d.op = OP_INVALID;
+        break;
+    }
+    return d;
+}
+
+void build_table()
+{
+    for (int i = 0; i < 65536; i++)
+    {
+        DecodeTable[i] = decode(i);
+    }
+}
+
+void InitDecodeTable()
+{
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, build_table);
+}
@@ -0,0 +1,75 @@
+// decode.h: table of every possible 16-bit LC4 instruction, decoded once.
+// DecodeTable[instruction] gives the operation and its pre-extracted operands, so executing an
+// instruction is one table lookup instead of re-extracting bit fields in every handler.
+// The table is read-only after InitDecodeTable and shared by every MachineState (and thread).
+
+#ifndef DECODE_H
+#define DECODE_H
+
+typedef enum
+{
+    OP_BR,
+    OP_ADD,
+    OP_MUL,
+    OP_SUB,
+    OP_DIV,
+    OP_ADDI,
+    OP_CMP,
+    OP_CMPU,
+    OP_CMPI,
+    OP_CMPIU,
+    OP_JSRR,
+    OP_JSR,
+    OP_AND,
+    OP_NOT,
+    OP_OR,
+    OP_XOR,
+    OP_ANDI,
+    OP_LDR,
+    OP_STR,
+    OP_RTI,
+    OP_CONST,
+    OP_SLL,
+    OP_SRL, // shift sub-opcode 1
+    OP_SRA, // shift sub-opcode 2
+    OP_MOD,
+    OP_JMPR,
+    OP_JMP,
+    OP_HICONST,
+    OP_TRAP,
+    OP_INVALID
+} DecodedOp;
+
+typedef struct
+{
+    unsigned char op; // DecodedOp
+
+    // register fields by bit position. Bits 9-11 are Rd for most instructions, but Rs for CMP*,
+    // Rt for STR and the NZP condition for BR.
+    unsigned char rd; // bits 9-11
+    unsigned char rs; // bits 6-8
+    unsigned char rt; // bits 0-2
+
+    // sign-extended IMM5/IMM6/IMM9/IMM11, UIMM4 shift amount, IMM7 of CMPI/CMPIU (not sign-extended,
+    // as the simulator has always treated it), UIMM8 of HICONST or the trap vector
+    short int imm;
+} DecodedInsn;
+
+extern DecodedInsn DecodeTable[65536];
+
+// assembler mnemonic of each DecodedOp (OP_ADDI and OP_ANDI are "ADD" and "AND")
+extern const char *DecodedOpNames[OP_INVALID + 1];
+
+// Build DecodeTable. Safe to call any number of times from any thread; only the first call does work.
+void InitDecodeTable();
+
+// Bit field helpers used to build the table.
+unsigned char getReg1(unsigned short int instruction);
+unsigned char getReg2(unsigned short int instruction);
+unsigned char getReg3(unsigned short int instruction);
+short int sign_extend_5_to_16(short int num);
+short int sign_extend_6_to_16(short int num);
+short int sign_extend_9_to_16(short int num);
+short int sign_extend_11_to_16(short int num);
+
+#endif
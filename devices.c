@@ -0,0 +1,391 @@
+/*
+ * devices.c: memory-mapped console, timer and framebuffer devices
+ */
+
+#include "devices.h"
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Map a device into the CPU's address space.
+ */
+int AttachDevice(MachineState *CPU, MMIODevice *device)
+{
+    if (CPU->numDevices == MAX_DEVICES)
+    {
+        return 1;
+    }
+    CPU->devices[CPU->numDevices] = device;
+    CPU->numDevices++;
+
+    // mark every page the device touches so LDR/STR know to dispatch
+    for (int page = device->first >> 8; page <= device->last >> 8; page++)
+    {
+        CPU->mmioPage[page] = 1;
+    }
+    return 0;
+}
+
+/*
+ * Detach and free every device.
+ */
+void FreeDevices(MachineState *CPU)
+{
+    for (int i = 0; i < CPU->numDevices; i++)
+    {
+        free(CPU->devices[i]->state);
+        free(CPU->devices[i]);
+    }
+    CPU->numDevices = 0;
+    memset(CPU->mmioPage, 0, sizeof(CPU->mmioPage));
+}
+
+MMIODevice *FindDevice(MachineState *CPU, const char *name)
+{
+    for (int i = 0; i < CPU->numDevices; i++)
+    {
+        if (strcmp(CPU->devices[i]->name, name) == 0)
+        {
+            return CPU->devices[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Dispatch a load from a device page. Addresses on the page that no device claims are plain memory.
+ */
+unsigned short int DeviceRead(MachineState *CPU, unsigned short int address)
+{
+    // a device can answer differently each time, e.g. the keyboard
+    CPU->storeGeneration++;
+    for (int i = 0; i < CPU->numDevices; i++)
+    {
+        MMIODevice *device = CPU->devices[i];
+        if (address >= device->first && address <= device->last)
+        {
+            return device->read(device, CPU, address);
+        }
+    }
+    return CPU->memory[address];
+}
+
+/*
+ * Dispatch a store to a device page.
+ */
+void DeviceWrite(MachineState *CPU, unsigned short int address, unsigned short int value)
+{
+    for (int i = 0; i < CPU->numDevices; i++)
+    {
+        MMIODevice *device = CPU->devices[i];
+        if (address >= device->first && address <= device->last)
+        {
+            device->write(device, CPU, address, value);
+            return;
+        }
+    }
+    CPU->memory[address] = value;
+}
+
+MMIODevice *NewDevice(const char *name, unsigned short int first, unsigned short int last, void *state)
+{
+    MMIODevice *device = (MMIODevice *)malloc(sizeof(MMIODevice));
+    device->name = name;
+    device->first = first;
+    device->last = last;
+    device->state = state;
+    return device;
+}
+
+//////////////// CONSOLE ///////////////////////////
+
+typedef struct
+{
+    int inFd; // -1 when input comes from the buffer below
+    FILE *out;
+    // character read ahead by a status poll, or -1
+    int pending;
+    int eof;
+    // set once the program asks for input after the end of it
+    int starved;
+    const unsigned char *input;
+    size_t inputLength;
+    size_t inputPos;
+} Console;
+
+// try to fill console->pending without blocking
+void console_poll(Console *console)
+{
+    if (console->pending >= 0 || console->eof)
+    {
+        return;
+    }
+    if (console->inFd < 0)
+    {
+        if (console->inputPos < console->inputLength)
+            console->pending = console->input[console->inputPos++];
+        else
+            console->eof = 1;
+        return;
+    }
+    struct pollfd pfd = {console->inFd, POLLIN, 0};
+    if (poll(&pfd, 1, 0) <= 0)
+    {
+        return;
+    }
+    unsigned char c;
+    if (read(console->inFd, &c, 1) == 1)
+    {
+        console->pending = c;
+    }
+    else
+    {
+        console->eof = 1;
+    }
+}
+
+unsigned short int console_read(MMIODevice *device, MachineState *CPU, unsigned short int address)
+{
+    Console *console = (Console *)device->state;
+    unsigned short int value = 0;
+    switch (address)
+    {
+    case OS_KBSR:
+        console_poll(console);
+        value = console->pending >= 0 ? 0x8000 : 0;
+        console->starved |= console->eof && console->pending < 0;
+        break;
+    case OS_KBDR:
+        console_poll(console);
+        if (console->pending >= 0)
+        {
+            value = console->pending;
+            console->pending = -1;
+        }
+        else
+        {
+            console->starved |= console->eof;
+        }
+        break;
+    case OS_ADSR:
+        // output never backs up
+        value = 0x8000;
+        break;
+    }
+    return value;
+}
+
+void console_write(MMIODevice *device, MachineState *CPU, unsigned short int address, unsigned short int value)
+{
+    Console *console = (Console *)device->state;
+    if (address == OS_ADDR && console->out != NULL)
+    {
+        fputc(value & 0xFF, console->out);
+    }
+}
+
+MMIODevice *CreateConsoleDevice(int inFd, FILE *out)
+{
+    Console *console = (Console *)calloc(1, sizeof(Console));
+    console->inFd = inFd;
+    console->out = out;
+    console->pending = -1;
+
+    MMIODevice *device = NewDevice("console", OS_KBSR, OS_ADDR + 1, console);
+    device->read = console_read;
+    device->write = console_write;
+    return device;
+}
+
+MMIODevice *CreateBufferConsoleDevice(FILE *out)
+{
+    return CreateConsoleDevice(-1, out);
+}
+
+void SetConsoleInput(MMIODevice *console, const unsigned char *data, size_t length)
+{
+    Console *state = (Console *)console->state;
+    state->input = data;
+    state->inputLength = length;
+    state->inputPos = 0;
+    state->pending = -1;
+    state->eof = 0;
+    state->starved = 0;
+}
+
+int ConsoleStarved(MMIODevice *console)
+{
+    return ((Console *)console->state)->starved;
+}
+
+unsigned short int ConsoleGetChar(MMIODevice *console)
+{
+    Console *state = (Console *)console->state;
+    if (state->inFd < 0)
+    {
+        console_poll(state);
+    }
+    if (state->pending < 0 && !state->eof)
+    {
+        unsigned char c;
+        if (read(state->inFd, &c, 1) == 1)
+        {
+            return c;
+        }
+        state->eof = 1;
+    }
+    if (state->pending < 0)
+    {
+        state->starved = 1;
+        return 0;
+    }
+    unsigned short int c = state->pending;
+    state->pending = -1;
+    return c;
+}
+
+void ConsolePutChar(MMIODevice *console, unsigned short int c)
+{
+    FILE *out = ((Console *)console->state)->out;
+    if (out != NULL)
+    {
+        fputc(c & 0xFF, out);
+    }
+}
+
+//////////////// TIMER ///////////////////////////
+
+typedef struct
+{
+    unsigned long instructionsPerMs;
+    unsigned short int interval;
+    // time (ms) the current interval started
+    double start;
+} Timer;
+
+double timer_now(Timer *timer, MachineState *CPU)
+{
+    if (timer->instructionsPerMs != 0)
+    {
+        return (double)CPU->instructionCount / timer->instructionsPerMs;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+unsigned short int timer_read(MMIODevice *device, MachineState *CPU, unsigned short int address)
+{
+    Timer *timer = (Timer *)device->state;
+    if (address == OS_TIR)
+    {
+        return timer->interval;
+    }
+    if (address == OS_TSR && timer->interval != 0)
+    {
+        double now = timer_now(timer, CPU);
+        if (now - timer->start >= timer->interval)
+        {
+            // reading the status clears it and starts the next interval
+            timer->start = now;
+            return 0x8000;
+        }
+    }
+    return 0;
+}
+
+void timer_write(MMIODevice *device, MachineState *CPU, unsigned short int address, unsigned short int value)
+{
+    Timer *timer = (Timer *)device->state;
+    if (address == OS_TIR)
+    {
+        timer->interval = value;
+        timer->start = timer_now(timer, CPU);
+    }
+}
+
+MMIODevice *CreateTimerDevice(unsigned long instructionsPerMs)
+{
+    Timer *timer = (Timer *)malloc(sizeof(Timer));
+    timer->instructionsPerMs = instructionsPerMs;
+    timer->interval = 0;
+    timer->start = 0;
+
+    MMIODevice *device = NewDevice("timer", OS_TSR, OS_TIR + 1, timer);
+    device->read = timer_read;
+    device->write = timer_write;
+    return device;
+}
+
+//////////////// FRAMEBUFFER ///////////////////////////
+
+unsigned short int framebuffer_read(MMIODevice *device, MachineState *CPU, unsigned short int address)
+{
+    return CPU->memory[address];
+}
+
+void framebuffer_write(MMIODevice *device, MachineState *CPU, unsigned short int address, unsigned short int value)
+{
+    Framebuffer *fb = (Framebuffer *)device->state;
+    CPU->memory[address] = value;
+    fb->writes++;
+    fb->changed = 1;
+
+    // grow the dirty region to cover this pixel
+    int row = (address - VIDEO_BASE) / VIDEO_COLS;
+    int col = (address - VIDEO_BASE) % VIDEO_COLS;
+    if (row < fb->dirtyTop)
+        fb->dirtyTop = row;
+    if (row > fb->dirtyBottom)
+        fb->dirtyBottom = row;
+    if (col < fb->dirtyLeft[row])
+        fb->dirtyLeft[row] = col;
+    if (col > fb->dirtyRight[row])
+        fb->dirtyRight[row] = col;
+}
+
+void ClearFramebufferDirty(Framebuffer *fb)
+{
+    fb->changed = 0;
+    fb->dirtyTop = VIDEO_ROWS;
+    fb->dirtyBottom = -1;
+    memset(fb->dirtyLeft, VIDEO_COLS - 1, sizeof(fb->dirtyLeft));
+    memset(fb->dirtyRight, 0, sizeof(fb->dirtyRight));
+}
+
+MMIODevice *CreateFramebufferDevice()
+{
+    Framebuffer *fb = (Framebuffer *)malloc(sizeof(Framebuffer));
+    fb->writes = 0;
+    ClearFramebufferDirty(fb);
+
+    MMIODevice *device = NewDevice("framebuffer", VIDEO_BASE, VIDEO_BASE + VIDEO_ROWS * VIDEO_COLS - 1, fb);
+    device->read = framebuffer_read;
+    device->write = framebuffer_write;
+    return device;
+}
+
+/*
+ * Pixels are RGB 5:5:5 (bits 14-10 red, 9-5 green, 4-0 blue). Scale each channel to 8 bits.
+ */
+void PixelToRGB(unsigned short int pixel, unsigned char *rgb)
+{
+    rgb[0] = ((pixel >> 10) & 0x1F) * 255 / 31;
+    rgb[1] = ((pixel >> 5) & 0x1F) * 255 / 31;
+    rgb[2] = (pixel & 0x1F) * 255 / 31;
+}
+
+/*
+ * Write the screen as a binary PPM.
+ */
+void WriteScreenPPM(MachineState *CPU, FILE *output)
+{
+    fprintf(output, "P6\n%d %d\n255\n", VIDEO_COLS, VIDEO_ROWS);
+    for (int i = 0; i < VIDEO_ROWS * VIDEO_COLS; i++)
+    {
+        unsigned char rgb[3];
+        PixelToRGB(CPU->memory[VIDEO_BASE + i], rgb);
+        fwrite(rgb, 1, 3, output);
+    }
+}
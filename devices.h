@@ -0,0 +1,101 @@
+// devices.h: memory-mapped I/O (MMIO) devices.
+// A device claims a range of addresses; LDR/STR to those addresses call the device instead of
+// touching memory directly. Only pages marked in CPU->mmioPage are checked, so ordinary loads
+// and stores cost one extra table lookup.
+
+#ifndef DEVICES_H
+#define DEVICES_H
+
+#include "LC4.h"
+
+// device registers, as laid out by the OS
+#define OS_KBSR 0xFE00 // keyboard status: bit 15 is set when a character is ready
+#define OS_KBDR 0xFE02 // keyboard data: reading it consumes the character
+#define OS_ADSR 0xFE04 // display status: bit 15 is set when the display is ready
+#define OS_ADDR 0xFE06 // display data: writing it prints a character
+#define OS_TSR 0xFE08  // timer status: bit 15 is set once the interval has elapsed (cleared on read)
+#define OS_TIR 0xFE0A  // timer interval in milliseconds
+
+// video memory: 128 columns x 124 rows of RGB 5:5:5 pixels from xC000 to xFDFF
+#define VIDEO_BASE 0xC000
+#define VIDEO_COLS 128
+#define VIDEO_ROWS 124
+
+typedef struct MMIODevice
+{
+    const char *name;
+
+    // addresses first..last (inclusive) belong to this device
+    unsigned short int first;
+    unsigned short int last;
+
+    // called for LDR/STR to the device's addresses
+    unsigned short int (*read)(struct MMIODevice *device, MachineState *CPU, unsigned short int address);
+    void (*write)(struct MMIODevice *device, MachineState *CPU, unsigned short int address, unsigned short int value);
+
+    // device specific state
+    void *state;
+} MMIODevice;
+
+// state of the framebuffer device
+typedef struct
+{
+    // number of stores to video memory, and whether any happened since the flag was last cleared
+    unsigned long long writes;
+    int changed;
+
+    // region written since the last ClearFramebufferDirty: rows dirtyTop..dirtyBottom, and within
+    // each row columns dirtyLeft[row]..dirtyRight[row]. A clean row has dirtyLeft > dirtyRight.
+    int dirtyTop;
+    int dirtyBottom;
+    unsigned char dirtyLeft[VIDEO_ROWS];
+    unsigned char dirtyRight[VIDEO_ROWS];
+} Framebuffer;
+
+// Map a device into CPU's address space. Returns 1 if there is no room for another device.
+int AttachDevice(MachineState *CPU, MMIODevice *device);
+
+// Detach and free every device.
+void FreeDevices(MachineState *CPU);
+
+// Find an attached device by name, or NULL.
+MMIODevice *FindDevice(MachineState *CPU, const char *name);
+
+// Called by LDR/STR when the address is on a page marked in CPU->mmioPage.
+unsigned short int DeviceRead(MachineState *CPU, unsigned short int address);
+void DeviceWrite(MachineState *CPU, unsigned short int address, unsigned short int value);
+
+// Console: keyboard reads come from file descriptor inFd, display writes go to out.
+MMIODevice *CreateConsoleDevice(int inFd, FILE *out);
+
+// Console whose keyboard input comes from memory set with SetConsoleInput (e.g. by the fuzzer).
+// Display writes go to out, or nowhere if it is NULL.
+MMIODevice *CreateBufferConsoleDevice(FILE *out);
+
+// Replace the console's input with length bytes at data (not copied) and clear its end of input.
+void SetConsoleInput(MMIODevice *console, const unsigned char *data, size_t length);
+
+// Nonzero once the program asked for a character after the end of the input
+int ConsoleStarved(MMIODevice *console);
+
+// Blocking console access used by the native trap handlers. ConsoleGetChar returns 0 at end of input.
+unsigned short int ConsoleGetChar(MMIODevice *console);
+void ConsolePutChar(MMIODevice *console, unsigned short int c);
+
+// Timer: if instructionsPerMs is nonzero the timer runs on simulated time (deterministic traces),
+// otherwise on wall clock time like PennSim.
+MMIODevice *CreateTimerDevice(unsigned long instructionsPerMs);
+
+// Framebuffer over video memory. Pixels live in CPU->memory; the device tracks stores to it.
+MMIODevice *CreateFramebufferDevice();
+
+// Mark the whole framebuffer clean.
+void ClearFramebufferDirty(Framebuffer *fb);
+
+// Convert an RGB 5:5:5 pixel to 8-bit red, green, blue.
+void PixelToRGB(unsigned short int pixel, unsigned char *rgb);
+
+// Write the current screen as a binary PPM image.
+void WriteScreenPPM(MachineState *CPU, FILE *output);
+
+#endif
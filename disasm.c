@@ -0,0 +1,384 @@
+/*
+ * disasm.c: disassembler, basic blocks and control flow graph of the loaded code
+ */
+
+#include "disasm.h"
+#include "loader.h"
+
+// the boot address Reset puts in the PC
+#define BOOT_ADDRESS 0x8200
+
+// could the word at address be fetched as an instruction (in either mode)
+int in_code_region(unsigned int address)
+{
+    return address < 0x2000 || (address >= 0x8000 && address <= 0x9FFF && address != 0x80FF);
+}
+
+int InstructionTarget(unsigned short int pc, unsigned short int instruction)
+{
+    const DecodedInsn *d = &DecodeTable[instruction];
+    switch (d->op)
+    {
+    case OP_BR:
+        return d->rd != 0 ? (unsigned short int)(pc + 1 + d->imm) : -1;
+    case OP_JMP:
+    case OP_JSR:
+        return (unsigned short int)(pc + 1 + d->imm);
+    case OP_TRAP:
+        return 0x8000 | d->imm;
+    default:
+        return -1;
+    }
+}
+
+/*
+ * A target as its label if there is one, otherwise as a hex address.
+ */
+void format_target(unsigned short int target, char *text)
+{
+    const char *name = SymbolAtAddress(target);
+    if (name != NULL)
+    {
+        snprintf(text, SYMBOL_NAME_LENGTH, "%s", name);
+    }
+    else
+    {
+        snprintf(text, SYMBOL_NAME_LENGTH, "x%04X", target);
+    }
+}
+
+void DisassembleInstruction(unsigned short int pc, unsigned short int instruction, char *text)
+{
+    InitDecodeTable();
+    const DecodedInsn *d = &DecodeTable[instruction];
+    const char *name = DecodedOpNames[d->op];
+    char target[SYMBOL_NAME_LENGTH];
+
+    switch (d->op)
+    {
+    case OP_BR:
+        if (d->rd == 0)
+        {
+            snprintf(text, DISASM_TEXT_LENGTH, "NOP");
+            break;
+        }
+        format_target(pc + 1 + d->imm, target);
+        snprintf(text, DISASM_TEXT_LENGTH, "BR%s%s%s %s", d->rd & 4 ? "n" : "", d->rd & 2 ? "z" : "", d->rd & 1 ? "p" : "", target);
+        break;
+    case OP_ADD:
+    case OP_MUL:
+    case OP_SUB:
+    case OP_DIV:
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+    case OP_MOD:
+        snprintf(text, DISASM_TEXT_LENGTH, "%s R%d, R%d, R%d", name, d->rd, d->rs, d->rt);
+        break;
+    case OP_ADDI:
+    case OP_ANDI:
+    case OP_LDR:
+    case OP_SLL:
+    case OP_SRL:
+    case OP_SRA:
+        snprintf(text, DISASM_TEXT_LENGTH, "%s R%d, R%d, #%d", name, d->rd, d->rs, d->imm);
+        break;
+    case OP_STR:
+        // bits 9-11 are the register stored
+        snprintf(text, DISASM_TEXT_LENGTH, "STR R%d, R%d, #%d", d->rd, d->rs, d->imm);
+        break;
+    case OP_NOT:
+        snprintf(text, DISASM_TEXT_LENGTH, "NOT R%d, R%d", d->rd, d->rs);
+        break;
+    case OP_CMP:
+    case OP_CMPU:
+        snprintf(text, DISASM_TEXT_LENGTH, "%s R%d, R%d", name, d->rd, d->rt);
+        break;
+    case OP_CMPI:
+    case OP_CMPIU:
+        snprintf(text, DISASM_TEXT_LENGTH, "%s R%d, #%d", name, d->rd, d->imm);
+        break;
+    case OP_JSRR:
+    case OP_JMPR:
+        snprintf(text, DISASM_TEXT_LENGTH, "%s R%d", name, d->rs);
+        break;
+    case OP_JSR:
+    case OP_JMP:
+        format_target(pc + 1 + d->imm, target);
+        snprintf(text, DISASM_TEXT_LENGTH, "%s %s", name, target);
+        break;
+    case OP_RTI:
+        snprintf(text, DISASM_TEXT_LENGTH, "RTI");
+        break;
+    case OP_CONST:
+        snprintf(text, DISASM_TEXT_LENGTH, "CONST R%d, #%d", d->rd, d->imm);
+        break;
+    case OP_HICONST:
+        snprintf(text, DISASM_TEXT_LENGTH, "HICONST R%d, x%02X", d->rd, d->imm);
+        break;
+    case OP_TRAP:
+        snprintf(text, DISASM_TEXT_LENGTH, "TRAP x%02X", d->imm);
+        break;
+    default:
+        snprintf(text, DISASM_TEXT_LENGTH, ".FILL x%04X", instruction);
+        break;
+    }
+}
+
+// does the instruction end a basic block, and can execution go on to the next word after it
+int ends_block(const DecodedInsn *d)
+{
+    return (d->op == OP_BR && d->rd != 0) || d->op == OP_JMP || d->op == OP_JMPR || d->op == OP_JSR ||
+           d->op == OP_JSRR || d->op == OP_RTI || d->op == OP_TRAP;
+}
+
+int falls_through(const DecodedInsn *d)
+{
+    // calls and traps come back to the next word
+    return !((d->op == OP_BR && d->rd == 7) || d->op == OP_JMP || d->op == OP_JMPR || d->op == OP_RTI);
+}
+
+/*
+ * Mark the code reachable from the addresses on the worklist. reached is set on every word found.
+ */
+void follow_flow(ControlFlowGraph *cfg, MachineState *CPU, unsigned short int *worklist, int count, unsigned char *reached)
+{
+    while (count > 0)
+    {
+        unsigned int pc = worklist[--count];
+        if (!in_code_region(pc))
+        {
+            continue;
+        }
+        cfg->isLeader[pc] = 1;
+
+        // walk straight through the code until the flow leaves it or meets code already found. A zero
+        // word is a NOP, but far more often the empty memory after a program, so it ends the walk too.
+        while (in_code_region(pc) && !reached[pc] && CPU->memory[pc] != 0)
+        {
+            reached[pc] = 1;
+            cfg->isCode[pc] = 1;
+            unsigned short int instruction = CPU->memory[pc];
+            const DecodedInsn *d = &DecodeTable[instruction];
+
+            int target = InstructionTarget(pc, instruction);
+            if (target >= 0 && in_code_region(target))
+            {
+                cfg->isLeader[target] = 1;
+                if (!reached[target])
+                {
+                    worklist[count++] = target;
+                }
+            }
+            if (ends_block(d))
+            {
+                if (!falls_through(d))
+                {
+                    break;
+                }
+                if (pc + 1 < 65536)
+                {
+                    cfg->isLeader[pc + 1] = 1;
+                }
+            }
+            pc++;
+        }
+    }
+}
+
+ControlFlowGraph *BuildControlFlowGraph(MachineState *CPU)
+{
+    InitDecodeTable();
+    ControlFlowGraph *cfg = (ControlFlowGraph *)calloc(1, sizeof(ControlFlowGraph));
+    cfg->blockAt = (int *)malloc(65536 * sizeof(int));
+    unsigned char *reached = (unsigned char *)calloc(65536, 1);
+    unsigned char *reachable = (unsigned char *)calloc(65536, 1);
+
+    // every word can be pushed at most once per pass (it is marked reached before its targets are)
+    unsigned short int *worklist = (unsigned short int *)malloc(65536 * 2 * sizeof(unsigned short int));
+    int count = 0;
+    worklist[count++] = BOOT_ADDRESS;
+    worklist[count++] = 0x0000;
+    for (int i = 0; i < NumSymbols; i++)
+    {
+        if (in_code_region(Symbols[i].address))
+        {
+            worklist[count++] = Symbols[i].address;
+        }
+    }
+    follow_flow(cfg, CPU, worklist, count, reached);
+    memcpy(reachable, reached, 65536);
+
+    // then whatever else looks like code: runs of nonzero words nothing jumps to
+    for (unsigned int pc = 0; pc < 65536; pc++)
+    {
+        if (in_code_region(pc) && !reached[pc] && CPU->memory[pc] != 0)
+        {
+            worklist[0] = pc;
+            follow_flow(cfg, CPU, worklist, 1, reached);
+        }
+    }
+    free(worklist);
+
+    // cut the code into blocks
+    int capacity = 256;
+    cfg->blocks = (BasicBlock *)malloc(capacity * sizeof(BasicBlock));
+    for (unsigned int pc = 0; pc < 65536; pc++)
+    {
+        cfg->blockAt[pc] = -1;
+    }
+    for (unsigned int pc = 0; pc < 65536; pc++)
+    {
+        if (!cfg->isCode[pc])
+        {
+            continue;
+        }
+        if (cfg->numBlocks == capacity)
+        {
+            capacity *= 2;
+            cfg->blocks = (BasicBlock *)realloc(cfg->blocks, capacity * sizeof(BasicBlock));
+        }
+        BasicBlock *block = &cfg->blocks[cfg->numBlocks];
+        memset(block, 0, sizeof(BasicBlock));
+        block->start = pc;
+        block->reachable = reachable[pc];
+
+        const DecodedInsn *d;
+        while (1)
+        {
+            cfg->blockAt[pc] = cfg->numBlocks;
+            d = &DecodeTable[CPU->memory[pc]];
+            if (ends_block(d) || pc + 1 >= 65536 || !cfg->isCode[pc + 1] || cfg->isLeader[pc + 1])
+            {
+                break;
+            }
+            pc++;
+        }
+        block->end = pc;
+
+        int target = InstructionTarget(pc, CPU->memory[pc]);
+        if (target >= 0)
+        {
+            block->edges[block->numEdges].target = target;
+            block->edges[block->numEdges++].kind = d->op == OP_BR    ? EDGE_BRANCH
+                                                   : d->op == OP_JMP ? EDGE_JUMP
+                                                   : d->op == OP_JSR ? EDGE_CALL
+                                                                     : EDGE_TRAP;
+        }
+        if (falls_through(d))
+        {
+            block->edges[block->numEdges].target = pc + 1;
+            block->edges[block->numEdges++].kind = EDGE_FALLTHROUGH;
+        }
+        block->indirect = d->op == OP_JMPR || d->op == OP_JSRR || d->op == OP_RTI;
+        cfg->numBlocks++;
+    }
+
+    free(reached);
+    free(reachable);
+    return cfg;
+}
+
+void FreeControlFlowGraph(ControlFlowGraph *cfg)
+{
+    free(cfg->blocks);
+    free(cfg->blockAt);
+    free(cfg);
+}
+
+const char *EdgeKindNames[] = {"fall through", "branch", "jump", "call", "trap"};
+
+void WriteListing(ControlFlowGraph *cfg, MachineState *CPU, FILE *output)
+{
+    for (int i = 0; i < cfg->numBlocks; i++)
+    {
+        BasicBlock *block = &cfg->blocks[i];
+        fprintf(output, "\n; block x%04X-x%04X%s%s", block->start, block->end, block->reachable ? "" : ", unreachable",
+                block->indirect ? ", indirect" : "");
+        for (int e = 0; e < block->numEdges; e++)
+        {
+            fprintf(output, "%s%s x%04X", e == 0 ? " -> " : ", ", EdgeKindNames[block->edges[e].kind],
+                    block->edges[e].target);
+        }
+        fprintf(output, "\n");
+
+        for (unsigned int pc = block->start; pc <= block->end; pc++)
+        {
+            for (int s = 0; s < NumSymbols; s++)
+            {
+                if (Symbols[s].address == pc)
+                {
+                    fprintf(output, "%s\n", Symbols[s].name);
+                }
+            }
+            char text[DISASM_TEXT_LENGTH];
+            DisassembleInstruction(pc, CPU->memory[pc], text);
+            fprintf(output, "    x%04X  %04X  %s\n", pc, CPU->memory[pc], text);
+        }
+    }
+}
+
+// print text inside a DOT string, escaped
+void dot_escape(FILE *output, const char *text)
+{
+    for (; *text; text++)
+    {
+        if (*text == '"' || *text == '\\')
+        {
+            fputc('\\', output);
+        }
+        fputc(*text, output);
+    }
+}
+
+void WriteControlFlowDot(ControlFlowGraph *cfg, MachineState *CPU, FILE *output)
+{
+    fprintf(output, "digraph cfg {\n    node [shape=box fontname=\"monospace\"];\n");
+    for (int i = 0; i < cfg->numBlocks; i++)
+    {
+        BasicBlock *block = &cfg->blocks[i];
+        fprintf(output, "    b%04X [label=\"", block->start);
+        const char *name = SymbolAtAddress(block->start);
+        if (name != NULL)
+        {
+            dot_escape(output, name);
+            fprintf(output, ":\\l");
+        }
+        for (unsigned int pc = block->start; pc <= block->end; pc++)
+        {
+            char text[DISASM_TEXT_LENGTH];
+            DisassembleInstruction(pc, CPU->memory[pc], text);
+            fprintf(output, "x%04X  ", pc);
+            dot_escape(output, text);
+            fprintf(output, "\\l");
+        }
+        fprintf(output, "\"%s];\n", block->reachable ? "" : " style=dashed");
+    }
+
+    // edges to addresses that aren't code (e.g. the halt address x80FF) get a plain node of their own
+    for (int i = 0; i < cfg->numBlocks; i++)
+    {
+        BasicBlock *block = &cfg->blocks[i];
+        for (int e = 0; e < block->numEdges; e++)
+        {
+            CFGEdge *edge = &block->edges[e];
+            int to = cfg->blockAt[edge->target];
+            if (to < 0)
+            {
+                fprintf(output, "    x%04X [shape=plaintext];\n    b%04X -> x%04X", edge->target, block->start,
+                        edge->target);
+            }
+            else
+            {
+                fprintf(output, "    b%04X -> b%04X", block->start, cfg->blocks[to].start);
+            }
+            if (edge->kind != EDGE_FALLTHROUGH)
+            {
+                fprintf(output, " [label=\"%s\"%s]", EdgeKindNames[edge->kind],
+                        edge->kind == EDGE_CALL || edge->kind == EDGE_TRAP ? " style=dashed" : "");
+            }
+            fprintf(output, ";\n");
+        }
+    }
+    fprintf(output, "}\n");
+}
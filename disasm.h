@@ -0,0 +1,73 @@
+// disasm.h: static analysis of a loaded machine. DisassembleInstruction turns one word into
+// assembler text; BuildControlFlowGraph finds the code in the code regions (x0000-x1FFF and
+// x8000-x9FFF) and splits it into basic blocks linked by their BR, JMP, JSR and TRAP targets.
+//
+// Code is found by following the control flow from the boot address (x8200), user code at x0000
+// and every label the object files define in a code region, up to the first zero word (a NOP,
+// but usually the empty memory after a program). Nonzero words no flow reaches are disassembled
+// too, as unreachable blocks. JMPR, JSRR and RTI go where a register says, so the graph can't
+// follow them; their blocks are marked indirect.
+
+#ifndef DISASM_H
+#define DISASM_H
+
+#include "LC4.h"
+#include "decode.h"
+
+typedef enum
+{
+    EDGE_FALLTHROUGH, // to the next word
+    EDGE_BRANCH,      // BR taken
+    EDGE_JUMP,        // JMP
+    EDGE_CALL,        // JSR
+    EDGE_TRAP         // TRAP, to the handler at x8000 + vector
+} EdgeKind;
+
+typedef struct
+{
+    unsigned short int target;
+    unsigned char kind; // EdgeKind
+} CFGEdge;
+
+typedef struct
+{
+    unsigned short int start;
+    unsigned short int end; // the last instruction, which is the only one that can transfer control
+    int numEdges;
+    CFGEdge edges[2];
+    unsigned char indirect;  // ends in JMPR, JSRR or RTI
+    unsigned char reachable; // the flow from an entry point gets here
+} BasicBlock;
+
+typedef struct
+{
+    unsigned char isCode[65536];
+    unsigned char isLeader[65536];
+
+    // blocks in address order; blockAt[address] is the index of the block holding address, or -1
+    BasicBlock *blocks;
+    int numBlocks;
+    int *blockAt;
+} ControlFlowGraph;
+
+// room for the longest instruction text: "BRnzp " and a label of SYMBOL_NAME_LENGTH
+#define DISASM_TEXT_LENGTH (SYMBOL_NAME_LENGTH + 16)
+
+// Assembler text of instruction at pc, e.g. "ADD R1, R2, #-3" or "BRnz x0012". Targets of BR, JMP
+// and JSR are given as labels when the object files define one there. text should hold
+// DISASM_TEXT_LENGTH characters.
+void DisassembleInstruction(unsigned short int pc, unsigned short int instruction, char *text);
+
+// The static target of a BR, JMP, JSR or TRAP at pc, or -1 for other instructions
+int InstructionTarget(unsigned short int pc, unsigned short int instruction);
+
+ControlFlowGraph *BuildControlFlowGraph(MachineState *CPU);
+void FreeControlFlowGraph(ControlFlowGraph *cfg);
+
+// Every block, labels first, then one instruction per line
+void WriteListing(ControlFlowGraph *cfg, MachineState *CPU, FILE *output);
+
+// The graph in Graphviz DOT, one node per block
+void WriteControlFlowDot(ControlFlowGraph *cfg, MachineState *CPU, FILE *output);
+
+#endif
@@ -1,8 +1,39 @@
 #include "file-loader.h"
+#include <stdarg.h>
 
 // current memory array location
 unsigned short int memoryAddress;
 
+// symbols of every object file read so far
+Symbol Symbols[MAX_SYMBOLS];
+int NumSymbols = 0;
+
+// set while LoadObjectFiles runs: no progress messages, and problems go to stderr
+int quietLoad = 0;
+
+void load_progress(const char *format, ...)
+{
+    if (!quietLoad)
+    {
+        va_list args;
+        va_start(args, format);
+        vprintf(format, args);
+        va_end(args);
+    }
+}
+
+void load_problem(const char *filename, const char *message)
+{
+    if (quietLoad)
+    {
+        fprintf(stderr, "%s: %s\n", filename, message);
+    }
+    else
+    {
+        printf("%s", message);
+    }
+}
+
 // convert hex characters of 2 words to an int
 // of the format "XX XX " where X is a hex digit. I want to extract the digits and convert to an int
 // max 16 bits
@@ -38,31 +69,47 @@ int ReadObjectFile(char *filename, MachineState *CPU)
                 if (buffer[0] == 0xC3 && buffer[1] == 0xB7)
                 {
                     // symbol
-                    printf("symbol\n");
+                    load_progress("symbol\n");
                     unsigned char buffer2[2];
                     // the next 2 words are the address
                     fread(buffer2, 1, sizeof(buffer2), file);
-                    // the next 2 words are the number of bytes to skip
+                    unsigned short int symbol_address = two_words_to_int(buffer2);
+                    // the next 2 words are the length of the name
                     fread(buffer2, 1, sizeof(buffer2), file);
                     int num_bytes_to_skip = two_words_to_int(buffer2);
-                    printf("skipping %d bytes\n", num_bytes_to_skip);
-                    fseek(file, num_bytes_to_skip, SEEK_CUR);
+                    load_progress("skipping %d bytes\n", num_bytes_to_skip);
+
+                    // keep the name for looking symbols up later; names that don't fit are skipped
+                    if (NumSymbols < MAX_SYMBOLS && num_bytes_to_skip < SYMBOL_NAME_LENGTH)
+                    {
+                        Symbol *symbol = &Symbols[NumSymbols];
+                        if (fread(symbol->name, 1, num_bytes_to_skip, file) == (size_t)num_bytes_to_skip)
+                        {
+                            symbol->name[num_bytes_to_skip] = '\0';
+                            symbol->address = symbol_address;
+                            NumSymbols++;
+                        }
+                    }
+                    else
+                    {
+                        fseek(file, num_bytes_to_skip, SEEK_CUR);
+                    }
                 }
                 else if (buffer[0] == 0xF1 && buffer[1] == 0x7E)
                 {
                     // number
-                    printf("number\n");
+                    load_progress("number\n");
                     // the next 2 words are the number of bytes to skip
                     unsigned char buffer2[2];
                     fread(buffer2, 1, sizeof(buffer2), file);
                     int num_bytes_to_skip = two_words_to_int(buffer2);
-                    printf("skipping %d bytes\n", num_bytes_to_skip);
+                    load_progress("skipping %d bytes\n", num_bytes_to_skip);
                     fseek(file, num_bytes_to_skip, SEEK_CUR);
                 }
                 else if (buffer[0] == 0x00 && buffer[1] == 0x00)
                 {
                     // end of file
-                    printf("end of file\n");
+                    load_progress("end of file\n");
                     break;
                 }
                 else if (buffer[0] == 0x71 && buffer[1] == 0x5E)
@@ -76,7 +123,7 @@ int ReadObjectFile(char *filename, MachineState *CPU)
                 }
                 else
                 {
-                    printf("invalid obj header.");
+                    load_problem(filename, "invalid obj header.");
                 }
                 continue;
             }
@@ -85,13 +132,13 @@ int ReadObjectFile(char *filename, MachineState *CPU)
         {
             // here we have start memory address
             start_address = two_words_to_int(buffer);
-            printf("start address: %04x\n", start_address);
+            load_progress("start address: %04x\n", start_address);
         }
         else if (i == 2)
         {
             // here we have number of instructions
             num_instructions = two_words_to_int(buffer);
-            printf("num instructions: %d\n", num_instructions);
+            load_progress("num instructions: %d\n", num_instructions);
         }
         else
         {
@@ -103,15 +150,15 @@ int ReadObjectFile(char *filename, MachineState *CPU)
             {
                 unsigned short int instruction = two_words_to_int(buffer);
                 // print the instruction
-                printf("%d ", i);
-                printf("%02x", buffer[0]);
-                printf("%02x ", buffer[1]);
-                printf("%04x ", instruction);
-                printf("%016b ", instruction);
-                printf("%04x ", memoryAddress);
+                load_progress("%d ", i);
+                load_progress("%02x", buffer[0]);
+                load_progress("%02x ", buffer[1]);
+                load_progress("%04x ", instruction);
+                load_progress("%016b ", instruction);
+                load_progress("%04x ", memoryAddress);
                 CPU->memory[memoryAddress] = instruction;
-                printf("%b", CPU->memory[memoryAddress]);
-                printf("\n");
+                load_progress("%b", CPU->memory[memoryAddress]);
+                load_progress("\n");
 
                 if (adjusted_i == num_instructions - 1)
                 {
@@ -121,7 +168,7 @@ int ReadObjectFile(char *filename, MachineState *CPU)
             }
             else
             {
-                printf("bleh we should not be here.");
+                load_problem(filename, "bleh we should not be here.");
             }
         }
         i++;
@@ -130,3 +177,56 @@ int ReadObjectFile(char *filename, MachineState *CPU)
     fclose(file);
     return 0;
 }
+
+int LoadObjectFiles(char **filenames, int numFiles, MachineState *CPU)
+{
+    quietLoad = 1;
+    int result = 0;
+    for (int i = 0; i < numFiles && result == 0; i++)
+    {
+        result = ReadObjectFile(filenames[i], CPU);
+        if (result != 0)
+        {
+            fprintf(stderr, "Could not load %s\n", filenames[i]);
+        }
+    }
+    quietLoad = 0;
+    return result;
+}
+
+int LookupSymbol(const char *name)
+{
+    for (int i = 0; i < NumSymbols; i++)
+    {
+        if (strcmp(Symbols[i].name, name) == 0)
+        {
+            return Symbols[i].address;
+        }
+    }
+    return -1;
+}
+
+int NextSymbolAddress(unsigned short int address)
+{
+    int next = -1;
+    for (int i = 0; i < NumSymbols; i++)
+    {
+        if (Symbols[i].address > address && (next < 0 || Symbols[i].address < next))
+        {
+            next = Symbols[i].address;
+        }
+    }
+    return next;
+}
+
+const char *SymbolAtAddress(unsigned short int address)
+{
+    for (int i = 0; i < NumSymbols; i++)
+    {
+        if (Symbols[i].address == address)
+        {
+            return Symbols[i].name;
+        }
+    }
+    return NULL;
+}
@@ -1,5 +1,32 @@
 #include <stdio.h>
 #include "LC4.h"
 
+// symbols (labels) found in the object files, in the order they were read
+#define MAX_SYMBOLS 4096
+#define SYMBOL_NAME_LENGTH 64
+
+typedef struct
+{
+    char name[SYMBOL_NAME_LENGTH];
+    unsigned short int address;
+} Symbol;
+
+extern Symbol Symbols[MAX_SYMBOLS];
+extern int NumSymbols;
+
 // Read an object file, load instructions into instruction register
-int ReadObjectFile(char *filename, MachineState *CPU);
\ No newline at end of file
+int ReadObjectFile(char *filename, MachineState *CPU);
+
+// Read the object files in order, stopping at the first that can't be opened. Unlike
+// ReadObjectFile, prints no progress to stdout; problems go to stderr with the file's name.
+// Returns 0 if every file was read.
+int LoadObjectFiles(char **filenames, int numFiles, MachineState *CPU);
+
+// Address of the symbol called name, or -1 if no object file defined it
+int LookupSymbol(const char *name);
+
+// Lowest symbol address above address, or -1 if there is none
+int NextSymbolAddress(unsigned short int address);
+
+// Name of the first symbol defined at address, or NULL if there is none
+const char *SymbolAtAddress(unsigned short int address);
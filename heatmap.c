@@ -0,0 +1,213 @@
+/*
+ * heatmap.c: per-epoch data memory access counts and working sets
+ */
+
+#include "heatmap.h"
+#include <limits.h>
+
+void put_u32(FILE *file, unsigned int value)
+{
+    unsigned char bytes[4] = {value & 0xFF, (value >> 8) & 0xFF, (value >> 16) & 0xFF, value >> 24};
+    fwrite(bytes, 1, 4, file);
+}
+
+void put_u64(FILE *file, unsigned long long value)
+{
+    put_u32(file, value & 0xFFFFFFFF);
+    put_u32(file, value >> 32);
+}
+
+int get_u32(FILE *file, unsigned int *value)
+{
+    unsigned char bytes[4];
+    if (fread(bytes, 1, 4, file) != 4)
+    {
+        return -1;
+    }
+    *value = bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (unsigned int)bytes[3] << 24;
+    return 0;
+}
+
+int get_u64(FILE *file, unsigned long long *value)
+{
+    unsigned int low, high;
+    if (get_u32(file, &low) != 0 || get_u32(file, &high) != 0)
+    {
+        return -1;
+    }
+    *value = low | (unsigned long long)high << 32;
+    return 0;
+}
+
+Heatmap *CreateHeatmap(const char *filename, unsigned long long epochLength)
+{
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL)
+    {
+        return NULL;
+    }
+
+    Heatmap *heatmap = (Heatmap *)calloc(1, sizeof(Heatmap));
+    heatmap->file = file;
+    heatmap->epochLength = epochLength != 0 ? epochLength : 1;
+    heatmap->epochEnd = heatmap->epochLength;
+
+    // the number of epochs is filled in by FinishHeatmap
+    fwrite(HEATMAP_MAGIC, 1, 8, file);
+    put_u64(file, heatmap->epochLength);
+    put_u32(file, HEATMAP_LINE_WORDS);
+    put_u32(file, 0);
+    return heatmap;
+}
+
+void write_epoch(Heatmap *heatmap)
+{
+    HeatmapEpoch *epoch = &heatmap->epoch;
+    put_u64(heatmap->file, epoch->start);
+    put_u64(heatmap->file, epoch->reads);
+    put_u64(heatmap->file, epoch->writes);
+    put_u32(heatmap->file, epoch->pagesTouched);
+    put_u32(heatmap->file, epoch->linesTouched);
+    for (int page = 0; page < HEATMAP_PAGES; page++)
+    {
+        put_u64(heatmap->file, epoch->pageAccesses[page]);
+    }
+    heatmap->numEpochs++;
+
+    memset(epoch, 0, sizeof(HeatmapEpoch));
+    epoch->start = heatmap->epochEnd;
+    heatmap->epochEnd += heatmap->epochLength;
+}
+
+void HeatmapAccess(Heatmap *heatmap, MachineState *CPU, unsigned short int address, int isWrite)
+{
+    // close every epoch that ended since the last access, including ones with no accesses
+    while (CPU->instructionCount >= heatmap->epochEnd)
+    {
+        write_epoch(heatmap);
+    }
+
+    HeatmapEpoch *epoch = &heatmap->epoch;
+    unsigned int stamp = heatmap->numEpochs + 1;
+    int page = address >> 8;
+    int line = address / HEATMAP_LINE_WORDS;
+
+    if (heatmap->pageStamp[page] != stamp)
+    {
+        heatmap->pageStamp[page] = stamp;
+        epoch->pagesTouched++;
+    }
+    if (heatmap->lineStamp[line] != stamp)
+    {
+        heatmap->lineStamp[line] = stamp;
+        epoch->linesTouched++;
+    }
+    epoch->pageAccesses[page]++;
+
+    if (isWrite)
+    {
+        epoch->writes++;
+        heatmap->lineWrites[line] += heatmap->lineWrites[line] != ULLONG_MAX;
+    }
+    else
+    {
+        epoch->reads++;
+        heatmap->lineReads[line] += heatmap->lineReads[line] != ULLONG_MAX;
+    }
+}
+
+void FinishHeatmap(Heatmap *heatmap, MachineState *CPU)
+{
+    while (CPU->instructionCount >= heatmap->epochEnd)
+    {
+        write_epoch(heatmap);
+    }
+    // the last, partial epoch
+    if (CPU->instructionCount > heatmap->epoch.start)
+    {
+        write_epoch(heatmap);
+    }
+
+    for (int line = 0; line < HEATMAP_LINES; line++)
+    {
+        put_u64(heatmap->file, heatmap->lineReads[line]);
+    }
+    for (int line = 0; line < HEATMAP_LINES; line++)
+    {
+        put_u64(heatmap->file, heatmap->lineWrites[line]);
+    }
+
+    fseek(heatmap->file, 20, SEEK_SET);
+    put_u32(heatmap->file, heatmap->numEpochs);
+    fclose(heatmap->file);
+    free(heatmap);
+}
+
+// size of an open file, leaving its position where it was; -1 if it can't be found
+long long file_size(FILE *file)
+{
+    long position = ftell(file);
+    if (position < 0 || fseek(file, 0, SEEK_END) != 0)
+    {
+        return -1;
+    }
+    long long size = ftell(file);
+    fseek(file, position, SEEK_SET);
+    return size;
+}
+
+HeatmapFile *ReadHeatmapFile(const char *filename)
+{
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL)
+    {
+        return NULL;
+    }
+
+    char magic[8];
+    HeatmapFile *heatmap = (HeatmapFile *)calloc(1, sizeof(HeatmapFile));
+    if (fread(magic, 1, 8, file) != 8 || memcmp(magic, HEATMAP_MAGIC, 8) != 0 || get_u64(file, &heatmap->epochLength) != 0 ||
+        get_u32(file, &heatmap->lineWords) != 0 || get_u32(file, &heatmap->numEpochs) != 0 ||
+        heatmap->lineWords != HEATMAP_LINE_WORDS ||
+        file_size(file) != HEATMAP_HEADER_BYTES + (long long)heatmap->numEpochs * HEATMAP_EPOCH_BYTES + HEATMAP_TOTALS_BYTES)
+    {
+        fclose(file);
+        free(heatmap);
+        return NULL;
+    }
+
+    heatmap->epochs = (HeatmapEpoch *)calloc(heatmap->numEpochs + 1, sizeof(HeatmapEpoch));
+    int error = 0;
+    for (unsigned int i = 0; i < heatmap->numEpochs && !error; i++)
+    {
+        HeatmapEpoch *epoch = &heatmap->epochs[i];
+        error |= get_u64(file, &epoch->start) | get_u64(file, &epoch->reads) | get_u64(file, &epoch->writes) |
+                 get_u32(file, &epoch->pagesTouched) | get_u32(file, &epoch->linesTouched);
+        for (int page = 0; page < HEATMAP_PAGES && !error; page++)
+        {
+            error |= get_u64(file, &epoch->pageAccesses[page]);
+        }
+    }
+    for (int line = 0; line < HEATMAP_LINES && !error; line++)
+    {
+        error |= get_u64(file, &heatmap->lineReads[line]);
+    }
+    for (int line = 0; line < HEATMAP_LINES && !error; line++)
+    {
+        error |= get_u64(file, &heatmap->lineWrites[line]);
+    }
+    fclose(file);
+
+    if (error)
+    {
+        FreeHeatmapFile(heatmap);
+        return NULL;
+    }
+    return heatmap;
+}
+
+void FreeHeatmapFile(HeatmapFile *heatmap)
+{
+    free(heatmap->epochs);
+    free(heatmap);
+}
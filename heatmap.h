@@ -0,0 +1,78 @@
+// heatmap.h: which data memory LDR/STR touch, and how that changes over time.
+// Execution is cut into epochs of a fixed number of instructions. For each epoch the heatmap
+// counts accesses per 256-word page and records the working set: how many distinct pages and
+// HEATMAP_LINE_WORDS-word lines were touched. Per-line read and write totals over the whole run
+// are kept too.
+//
+// File format (all integers little-endian):
+//   header:  "LC4HEAT3", u64 epoch length in instructions, u32 line size in words, u32 number of epochs
+//   epochs:  u64 first instruction, u64 reads, u64 writes, u32 pages touched, u32 lines touched,
+//            u64 accesses for each of the 256 pages
+//   totals:  u64 reads for each line, then u64 writes for each line (these stop at the maximum)
+
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+#include "LC4.h"
+
+#define HEATMAP_MAGIC "LC4HEAT3"
+#define HEATMAP_PAGES 256
+#define HEATMAP_LINE_WORDS 16
+#define HEATMAP_LINES (65536 / HEATMAP_LINE_WORDS)
+#define HEATMAP_HEADER_BYTES 24
+#define HEATMAP_EPOCH_BYTES (32 + 8 * HEATMAP_PAGES)
+#define HEATMAP_TOTALS_BYTES (16 * HEATMAP_LINES)
+
+typedef struct
+{
+    unsigned long long start;
+    unsigned long long reads;
+    unsigned long long writes;
+    unsigned int pagesTouched;
+    unsigned int linesTouched;
+    unsigned long long pageAccesses[HEATMAP_PAGES];
+} HeatmapEpoch;
+
+typedef struct Heatmap
+{
+    FILE *file;
+    unsigned long long epochLength;
+    unsigned int numEpochs;
+
+    // the epoch being counted, and the instruction count where it ends
+    HeatmapEpoch epoch;
+    unsigned long long epochEnd;
+
+    // epoch number + 1 of the last access to each page/line, to count each once per epoch
+    unsigned int pageStamp[HEATMAP_PAGES];
+    unsigned int lineStamp[HEATMAP_LINES];
+
+    unsigned long long lineReads[HEATMAP_LINES];
+    unsigned long long lineWrites[HEATMAP_LINES];
+} Heatmap;
+
+// Start a heatmap written to file, with epochs of epochLength instructions. Returns NULL if it can't be opened.
+Heatmap *CreateHeatmap(const char *filename, unsigned long long epochLength);
+
+// Count one LDR (isWrite 0) or STR (isWrite 1) at address
+void HeatmapAccess(Heatmap *heatmap, MachineState *CPU, unsigned short int address, int isWrite);
+
+// Write out the last epoch and the per-line totals, then close the file and free the heatmap.
+void FinishHeatmap(Heatmap *heatmap, MachineState *CPU);
+
+// Reading a heatmap file back
+typedef struct
+{
+    unsigned long long epochLength;
+    unsigned int lineWords;
+    unsigned int numEpochs;
+    HeatmapEpoch *epochs;
+    unsigned long long lineReads[HEATMAP_LINES];
+    unsigned long long lineWrites[HEATMAP_LINES];
+} HeatmapFile;
+
+// Returns NULL if the file can't be read or isn't a heatmap
+HeatmapFile *ReadHeatmapFile(const char *filename);
+void FreeHeatmapFile(HeatmapFile *heatmap);
+
+#endif
@@ -0,0 +1,80 @@
+/*
+ * lc4aot.c: translate the code of object files, as loaded, to C to be compiled and linked with
+ * aot-runtime.o and aot-main.c (see the readme)
+ */
+
+#include "loader.h"
+#include "aot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Global variable defining the current state of the machine
+MachineState *CPU;
+
+void PrintUsage()
+{
+    printf("Usage: ./lc4aot [-o <file.c>] <file1.obj> [file2.obj] ...\n");
+    printf("  -o <file.c>  write the translation to file instead of stdout\n");
+}
+
+int main(int argc, char **argv)
+{
+    char *output_filename = NULL;
+    int argi = 1;
+    while (argi < argc && argv[argi][0] == '-')
+    {
+        if (strcmp(argv[argi], "-o") == 0 && argi + 1 < argc)
+        {
+            output_filename = argv[++argi];
+        }
+        else
+        {
+            PrintUsage();
+            return -1;
+        }
+        argi++;
+    }
+    if (argi >= argc)
+    {
+        PrintUsage();
+        return -1;
+    }
+
+    CPU = (MachineState *)malloc(sizeof(MachineState));
+    Reset(CPU);
+    ClearSignals(CPU);
+
+    // the loader's progress messages would end up in the translation
+    if (LoadObjectFiles(argv + argi, argc - argi, CPU) != 0)
+    {
+        return 1;
+    }
+    char source[1024] = "";
+    for (int i = argi; i < argc; i++)
+    {
+        if (strlen(source) + strlen(argv[i]) + 2 < sizeof(source))
+        {
+            strcat(source, i > argi ? " " : "");
+            strcat(source, argv[i]);
+        }
+    }
+
+    FILE *output = output_filename != NULL ? fopen(output_filename, "w") : stdout;
+    if (output == NULL)
+    {
+        perror("Error opening output file");
+        return 1;
+    }
+    ControlFlowGraph *cfg = BuildControlFlowGraph(CPU);
+    int instructions = TranslateProgram(cfg, CPU, source, output);
+    if (output != stdout)
+    {
+        fclose(output);
+    }
+    fprintf(stderr, "%d instructions in %d blocks translated\n", instructions, cfg->numBlocks);
+
+    FreeControlFlowGraph(cfg);
+    free(CPU);
+    return 0;
+}
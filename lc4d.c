@@ -0,0 +1,647 @@
+/*
+ * lc4d.c: long-running simulator server. Runs jobs sent over a Unix socket on warm machines.
+ *
+ * Every worker thread owns one MachineState for its whole life, so a job costs no malloc and
+ * no Reset: the machine is copied from a cached image of its object files, already loaded
+ * into a reset machine. Images are keyed by the file names, sizes and modification times, so
+ * a rebuilt object file is loaded again.
+ *
+ * The main thread accepts connections and polls the idle ones. A whole request line hands its
+ * connection to a worker for that one request, so a client that keeps its connection open
+ * without sending anything doesn't tie up a worker.
+ *
+ * Protocol: one request per line, one reply line per request. A connection can send any
+ * number of requests.
+ *
+ *   run [out=<file>] [mode=text|binary] [verify=<trace>] [steps=<N>] [seconds=<S>] [loops=1]
+ *       <file1.obj> [file2.obj] ...
+ *     -> done status=<LC4Status> steps=<N> pc=<PC> psr=<PSR> faultpc=<PC> faultaddr=<addr>
+ *             cached=<0|1> mismatch=<0|1> usec=<N> msg=<LC4StatusMessage or "trace mismatch">
+ *   stats -> stats jobs=<N> hits=<N> misses=<N> images=<N>
+ *   shutdown -> bye, and the server exits
+ * Errors are replied as "error <message>".
+ * steps= stops a job with LC4_STEP_LIMIT after N steps, seconds= with LC4_TIME_LIMIT after S
+ * seconds, and loops=1 stops it with LC4_INFINITE_LOOP once it is provably stuck (see watchdog.h).
+ * A job still running at shutdown stops with LC4_ABORTED.
+ *
+ * Jobs run without devices or HLE traps; the machine has nothing to talk to but its trace.
+ */
+
+#include "loader.h"
+#include "trace-record.h"
+#include "watchdog.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define MAX_IMAGES 16
+#define MAX_JOB_FILES 16
+#define MAX_WORKERS 64
+#define MAX_CONNECTIONS 256
+#define REPLY_TIMEOUT_SECONDS 10
+#define REQUEST_LENGTH 4096
+#define IMAGE_KEY_LENGTH (REQUEST_LENGTH + MAX_JOB_FILES * 48)
+
+// object files loaded into a reset machine
+typedef struct
+{
+    char key[IMAGE_KEY_LENGTH];
+    MachineState *machine;
+    unsigned long long lastUse;
+} Image;
+
+Image images[MAX_IMAGES];
+int numImages = 0;
+unsigned long long imageClock = 0;
+unsigned long long jobs = 0, hits = 0, misses = 0;
+pthread_mutex_t imageLock = PTHREAD_MUTEX_INITIALIZER;
+
+// a machine straight after Reset, copied instead of calling Reset again
+MachineState *resetTemplate;
+
+int listenFd;
+_Atomic int shuttingDown = 0;
+
+// an open client connection. The poller reads requests from it while it's idle; a worker owns it
+// (busy) while one of its requests runs.
+typedef struct
+{
+    int fd; // -1 if the slot is free
+    int busy;
+    char buffer[REQUEST_LENGTH];
+    int length;
+} Connection;
+
+Connection connections[MAX_CONNECTIONS];
+pthread_mutex_t connectionLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t requestReady = PTHREAD_COND_INITIALIZER;
+
+// busy connections with a request line buffered, oldest first
+Connection *readyQueue[MAX_CONNECTIONS];
+int readyHead = 0, readyCount = 0;
+
+// written to wake the poller when a connection goes back to idle, or at shutdown
+int wakePipe[2];
+
+typedef struct
+{
+    char *output;
+    int binary;
+    char *verify;
+    unsigned long long steps;
+    double seconds;
+    int detectLoops;
+    char *files[MAX_JOB_FILES];
+    int numFiles;
+} Job;
+
+unsigned long long now_usec()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (unsigned long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/*
+ * Build the cache key of a set of files: each name with its size and mtime. Returns -1 if one can't be stat'ed.
+ */
+int image_key(Job *job, char *key)
+{
+    int n = 0;
+    key[0] = '\0';
+    for (int i = 0; i < job->numFiles; i++)
+    {
+        struct stat st;
+        if (stat(job->files[i], &st) != 0)
+        {
+            return -1;
+        }
+        n += snprintf(key + n, IMAGE_KEY_LENGTH - n, "%s:%lld:%lld.%09ld;", job->files[i], (long long)st.st_size,
+                      (long long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+        if (n >= IMAGE_KEY_LENGTH)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Copy the loaded image of the job's files into machine, loading and caching it on a miss.
+ * Returns 1 on a cache hit, 0 on a miss, -1 if a file can't be read.
+ */
+int load_image(Job *job, MachineState *machine)
+{
+    char key[IMAGE_KEY_LENGTH];
+    if (image_key(job, key) != 0)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&imageLock);
+    imageClock++;
+    for (int i = 0; i < numImages; i++)
+    {
+        if (strcmp(images[i].key, key) == 0)
+        {
+            images[i].lastUse = imageClock;
+            memcpy(machine, images[i].machine, sizeof(MachineState));
+            hits++;
+            pthread_mutex_unlock(&imageLock);
+            return 1;
+        }
+    }
+
+    // the loader keeps global state, so loading stays under the lock too. It loads quietly:
+    // nothing else in the server writes to stdout, which may be a pipe nobody reads.
+    memcpy(machine, resetTemplate, sizeof(MachineState));
+    NumSymbols = 0;
+    if (LoadObjectFiles(job->files, job->numFiles, machine) != 0)
+    {
+        pthread_mutex_unlock(&imageLock);
+        return -1;
+    }
+
+    // cache it, replacing the least recently used image when full
+    Image *image;
+    if (numImages < MAX_IMAGES)
+    {
+        image = &images[numImages++];
+        image->machine = (MachineState *)malloc(sizeof(MachineState));
+    }
+    else
+    {
+        image = &images[0];
+        for (int i = 1; i < MAX_IMAGES; i++)
+        {
+            if (images[i].lastUse < image->lastUse)
+                image = &images[i];
+        }
+    }
+    strcpy(image->key, key);
+    image->lastUse = imageClock;
+    memcpy(image->machine, machine, sizeof(MachineState));
+    misses++;
+    pthread_mutex_unlock(&imageLock);
+    return 0;
+}
+
+/*
+ * Split a run request into a job. Returns an error message, or NULL.
+ */
+const char *parse_job(char *request, Job *job)
+{
+    memset(job, 0, sizeof(Job));
+    job->steps = ~0ULL;
+
+    char *save;
+    for (char *word = strtok_r(request, " \t\r\n", &save); word != NULL; word = strtok_r(NULL, " \t\r\n", &save))
+    {
+        if (strncmp(word, "out=", 4) == 0)
+            job->output = word + 4;
+        else if (strcmp(word, "mode=text") == 0)
+            job->binary = 0;
+        else if (strcmp(word, "mode=binary") == 0)
+            job->binary = 1;
+        else if (strncmp(word, "verify=", 7) == 0)
+            job->verify = word + 7;
+        else if (strncmp(word, "steps=", 6) == 0)
+            job->steps = strtoull(word + 6, NULL, 0);
+        else if (strncmp(word, "seconds=", 8) == 0)
+            job->seconds = atof(word + 8);
+        else if (strncmp(word, "loops=", 6) == 0)
+            job->detectLoops = atoi(word + 6);
+        else if (strchr(word, '=') != NULL)
+            return "unknown option";
+        else if (job->numFiles == MAX_JOB_FILES)
+            return "too many files";
+        else
+            job->files[job->numFiles++] = word;
+    }
+    if (job->numFiles == 0)
+    {
+        return "no object files";
+    }
+    if (job->verify != NULL && job->output != NULL && job->binary)
+    {
+        return "verify can't be combined with a binary trace";
+    }
+    return NULL;
+}
+
+/*
+ * Run one job on machine and write the reply line into reply.
+ */
+void run_job(Job *job, MachineState *machine, char *reply, size_t size)
+{
+    unsigned long long start = now_usec();
+    int cached = load_image(job, machine);
+    if (cached < 0)
+    {
+        snprintf(reply, size, "error can't read the object files\n");
+        return;
+    }
+    machine->verbosity = VERBOSITY_QUIET;
+
+    FILE *output = NULL;
+    if (job->output != NULL && (output = fopen(job->output, "w")) == NULL)
+    {
+        snprintf(reply, size, "error can't open %s: %s\n", job->output, strerror(errno));
+        return;
+    }
+    FILE *text = output;
+    if (output != NULL && job->binary)
+    {
+        WriteTraceHeader(output);
+        machine->traceSink = BinaryTraceSink;
+        machine->traceContext = output;
+        text = NULL;
+    }
+
+    // mismatches are reported in the reply, not on a stream
+    FILE *report = fopen("/dev/null", "w");
+    TraceVerifier *verifier = NULL;
+    if (job->verify != NULL && (verifier = CreateTraceVerifier(machine, job->verify, report)) == NULL)
+    {
+        snprintf(reply, size, "error can't open %s\n", job->verify);
+        if (output != NULL)
+            fclose(output);
+        fclose(report);
+        return;
+    }
+
+    Watchdog *watchdog = NULL;
+    if (job->seconds > 0 || job->detectLoops)
+    {
+        watchdog = CreateWatchdog(0, job->seconds, job->detectLoops);
+    }
+
+    int status = LC4_OK;
+    while (machine->instructionCount < job->steps)
+    {
+        unsigned short int pc = machine->PC;
+        status = UpdateMachineState(machine, text);
+        if (status != LC4_OK || (verifier != NULL && verifier->mismatch))
+        {
+            break;
+        }
+        if (watchdog != NULL && (status = WatchdogStep(watchdog, machine, pc)) != LC4_OK)
+        {
+            break;
+        }
+        // a job with no budget may never stop; don't let it hold up a shutdown
+        if ((machine->instructionCount & 0xFFFF) == 0 && shuttingDown)
+        {
+            status = LC4_ABORTED;
+            break;
+        }
+    }
+    if (watchdog != NULL)
+    {
+        FreeWatchdog(watchdog);
+    }
+    if (status == LC4_OK && machine->instructionCount >= job->steps)
+    {
+        status = LC4_STEP_LIMIT;
+    }
+
+    int mismatch = verifier != NULL ? FinishTraceVerifier(verifier, machine, status >= LC4_STEP_LIMIT) : 0;
+    fclose(report);
+    if (output != NULL)
+    {
+        fclose(output);
+    }
+
+    snprintf(reply, size,
+             "done status=%d steps=%llu pc=%04X psr=%04X faultpc=%04X faultaddr=%04X cached=%d mismatch=%d usec=%llu msg=%s\n",
+             status, machine->instructionCount, machine->PC, machine->PSR, machine->faultPC, machine->faultAddr, cached,
+             mismatch, now_usec() - start,
+             mismatch ? "trace mismatch" : LC4StatusMessage(status));
+}
+
+/*
+ * Answer one request line on fd. Returns 0 if it was shutdown.
+ */
+int handle_request(char *request, int fd, MachineState *machine)
+{
+    char reply[512];
+    if (strncmp(request, "run ", 4) == 0)
+    {
+        Job job;
+        const char *error = parse_job(request + 4, &job);
+        if (error != NULL)
+        {
+            snprintf(reply, sizeof(reply), "error %s\n", error);
+        }
+        else
+        {
+            run_job(&job, machine, reply, sizeof(reply));
+            pthread_mutex_lock(&imageLock);
+            jobs++;
+            pthread_mutex_unlock(&imageLock);
+        }
+    }
+    else if (strncmp(request, "stats", 5) == 0)
+    {
+        pthread_mutex_lock(&imageLock);
+        snprintf(reply, sizeof(reply), "stats jobs=%llu hits=%llu misses=%llu images=%d\n", jobs, hits, misses,
+                 numImages);
+        pthread_mutex_unlock(&imageLock);
+    }
+    else if (strncmp(request, "shutdown", 8) == 0)
+    {
+        write(fd, "bye\n", 4);
+        return 0;
+    }
+    else
+    {
+        snprintf(reply, sizeof(reply), "error unknown request\n");
+    }
+    write(fd, reply, strlen(reply));
+    return 1;
+}
+
+// does the connection have a whole request line buffered
+int has_request(Connection *connection)
+{
+    return memchr(connection->buffer, '\n', connection->length) != NULL;
+}
+
+// hand a connection with a request line to the workers. Call with connectionLock held.
+void queue_request(Connection *connection)
+{
+    connection->busy = 1;
+    readyQueue[(readyHead + readyCount) % MAX_CONNECTIONS] = connection;
+    readyCount++;
+    pthread_cond_signal(&requestReady);
+}
+
+void stop_server()
+{
+    shuttingDown = 1;
+    pthread_mutex_lock(&connectionLock);
+    pthread_cond_broadcast(&requestReady);
+    pthread_mutex_unlock(&connectionLock);
+    write(wakePipe[1], "", 1);
+}
+
+void *worker(void *arg)
+{
+    // the worker's machine, reused by every job it runs
+    MachineState *machine = (MachineState *)malloc(sizeof(MachineState));
+    char request[REQUEST_LENGTH];
+    while (1)
+    {
+        pthread_mutex_lock(&connectionLock);
+        while (readyCount == 0 && !shuttingDown)
+        {
+            pthread_cond_wait(&requestReady, &connectionLock);
+        }
+        if (shuttingDown)
+        {
+            pthread_mutex_unlock(&connectionLock);
+            break;
+        }
+        Connection *connection = readyQueue[readyHead];
+        readyHead = (readyHead + 1) % MAX_CONNECTIONS;
+        readyCount--;
+        pthread_mutex_unlock(&connectionLock);
+
+        // the connection is ours until it goes back: take one line out of its buffer
+        int n = (char *)memchr(connection->buffer, '\n', connection->length) - connection->buffer + 1;
+        memcpy(request, connection->buffer, n);
+        request[n] = '\0';
+        connection->length -= n;
+        memmove(connection->buffer, connection->buffer + n, connection->length);
+
+        if (!handle_request(request, connection->fd, machine))
+        {
+            stop_server();
+            break;
+        }
+
+        // one request per turn: a client with more lines waiting goes to the back of the queue
+        pthread_mutex_lock(&connectionLock);
+        if (has_request(connection))
+        {
+            queue_request(connection);
+        }
+        else
+        {
+            connection->busy = 0;
+            write(wakePipe[1], "", 1);
+        }
+        pthread_mutex_unlock(&connectionLock);
+    }
+    free(machine);
+    return NULL;
+}
+
+void close_connection(Connection *connection)
+{
+    close(connection->fd);
+    connection->fd = -1;
+}
+
+/*
+ * Accept connections and read requests from the idle ones until shutdown. Workers only ever
+ * hold a connection for one request, so idle clients don't keep them from other jobs.
+ */
+void poll_connections()
+{
+    struct pollfd fds[MAX_CONNECTIONS + 2];
+    Connection *polled[MAX_CONNECTIONS + 2];
+    while (!shuttingDown)
+    {
+        int n = 0;
+        fds[n].fd = listenFd;
+        fds[n++].events = POLLIN;
+        fds[n].fd = wakePipe[0];
+        fds[n++].events = POLLIN;
+        pthread_mutex_lock(&connectionLock);
+        for (int i = 0; i < MAX_CONNECTIONS; i++)
+        {
+            if (connections[i].fd >= 0 && !connections[i].busy)
+            {
+                polled[n] = &connections[i];
+                fds[n].fd = connections[i].fd;
+                fds[n++].events = POLLIN;
+            }
+        }
+        pthread_mutex_unlock(&connectionLock);
+
+        if (poll(fds, n, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            break;
+        }
+        if (fds[1].revents)
+        {
+            char drain[64];
+            read(wakePipe[0], drain, sizeof(drain));
+        }
+        if (fds[0].revents)
+        {
+            int fd = accept(listenFd, NULL, NULL);
+            Connection *connection = NULL;
+            for (int i = 0; i < MAX_CONNECTIONS && fd >= 0 && connection == NULL; i++)
+            {
+                if (connections[i].fd < 0)
+                    connection = &connections[i];
+            }
+            if (connection != NULL)
+            {
+                // a client that stops reading its replies can't block a worker forever
+                struct timeval timeout = {REPLY_TIMEOUT_SECONDS, 0};
+                setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                connection->fd = fd;
+                connection->busy = 0;
+                connection->length = 0;
+            }
+            else if (fd >= 0)
+            {
+                write(fd, "error too many connections\n", 27);
+                close(fd);
+            }
+        }
+
+        // the connections polled were idle, so only this thread touches them until they're queued
+        for (int i = 2; i < n; i++)
+        {
+            if (!fds[i].revents)
+                continue;
+            Connection *connection = polled[i];
+            int r = read(connection->fd, connection->buffer + connection->length,
+                         REQUEST_LENGTH - 1 - connection->length);
+            if (r <= 0)
+            {
+                close_connection(connection);
+            }
+            else
+            {
+                connection->length += r;
+                if (has_request(connection))
+                {
+                    pthread_mutex_lock(&connectionLock);
+                    queue_request(connection);
+                    pthread_mutex_unlock(&connectionLock);
+                }
+                else if (connection->length == REQUEST_LENGTH - 1)
+                {
+                    write(connection->fd, "error request too long\n", 23);
+                    close_connection(connection);
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *socketPath = "/tmp/lc4d.sock";
+    int numWorkers = 4;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-workers") == 0 && i + 1 < argc)
+        {
+            numWorkers = atoi(argv[++i]);
+        }
+        else if (argv[i][0] != '-')
+        {
+            socketPath = argv[i];
+        }
+        else
+        {
+            printf("Usage: ./lc4d [-workers N] [socket path (default /tmp/lc4d.sock)]\n");
+            return -1;
+        }
+    }
+    if (numWorkers < 1 || numWorkers > MAX_WORKERS)
+    {
+        printf("-workers must be 1 to %d\n", MAX_WORKERS);
+        return -1;
+    }
+
+    // clients that hang up mid-reply shouldn't take the server down
+    signal(SIGPIPE, SIG_IGN);
+
+    resetTemplate = (MachineState *)malloc(sizeof(MachineState));
+    Reset(resetTemplate);
+    ClearSignals(resetTemplate);
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address.sun_path))
+    {
+        printf("Socket path too long\n");
+        return 1;
+    }
+    strcpy(address.sun_path, socketPath);
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socketPath);
+    if (listenFd < 0 || bind(listenFd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listenFd, 64) != 0)
+    {
+        perror("Error opening socket");
+        return 1;
+    }
+    fprintf(stderr, "lc4d: listening on %s with %d workers\n", socketPath, numWorkers);
+
+    // a full pipe already means the poller will wake, so the workers never wait on it
+    if (pipe(wakePipe) != 0 || fcntl(wakePipe[1], F_SETFL, O_NONBLOCK) != 0)
+    {
+        perror("Error creating pipe");
+        return 1;
+    }
+    for (int i = 0; i < MAX_CONNECTIONS; i++)
+    {
+        connections[i].fd = -1;
+    }
+
+    pthread_t threads[MAX_WORKERS];
+    for (int i = 0; i < numWorkers; i++)
+    {
+        pthread_create(&threads[i], NULL, worker, NULL);
+    }
+    poll_connections();
+
+    // hang up on idle clients. Running jobs stop with LC4_ABORTED and still send their reply; a
+    // client that doesn't read it only holds its worker up for the send timeout.
+    pthread_mutex_lock(&connectionLock);
+    for (int i = 0; i < MAX_CONNECTIONS; i++)
+    {
+        if (connections[i].fd >= 0 && !connections[i].busy)
+            shutdown(connections[i].fd, SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&connectionLock);
+    for (int i = 0; i < numWorkers; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    for (int i = 0; i < MAX_CONNECTIONS; i++)
+    {
+        if (connections[i].fd >= 0)
+            close(connections[i].fd);
+    }
+
+    close(wakePipe[0]);
+    close(wakePipe[1]);
+    close(listenFd);
+    unlink(socketPath);
+    for (int i = 0; i < numImages; i++)
+    {
+        free(images[i].machine);
+    }
+    free(resetTemplate);
+    return 0;
+}
@@ -0,0 +1,249 @@
+/*
+ * lc4diff.c: compare a text trace (as WriteOut writes it) against a reference, step by step.
+ *
+ * Both files are mapped and compared 64 bytes at a time with SSE2, counting the newlines on the
+ * way so differences can be reported by step. Only when a block differs are the two lines holding
+ * the difference parsed and compared field by field; comparison then resumes at the start of the
+ * next line of each file, so one line of a different length doesn't throw the rest off.
+ */
+
+#include "trace-record.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+typedef struct
+{
+    const char *data;
+    size_t size;
+} MappedFile;
+
+int map_file(const char *filename, MappedFile *file)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    file->size = st.st_size;
+    file->data = NULL;
+    if (file->size > 0)
+    {
+        void *data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            close(fd);
+            return -1;
+        }
+        madvise(data, file->size, MADV_SEQUENTIAL);
+        file->data = (const char *)data;
+    }
+    close(fd);
+    return 0;
+}
+
+/*
+ * Number of bytes a and b have in common at the start, up to length. Adds the newlines among
+ * them to *lines.
+ */
+size_t equal_prefix(const char *a, const char *b, size_t length, unsigned long long *lines)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; i + 64 <= length; i += 64)
+    {
+        __m128i a0 = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i a1 = _mm_loadu_si128((const __m128i *)(a + i + 16));
+        __m128i a2 = _mm_loadu_si128((const __m128i *)(a + i + 32));
+        __m128i a3 = _mm_loadu_si128((const __m128i *)(a + i + 48));
+        __m128i same = _mm_and_si128(
+            _mm_and_si128(_mm_cmpeq_epi8(a0, _mm_loadu_si128((const __m128i *)(b + i))),
+                          _mm_cmpeq_epi8(a1, _mm_loadu_si128((const __m128i *)(b + i + 16)))),
+            _mm_and_si128(_mm_cmpeq_epi8(a2, _mm_loadu_si128((const __m128i *)(b + i + 32))),
+                          _mm_cmpeq_epi8(a3, _mm_loadu_si128((const __m128i *)(b + i + 48)))));
+        if (_mm_movemask_epi8(same) != 0xFFFF)
+        {
+            // the bytewise loop below finds where in this block
+            break;
+        }
+        unsigned long long newlines = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(a0, newline)) |
+                                      (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(a1, newline)) << 16 |
+                                      (unsigned long long)_mm_movemask_epi8(_mm_cmpeq_epi8(a2, newline)) << 32 |
+                                      (unsigned long long)_mm_movemask_epi8(_mm_cmpeq_epi8(a3, newline)) << 48;
+        *lines += __builtin_popcountll(newlines);
+    }
+#endif
+    for (; i < length && a[i] == b[i]; i++)
+    {
+        *lines += a[i] == '\n';
+    }
+    return i;
+}
+
+/*
+ * Copy the line starting at start into line, ending it with a newline even if the file doesn't
+ * (at most size - 2 characters of it). Returns the offset of the next line.
+ */
+size_t copy_line(const MappedFile *file, size_t start, char *line, size_t size)
+{
+    const char *newline = (const char *)memchr(file->data + start, '\n', file->size - start);
+    size_t end = newline != NULL ? (size_t)(newline - file->data) + 1 : file->size;
+    size_t length = end - start < size - 2 ? end - start : size - 2;
+    memcpy(line, file->data + start, length);
+    if (length == 0 || line[length - 1] != '\n')
+    {
+        line[length++] = '\n';
+    }
+    line[length] = '\0';
+    return end;
+}
+
+unsigned long long count_lines(const MappedFile *file, size_t start)
+{
+    unsigned long long lines = 0;
+    for (const char *p = file->data + start, *end = file->data + file->size; p < end; p++)
+    {
+        const char *newline = (const char *)memchr(p, '\n', end - p);
+        lines++;
+        if (newline == NULL)
+        {
+            break;
+        }
+        p = newline;
+    }
+    return lines;
+}
+
+void report_step(unsigned long long step, const char *expectedLine, const char *actualLine)
+{
+    TraceRecord expected;
+    TraceRecord actual;
+    printf("Trace mismatch at step %llu:\n  expected %s  got      %s", step, expectedLine, actualLine);
+    if (ParseTraceRecord(expectedLine, &expected) != 0 || ParseTraceRecord(actualLine, &actual) != 0)
+    {
+        printf("  (malformed record)\n");
+        return;
+    }
+    if (TraceRecordsEqual(&expected, &actual))
+    {
+        printf("  (the fields are the same, only the text differs)\n");
+        return;
+    }
+    PrintTraceDiff(&expected, &actual, stdout);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long long maxDiffs = 10;
+    int argi = 1;
+    if (argi + 1 < argc && strcmp(argv[argi], "-n") == 0)
+    {
+        maxDiffs = strtoull(argv[argi + 1], NULL, 0);
+        argi += 2;
+    }
+    if (argc - argi != 2)
+    {
+        printf("Usage: ./lc4diff [-n <differences to report, default 10, 0 for all>] <reference trace> <trace>\n");
+        return 2;
+    }
+
+    MappedFile reference;
+    MappedFile trace;
+    for (int i = 0; i < 2; i++)
+    {
+        if (map_file(argv[argi + i], i == 0 ? &reference : &trace) != 0)
+        {
+            perror(argv[argi + i]);
+            return 2;
+        }
+    }
+
+    // lines counts the newlines before the current position in both files
+    size_t refPos = 0;
+    size_t tracePos = 0;
+    unsigned long long lines = 0;
+    unsigned long long diffs = 0;
+    int limited = 0;
+    while (1)
+    {
+        if (maxDiffs != 0 && diffs == maxDiffs)
+        {
+            // only say the report was cut off if something after the last difference differs
+            limited = reference.size - refPos != trace.size - tracePos ||
+                      memcmp(reference.data + refPos, trace.data + tracePos, reference.size - refPos) != 0;
+            break;
+        }
+        size_t length = reference.size - refPos < trace.size - tracePos ? reference.size - refPos : trace.size - tracePos;
+        size_t same = equal_prefix(reference.data + refPos, trace.data + tracePos, length, &lines);
+        refPos += same;
+        tracePos += same;
+
+        if (same == length)
+        {
+            // one file ended, possibly in the middle of a line. A last line without its newline
+            // is the same as one with it.
+            const MappedFile *longer = refPos < reference.size ? &reference : &trace;
+            size_t pos = longer == &reference ? refPos : tracePos;
+            if (pos > 0 && longer->data[pos - 1] != '\n' && (pos == longer->size || longer->data[pos] == '\n'))
+            {
+                // both files have this line, whole
+                pos += pos < longer->size;
+                lines++;
+            }
+            if (pos == longer->size)
+            {
+                break;
+            }
+
+            // the extra steps start after the last complete line both files have
+            while (pos > 0 && longer->data[pos - 1] != '\n')
+            {
+                pos--;
+            }
+            diffs++;
+            char line[128];
+            copy_line(longer, pos, line, sizeof(line));
+            printf("Trace mismatch at step %llu: the %s ended, but the %s has %llu more steps, starting with\n  %s",
+                   lines + 1, longer == &reference ? "trace" : "reference", longer == &reference ? "reference" : "trace",
+                   count_lines(longer, pos), line);
+            break;
+        }
+
+        // back up to the start of the line; up to there both files are the same
+        size_t back = 0;
+        while (back < refPos && reference.data[refPos - back - 1] != '\n')
+        {
+            back++;
+        }
+        char expectedLine[128];
+        char actualLine[128];
+        refPos = copy_line(&reference, refPos - back, expectedLine, sizeof(expectedLine));
+        tracePos = copy_line(&trace, tracePos - back, actualLine, sizeof(actualLine));
+        diffs++;
+        lines++;
+        report_step(lines, expectedLine, actualLine);
+    }
+
+    if (diffs == 0)
+    {
+        printf("Traces match (%llu steps)\n", lines);
+    }
+    else if (limited)
+    {
+        printf("Stopped after %llu differences\n", diffs);
+    }
+    return diffs == 0 ? 0 : 1;
+}
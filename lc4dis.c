@@ -0,0 +1,92 @@
+/*
+ * lc4dis.c: disassemble object files as loaded, split into basic blocks, and draw their control
+ * flow graph in DOT
+ */
+
+#include "loader.h"
+#include "disasm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Global variable defining the current state of the machine
+MachineState *CPU;
+
+void PrintUsage()
+{
+    printf("Usage: ./lc4dis [options] <file1.obj> [file2.obj] ...\n");
+    printf("  -o <file>    write the listing to file instead of stdout (none for no listing)\n");
+    printf("  -dot <file>  write the control flow graph in Graphviz DOT to file\n");
+}
+
+int main(int argc, char **argv)
+{
+    char *listing_filename = NULL;
+    char *dot_filename = NULL;
+    int argi = 1;
+    while (argi < argc && argv[argi][0] == '-')
+    {
+        if (strcmp(argv[argi], "-o") == 0 && argi + 1 < argc)
+        {
+            listing_filename = argv[++argi];
+        }
+        else if (strcmp(argv[argi], "-dot") == 0 && argi + 1 < argc)
+        {
+            dot_filename = argv[++argi];
+        }
+        else
+        {
+            PrintUsage();
+            return -1;
+        }
+        argi++;
+    }
+    if (argi >= argc)
+    {
+        PrintUsage();
+        return -1;
+    }
+
+    CPU = (MachineState *)malloc(sizeof(MachineState));
+    Reset(CPU);
+    ClearSignals(CPU);
+
+    // the loader's progress messages would end up in the listing
+    if (LoadObjectFiles(argv + argi, argc - argi, CPU) != 0)
+    {
+        return 1;
+    }
+
+    ControlFlowGraph *cfg = BuildControlFlowGraph(CPU);
+
+    if (listing_filename == NULL || strcmp(listing_filename, "none") != 0)
+    {
+        FILE *listing = listing_filename != NULL ? fopen(listing_filename, "w") : stdout;
+        if (listing == NULL)
+        {
+            perror("Error opening listing file");
+            return 1;
+        }
+        WriteListing(cfg, CPU, listing);
+        if (listing != stdout)
+        {
+            fclose(listing);
+        }
+    }
+
+    if (dot_filename != NULL)
+    {
+        FILE *dot = fopen(dot_filename, "w");
+        if (dot == NULL)
+        {
+            perror("Error opening DOT file");
+            return 1;
+        }
+        WriteControlFlowDot(cfg, CPU, dot);
+        fclose(dot);
+    }
+
+    FreeControlFlowGraph(cfg);
+    free(CPU);
+    return 0;
+}
@@ -0,0 +1,537 @@
+/*
+ * lc4fuzz.c: coverage-guided fuzzer for LC4 programs and OS trap handlers.
+ * The machine is booted once and snapshotted; every execution restores the snapshot (only the
+ * pages the last one stored to), feeds a mutated input to the console or a memory region, and
+ * runs until the program halts, faults, runs out of input or hits the step budget. Inputs that
+ * reach new control flow edges (or hit counts) join the corpus; inputs that fault are saved.
+ */
+
+#include "LC4.h"
+#include "loader.h"
+#include "devices.h"
+#include "snapshot.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+MachineState *CPU;
+
+#define MAX_CRASH_KINDS 4096
+
+typedef struct
+{
+    unsigned char *data;
+    unsigned int length;
+} Input;
+
+typedef struct
+{
+    // where the input goes: a memory region, or the console when regionWords is 0
+    unsigned short int regionStart;
+    unsigned int regionWords;
+    MMIODevice *console;
+    unsigned long long steps;
+    unsigned int maxLength;
+    const char *outDir;
+
+    Snapshot *snapshot;
+    unsigned char coverage[COVERAGE_MAP_SIZE];
+    // bucketed hit counts seen so far for each edge
+    unsigned char virgin[COVERAGE_MAP_SIZE];
+    unsigned int edges;
+
+    Input *corpus;
+    unsigned int corpusSize;
+    unsigned int corpusCapacity;
+
+    // distinct crashes, by status and faulting PC
+    unsigned int crashKeys[MAX_CRASH_KINDS];
+    unsigned int numCrashKinds;
+    unsigned long long crashes;
+    unsigned long long hangs;
+    unsigned long long executions;
+
+    unsigned long long random;
+} Fuzzer;
+
+void PrintUsage()
+{
+    printf("Usage: ./lc4fuzz [options] <object files>\n");
+    printf("  -out <dir>               corpus goes to dir/queue, crashing inputs to dir/crashes (default fuzz-out)\n");
+    printf("  -seeds <dir>             start from the inputs in dir (default one empty input)\n");
+    printf("  -region <address:words>  write the input into memory, 2 bytes per word, instead of the console\n");
+    printf("  -start <address|symbol>  snapshot the first time the PC gets here (default first user mode step)\n");
+    printf("  -steps <N>               step budget per execution (default 100000)\n");
+    printf("  -max-len <N>             largest input in bytes (default 256)\n");
+    printf("  -iterations <N>          stop after N executions (default run until interrupted)\n");
+    printf("  -seed <N>                random seed\n");
+    printf("  -hle                     service common OS traps natively\n");
+}
+
+double now_seconds()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+unsigned int next_random(Fuzzer *fuzzer)
+{
+    // xorshift64*
+    fuzzer->random ^= fuzzer->random >> 12;
+    fuzzer->random ^= fuzzer->random << 25;
+    fuzzer->random ^= fuzzer->random >> 27;
+    return (fuzzer->random * 2685821657736338717ULL) >> 32;
+}
+
+unsigned int random_below(Fuzzer *fuzzer, unsigned int n)
+{
+    return n == 0 ? 0 : next_random(fuzzer) % n;
+}
+
+/*
+ * Hit counts in AFL's buckets (1, 2, 3, 4-7, 8-15, 16-31, 32-127, 128+), one bit each
+ */
+unsigned char bucket(unsigned char count)
+{
+    if (count == 0)
+        return 0;
+    if (count <= 3)
+        return 1 << (count - 1);
+    if (count <= 7)
+        return 8;
+    if (count <= 15)
+        return 16;
+    if (count <= 31)
+        return 32;
+    if (count <= 127)
+        return 64;
+    return 128;
+}
+
+/*
+ * Fold the last execution's coverage into the virgin map. Returns 1 if anything was new.
+ */
+int new_coverage(Fuzzer *fuzzer)
+{
+    int found = 0;
+    const unsigned long long *words = (const unsigned long long *)fuzzer->coverage;
+    for (unsigned int w = 0; w < COVERAGE_MAP_SIZE / 8; w++)
+    {
+        if (words[w] == 0)
+        {
+            continue;
+        }
+        for (unsigned int i = w * 8; i < w * 8 + 8; i++)
+        {
+            unsigned char bits = bucket(fuzzer->coverage[i]);
+            if (bits & ~fuzzer->virgin[i])
+            {
+                if (fuzzer->virgin[i] == 0)
+                {
+                    fuzzer->edges++;
+                }
+                fuzzer->virgin[i] |= bits;
+                found = 1;
+            }
+        }
+    }
+    return found;
+}
+
+/*
+ * Run one input from the snapshot. Returns the status that ended it (LC4_OK if it ran out of
+ * steps or input).
+ */
+int execute(Fuzzer *fuzzer, const unsigned char *data, unsigned int length)
+{
+    RestoreSnapshot(fuzzer->snapshot, CPU);
+    memset(fuzzer->coverage, 0, sizeof(fuzzer->coverage));
+
+    if (fuzzer->regionWords > 0)
+    {
+        SetConsoleInput(fuzzer->console, NULL, 0);
+        for (unsigned int i = 0; i < fuzzer->regionWords; i++)
+        {
+            unsigned short int address = fuzzer->regionStart + i;
+            unsigned short int high = 2 * i < length ? data[2 * i] : 0;
+            unsigned short int low = 2 * i + 1 < length ? data[2 * i + 1] : 0;
+            MarkSnapshotDirty(fuzzer->snapshot, address);
+            CPU->memory[address] = high << 8 | low;
+        }
+    }
+    else
+    {
+        SetConsoleInput(fuzzer->console, data, length);
+    }
+
+    int status = LC4_OK;
+    unsigned long long end = CPU->instructionCount + fuzzer->steps;
+    while (CPU->instructionCount < end && !ConsoleStarved(fuzzer->console))
+    {
+        status = UpdateMachineState(CPU, NULL);
+        if (status != LC4_OK)
+        {
+            break;
+        }
+    }
+    if (status == LC4_OK && CPU->instructionCount >= end)
+    {
+        fuzzer->hangs++;
+    }
+    fuzzer->executions++;
+    return status;
+}
+
+void write_input(const char *path, const unsigned char *data, unsigned int length)
+{
+    FILE *file = fopen(path, "wb");
+    if (file != NULL)
+    {
+        fwrite(data, 1, length, file);
+        fclose(file);
+    }
+}
+
+void add_to_corpus(Fuzzer *fuzzer, const unsigned char *data, unsigned int length)
+{
+    if (fuzzer->corpusSize == fuzzer->corpusCapacity)
+    {
+        fuzzer->corpusCapacity = fuzzer->corpusCapacity * 2 + 16;
+        fuzzer->corpus = (Input *)realloc(fuzzer->corpus, fuzzer->corpusCapacity * sizeof(Input));
+    }
+    Input *input = &fuzzer->corpus[fuzzer->corpusSize];
+    input->data = (unsigned char *)malloc(length + 1);
+    memcpy(input->data, data, length);
+    input->length = length;
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/queue/id_%06u", fuzzer->outDir, fuzzer->corpusSize);
+    write_input(path, data, length);
+    fuzzer->corpusSize++;
+}
+
+/*
+ * Save an input that made the machine fault, once per status and faulting PC
+ */
+void record_crash(Fuzzer *fuzzer, int status, const unsigned char *data, unsigned int length)
+{
+    fuzzer->crashes++;
+    unsigned int key = (unsigned int)status << 16 | CPU->faultPC;
+    for (unsigned int i = 0; i < fuzzer->numCrashKinds; i++)
+    {
+        if (fuzzer->crashKeys[i] == key)
+        {
+            return;
+        }
+    }
+    if (fuzzer->numCrashKinds == MAX_CRASH_KINDS)
+    {
+        return;
+    }
+    fuzzer->crashKeys[fuzzer->numCrashKinds++] = key;
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/crashes/status%d_pc%04X_addr%04X", fuzzer->outDir, status, CPU->faultPC,
+             CPU->faultAddr);
+    write_input(path, data, length);
+    printf("new crash: %s at PC x%04X (address x%04X), saved as %s\n", LC4StatusMessage(status), CPU->faultPC,
+           CPU->faultAddr, path);
+}
+
+/*
+ * Run an input and keep it if it found something new
+ */
+void try_input(Fuzzer *fuzzer, const unsigned char *data, unsigned int length)
+{
+    int status = execute(fuzzer, data, length);
+    if (status != LC4_OK && status != LC4_HALT)
+    {
+        record_crash(fuzzer, status, data, length);
+    }
+    if (new_coverage(fuzzer))
+    {
+        add_to_corpus(fuzzer, data, length);
+    }
+}
+
+/*
+ * Apply a few random mutations to data (length bytes, room for maxLength). Returns the new length.
+ */
+unsigned int mutate(Fuzzer *fuzzer, unsigned char *data, unsigned int length)
+{
+    static const unsigned char interesting[] = {0, 1, 0x7F, 0x80, 0xFF, '\n', '\r', ' ', '0', '9', 'a', 'z', 'A', 'Z', '-', 'q', 'Q'};
+    unsigned int maxLength = fuzzer->maxLength;
+    int count = 1 << random_below(fuzzer, 5);
+    for (int m = 0; m < count; m++)
+    {
+        unsigned int position = random_below(fuzzer, length);
+        switch (random_below(fuzzer, 8))
+        {
+        case 0:
+            // flip a bit
+            if (length > 0)
+                data[position] ^= 1 << random_below(fuzzer, 8);
+            break;
+        case 1:
+            // random byte
+            if (length > 0)
+                data[position] = next_random(fuzzer);
+            break;
+        case 2:
+            // interesting byte
+            if (length > 0)
+                data[position] = interesting[random_below(fuzzer, sizeof(interesting))];
+            break;
+        case 3:
+            // small add or subtract
+            if (length > 0)
+                data[position] += (int)random_below(fuzzer, 17) - 8;
+            break;
+        case 4:
+            // insert a byte
+            if (length < maxLength)
+            {
+                position = random_below(fuzzer, length + 1);
+                memmove(data + position + 1, data + position, length - position);
+                data[position] = random_below(fuzzer, 2) ? next_random(fuzzer)
+                                                          : interesting[random_below(fuzzer, sizeof(interesting))];
+                length++;
+            }
+            break;
+        case 5:
+            // delete a few bytes
+            if (length > 0)
+            {
+                unsigned int n = 1 + random_below(fuzzer, length - position < 8 ? length - position : 8);
+                memmove(data + position, data + position + n, length - position - n);
+                length -= n;
+            }
+            break;
+        case 6:
+            // copy a chunk over another place
+            if (length > 1)
+            {
+                unsigned int from = random_below(fuzzer, length);
+                unsigned int n = 1 + random_below(fuzzer, length - (from > position ? from : position));
+                memmove(data + position, data + from, n);
+            }
+            break;
+        case 7:
+        {
+            // splice: keep our head, take the tail of another corpus entry
+            Input *other = &fuzzer->corpus[random_below(fuzzer, fuzzer->corpusSize)];
+            if (other->length > 0)
+            {
+                unsigned int from = random_below(fuzzer, other->length);
+                unsigned int n = other->length - from;
+                if (position + n > maxLength)
+                    n = maxLength - position;
+                memcpy(data + position, other->data + from, n);
+                length = position + n;
+            }
+            break;
+        }
+        }
+    }
+    return length;
+}
+
+void load_seeds(Fuzzer *fuzzer, const char *dirname)
+{
+    DIR *dir = opendir(dirname);
+    if (dir == NULL)
+    {
+        perror("Error opening seed directory");
+        return;
+    }
+    unsigned char *data = (unsigned char *)malloc(fuzzer->maxLength + 1);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", dirname, entry->d_name);
+        struct stat st;
+        FILE *file;
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode) || (file = fopen(path, "rb")) == NULL)
+        {
+            continue;
+        }
+        unsigned int length = fread(data, 1, fuzzer->maxLength, file);
+        fclose(file);
+        // seeds are kept even if they add no coverage
+        execute(fuzzer, data, length);
+        new_coverage(fuzzer);
+        add_to_corpus(fuzzer, data, length);
+    }
+    closedir(dir);
+    free(data);
+}
+
+/*
+ * Boot until the PC reaches start (or, if start is -1, until the first step in user mode)
+ */
+int boot(int start, unsigned long long limit)
+{
+    while (CPU->instructionCount < limit)
+    {
+        if (start >= 0 ? CPU->PC == start : !(CPU->PSR & 0x8000))
+        {
+            return 0;
+        }
+        if (UpdateMachineState(CPU, NULL) != LC4_OK)
+        {
+            return -1;
+        }
+    }
+    return -1;
+}
+
+int main(int argc, char **argv)
+{
+    Fuzzer *fuzzer = (Fuzzer *)calloc(1, sizeof(Fuzzer));
+    fuzzer->steps = 100000;
+    fuzzer->maxLength = 256;
+    fuzzer->outDir = "fuzz-out";
+    fuzzer->random = 0x2545F4914F6CDD1DULL;
+    const char *seedDir = NULL;
+    const char *startSpec = NULL;
+    unsigned long long iterations = 0;
+    int hleTraps = 0;
+
+    int argi = 1;
+    while (argi < argc && argv[argi][0] == '-')
+    {
+        if (strcmp(argv[argi], "-out") == 0 && argi + 1 < argc)
+            fuzzer->outDir = argv[++argi];
+        else if (strcmp(argv[argi], "-seeds") == 0 && argi + 1 < argc)
+            seedDir = argv[++argi];
+        else if (strcmp(argv[argi], "-region") == 0 && argi + 1 < argc)
+        {
+            char *spec = argv[++argi];
+            char *colon = strchr(spec, ':');
+            if (colon == NULL)
+            {
+                PrintUsage();
+                return -1;
+            }
+            fuzzer->regionStart = strtoul(spec[0] == 'x' ? spec + 1 : spec, NULL, 16);
+            fuzzer->regionWords = strtoul(colon + 1, NULL, 0);
+        }
+        else if (strcmp(argv[argi], "-start") == 0 && argi + 1 < argc)
+            startSpec = argv[++argi];
+        else if (strcmp(argv[argi], "-steps") == 0 && argi + 1 < argc)
+            fuzzer->steps = strtoull(argv[++argi], NULL, 0);
+        else if (strcmp(argv[argi], "-max-len") == 0 && argi + 1 < argc)
+            fuzzer->maxLength = strtoul(argv[++argi], NULL, 0);
+        else if (strcmp(argv[argi], "-iterations") == 0 && argi + 1 < argc)
+            iterations = strtoull(argv[++argi], NULL, 0);
+        else if (strcmp(argv[argi], "-seed") == 0 && argi + 1 < argc)
+            fuzzer->random ^= strtoull(argv[++argi], NULL, 0) * 0x9E3779B97F4A7C15ULL;
+        else if (strcmp(argv[argi], "-hle") == 0)
+            hleTraps = 1;
+        else
+        {
+            printf("Unknown option %s\n", argv[argi]);
+            PrintUsage();
+            return -1;
+        }
+        argi++;
+    }
+    if (argi >= argc || fuzzer->maxLength == 0)
+    {
+        PrintUsage();
+        return -1;
+    }
+
+    char path[4096];
+    mkdir(fuzzer->outDir, 0755);
+    snprintf(path, sizeof(path), "%s/queue", fuzzer->outDir);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/crashes", fuzzer->outDir);
+    mkdir(path, 0755);
+
+    CPU = (MachineState *)malloc(sizeof(MachineState));
+    Reset(CPU);
+    ClearSignals(CPU);
+    CPU->hleTraps = hleTraps;
+    CPU->verbosity = VERBOSITY_QUIET;
+    fuzzer->console = CreateBufferConsoleDevice(NULL);
+    AttachDevice(CPU, fuzzer->console);
+    SetConsoleInput(fuzzer->console, NULL, 0);
+    for (int i = argi; i < argc; i++)
+    {
+        if (ReadObjectFile(argv[i], CPU) == 1)
+        {
+            printf("Could not open %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    int start = -1;
+    if (startSpec != NULL)
+    {
+        start = LookupSymbol(startSpec);
+        if (start < 0)
+            start = strtol(startSpec[0] == 'x' ? startSpec + 1 : startSpec, NULL, 16) & 0xFFFF;
+    }
+    if (boot(start, 100000000) != 0)
+    {
+        printf("The program never reached the snapshot point (%s)\n", startSpec != NULL ? startSpec : "user mode");
+        return 1;
+    }
+    printf("snapshot at PC x%04X after %llu boot instructions\n", CPU->PC, CPU->instructionCount);
+
+    CPU->coverage = fuzzer->coverage;
+    fuzzer->snapshot = TakeSnapshot(CPU);
+
+    if (seedDir != NULL)
+    {
+        load_seeds(fuzzer, seedDir);
+    }
+    if (fuzzer->corpusSize == 0)
+    {
+        execute(fuzzer, NULL, 0);
+        new_coverage(fuzzer);
+        add_to_corpus(fuzzer, (const unsigned char *)"", 0);
+    }
+
+    unsigned char *data = (unsigned char *)malloc(fuzzer->maxLength + 1);
+    double started = now_seconds();
+    double lastReport = started;
+    while (iterations == 0 || fuzzer->executions < iterations)
+    {
+        Input *parent = &fuzzer->corpus[random_below(fuzzer, fuzzer->corpusSize)];
+        unsigned int length = parent->length < fuzzer->maxLength ? parent->length : fuzzer->maxLength;
+        memcpy(data, parent->data, length);
+        length = mutate(fuzzer, data, length);
+        try_input(fuzzer, data, length);
+
+        if ((fuzzer->executions & 0xFFF) == 0)
+        {
+            double now = now_seconds();
+            if (now - lastReport >= 1)
+            {
+                printf("%llu execs (%.0f/s), corpus %u, edges %u, crashes %llu (%u distinct), hangs %llu\n",
+                       fuzzer->executions, fuzzer->executions / (now - started), fuzzer->corpusSize, fuzzer->edges,
+                       fuzzer->crashes, fuzzer->numCrashKinds, fuzzer->hangs);
+                fflush(stdout);
+                lastReport = now;
+            }
+        }
+    }
+
+    double elapsed = now_seconds() - started;
+    printf("done: %llu execs (%.0f/s), corpus %u, edges %u, crashes %llu (%u distinct), hangs %llu\n",
+           fuzzer->executions, elapsed > 0 ? fuzzer->executions / elapsed : 0, fuzzer->corpusSize, fuzzer->edges,
+           fuzzer->crashes, fuzzer->numCrashKinds, fuzzer->hangs);
+
+    free(data);
+    FreeSnapshot(fuzzer->snapshot, CPU);
+    FreeDevices(CPU);
+    free(CPU);
+    return 0;
+}
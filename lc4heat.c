@@ -0,0 +1,155 @@
+/*
+ * lc4heat.c: render a heatmap file written by trace2 -heatmap as a PGM image or CSV
+ */
+
+#include "heatmap.h"
+#include <math.h>
+
+void PrintUsage()
+{
+    printf("Usage: ./lc4heat <heatmap file> [-pgm <image.pgm>] [-csv <epochs.csv>] [-lines <lines.csv>]\n");
+    printf("  -pgm    pages (rows, x0000 at the top) by epochs (columns), brighter = more accesses (log scale)\n");
+    printf("  -csv    one row per epoch: working set sizes, then accesses per page\n");
+    printf("  -lines  read and write totals of every line that was accessed\n");
+}
+
+int write_pgm(HeatmapFile *heatmap, const char *filename)
+{
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    unsigned long long max = 0;
+    for (unsigned int e = 0; e < heatmap->numEpochs; e++)
+    {
+        for (int page = 0; page < HEATMAP_PAGES; page++)
+        {
+            if (heatmap->epochs[e].pageAccesses[page] > max)
+                max = heatmap->epochs[e].pageAccesses[page];
+        }
+    }
+
+    int width = heatmap->numEpochs > 0 ? heatmap->numEpochs : 1;
+    fprintf(file, "P5\n%d %d\n255\n", width, HEATMAP_PAGES);
+    unsigned char *row = (unsigned char *)calloc(width, 1);
+    for (int page = 0; page < HEATMAP_PAGES; page++)
+    {
+        for (unsigned int e = 0; e < heatmap->numEpochs; e++)
+        {
+            unsigned long long count = heatmap->epochs[e].pageAccesses[page];
+            row[e] = count == 0 ? 0 : (unsigned char)(32 + 223 * log1p(count) / log1p(max));
+        }
+        fwrite(row, 1, width, file);
+    }
+    free(row);
+    fclose(file);
+    return 0;
+}
+
+int write_epochs_csv(HeatmapFile *heatmap, const char *filename)
+{
+    FILE *file = fopen(filename, "w");
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    fprintf(file, "epoch,start,reads,writes,pages,lines");
+    for (int page = 0; page < HEATMAP_PAGES; page++)
+    {
+        fprintf(file, ",x%02X00", page);
+    }
+    fprintf(file, "\n");
+    for (unsigned int e = 0; e < heatmap->numEpochs; e++)
+    {
+        HeatmapEpoch *epoch = &heatmap->epochs[e];
+        fprintf(file, "%u,%llu,%llu,%llu,%u,%u", e, epoch->start, epoch->reads, epoch->writes, epoch->pagesTouched,
+                epoch->linesTouched);
+        for (int page = 0; page < HEATMAP_PAGES; page++)
+        {
+            fprintf(file, ",%llu", epoch->pageAccesses[page]);
+        }
+        fprintf(file, "\n");
+    }
+    fclose(file);
+    return 0;
+}
+
+int write_lines_csv(HeatmapFile *heatmap, const char *filename)
+{
+    FILE *file = fopen(filename, "w");
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    fprintf(file, "line,reads,writes\n");
+    for (int line = 0; line < HEATMAP_LINES; line++)
+    {
+        if (heatmap->lineReads[line] != 0 || heatmap->lineWrites[line] != 0)
+        {
+            fprintf(file, "x%04X,%llu,%llu\n", line * heatmap->lineWords, heatmap->lineReads[line], heatmap->lineWrites[line]);
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argv[1][0] == '-')
+    {
+        PrintUsage();
+        return -1;
+    }
+
+    HeatmapFile *heatmap = ReadHeatmapFile(argv[1]);
+    if (heatmap == NULL)
+    {
+        printf("Could not read heatmap %s\n", argv[1]);
+        return 1;
+    }
+
+    int result = 0;
+    int outputs = 0;
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        int status;
+        if (strcmp(argv[i], "-pgm") == 0)
+            status = write_pgm(heatmap, argv[i + 1]);
+        else if (strcmp(argv[i], "-csv") == 0)
+            status = write_epochs_csv(heatmap, argv[i + 1]);
+        else if (strcmp(argv[i], "-lines") == 0)
+            status = write_lines_csv(heatmap, argv[i + 1]);
+        else
+        {
+            PrintUsage();
+            FreeHeatmapFile(heatmap);
+            return -1;
+        }
+        if (status != 0)
+        {
+            perror(argv[i + 1]);
+            result = 1;
+        }
+        outputs++;
+    }
+
+    // with no outputs, summarize the working set over time
+    if (outputs == 0)
+    {
+        printf("%u epochs of %llu instructions\n", heatmap->numEpochs, heatmap->epochLength);
+        printf("%8s %14s %10s %10s %8s %8s\n", "epoch", "start", "reads", "writes", "pages", "lines");
+        for (unsigned int e = 0; e < heatmap->numEpochs; e++)
+        {
+            HeatmapEpoch *epoch = &heatmap->epochs[e];
+            printf("%8u %14llu %10llu %10llu %8u %8u\n", e, epoch->start, epoch->reads, epoch->writes, epoch->pagesTouched,
+                   epoch->linesTouched);
+        }
+    }
+
+    FreeHeatmapFile(heatmap);
+    return result;
+}
@@ -0,0 +1,106 @@
+/*
+ * lc4mon.c: watch a simulation started with trace2 -shm, without slowing it down
+ */
+
+#include "shared-view.h"
+#include <sys/time.h>
+#include <unistd.h>
+
+double now_seconds()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void print_snapshot(const SharedSnapshot *snapshot, double rate)
+{
+    printf("%14llu  %10.0f/s  PC %04X  PSR %04X ", snapshot->instructionCount, rate, snapshot->PC, snapshot->PSR);
+    for (int i = 0; i < 8; i++)
+    {
+        printf(" R%d %04X", i, snapshot->R[i]);
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+    int intervalMs = 500;
+    int once = 0;
+    int memoryStart = 0;
+    int memoryWords = 0;
+    const char *name = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-interval") == 0 && i + 1 < argc)
+            intervalMs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-once") == 0)
+            once = 1;
+        else if (strcmp(argv[i], "-mem") == 0 && i + 2 < argc)
+        {
+            memoryStart = strtol(argv[++i], NULL, 16) & 0xFFFF;
+            memoryWords = atoi(argv[++i]);
+        }
+        else if (argv[i][0] != '-')
+            name = argv[i];
+        else
+        {
+            // unknown option
+            name = NULL;
+            break;
+        }
+    }
+    if (name == NULL)
+    {
+        printf("Usage: ./lc4mon [-interval ms] [-once] [-mem <hex address> <words>] <shm name or file>\n");
+        return -1;
+    }
+
+    SharedView *view = OpenSharedView(name);
+    if (view == NULL)
+    {
+        printf("Could not open %s (not running, or built from a different MachineState)\n", name);
+        return 1;
+    }
+
+    SharedSnapshot snapshot, previous;
+    ReadSharedSnapshot(view, &previous);
+    double previousTime = now_seconds();
+    while (1)
+    {
+        if (!once)
+        {
+            usleep(intervalMs * 1000);
+        }
+        ReadSharedSnapshot(view, &snapshot);
+        double time = now_seconds();
+        double rate = time > previousTime ? (snapshot.instructionCount - previous.instructionCount) / (time - previousTime) : 0;
+        print_snapshot(&snapshot, rate);
+
+        // memory is read live from the machine, not from the snapshot
+        for (int i = 0; i < memoryWords; i++)
+        {
+            unsigned short int address = memoryStart + i;
+            printf("%s%04X: %04X", i % 8 == 0 ? (i ? "\n" : "") : "  ", address, view->machine->memory[address]);
+        }
+        if (memoryWords > 0)
+        {
+            printf("\n");
+        }
+        fflush(stdout);
+
+        if (once || snapshot.finished)
+        {
+            if (snapshot.finished)
+            {
+                printf("finished: %s\n", LC4StatusMessage(snapshot.status));
+            }
+            break;
+        }
+        previous = snapshot;
+        previousTime = time;
+    }
+
+    CloseSharedView(view);
+    return 0;
+}
@@ -0,0 +1,47 @@
+/*
+ * lc4unz.c: decompress a trace written with trace2 -compress, on several threads
+ */
+
+#include "trace-compress.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+int main(int argc, char **argv)
+{
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int argi = 1;
+    if (argi + 1 < argc && strcmp(argv[argi], "-threads") == 0)
+    {
+        threads = atoi(argv[argi + 1]);
+        argi += 2;
+    }
+    if (argi >= argc || argc - argi > 2 || argv[argi][0] == '-')
+    {
+        printf("Usage: ./lc4unz [-threads N] <compressed trace> [output file, default stdout]\n");
+        return -1;
+    }
+
+    FILE *output = stdout;
+    if (argi + 1 < argc)
+    {
+        output = fopen(argv[argi + 1], "wb");
+        if (output == NULL)
+        {
+            perror("Error opening output file");
+            return 1;
+        }
+    }
+
+    int result = DecompressTrace(argv[argi], output, threads);
+    if (output != stdout && fclose(output) != 0)
+    {
+        result = -1;
+    }
+    if (result != 0)
+    {
+        fprintf(stderr, "%s is not a compressed trace, or is corrupt\n", argv[argi]);
+        return 1;
+    }
+    return 0;
+}
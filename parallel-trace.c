@@ -0,0 +1,218 @@
+/*
+ * parallel-trace.c: checkpoint the run untraced, then replay the stretches between checkpoints with
+ * a trace on worker threads and write them out in order
+ */
+
+#define _GNU_SOURCE
+#include "parallel-trace.h"
+#include "superblock.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+    MachineState *checkpoint; // the machine at the start of the stretch, replayed in place
+    char *trace;              // the stretch's trace, once replayed
+    size_t length;
+    int done;
+} Stretch;
+
+typedef struct
+{
+    Stretch *ring;
+    int ringSize;
+    // stretches are numbered: [written, taken) are being replayed, [taken, produced) are waiting
+    unsigned long long produced;
+    unsigned long long taken;
+    unsigned long long written;
+    int finished; // the fast-forward is over, no more stretches will come
+    int writing;  // a worker is writing stretches to the output
+    unsigned long long interval;
+    LC4TraceSink sink;
+    FILE *output;
+    pthread_mutex_t lock;
+    pthread_cond_t workReady;
+    pthread_cond_t stretchWritten;
+} ParallelTracer;
+
+int CanTraceInParallel(MachineState *CPU)
+{
+    return CPU->numDevices == 0 && !CPU->hleTraps && CPU->icache == NULL && CPU->dcache == NULL &&
+           CPU->heatmap == NULL;
+}
+
+/*
+ * Replay one stretch into memory: exactly the steps the serial loop would trace, up to the next checkpoint
+ */
+void replay_stretch(ParallelTracer *tracer, Stretch *stretch)
+{
+    MachineState *CPU = stretch->checkpoint;
+    FILE *stream = open_memstream(&stretch->trace, &stretch->length);
+    FILE *text = stream;
+    if (tracer->sink != NULL)
+    {
+        CPU->traceSink = tracer->sink;
+        CPU->traceContext = stream;
+        text = NULL;
+    }
+
+    unsigned long long end = CPU->instructionCount + tracer->interval;
+    while (CPU->instructionCount < end && UpdateMachineState(CPU, text) == LC4_OK)
+    {
+    }
+    fclose(stream);
+}
+
+/*
+ * Write every replayed stretch at the head of the ring, in order. Called with the lock held.
+ */
+void write_stretches(ParallelTracer *tracer)
+{
+    tracer->writing = 1;
+    while (tracer->written < tracer->taken)
+    {
+        Stretch *stretch = &tracer->ring[tracer->written % tracer->ringSize];
+        if (!stretch->done)
+        {
+            break;
+        }
+        pthread_mutex_unlock(&tracer->lock);
+        fwrite(stretch->trace, 1, stretch->length, tracer->output);
+        free(stretch->trace);
+        stretch->trace = NULL;
+        pthread_mutex_lock(&tracer->lock);
+        stretch->done = 0;
+        tracer->written++;
+        pthread_cond_broadcast(&tracer->stretchWritten);
+    }
+    tracer->writing = 0;
+}
+
+void *replay_worker(void *arg)
+{
+    ParallelTracer *tracer = (ParallelTracer *)arg;
+    pthread_mutex_lock(&tracer->lock);
+    while (1)
+    {
+        while (tracer->taken == tracer->produced && !tracer->finished)
+        {
+            pthread_cond_wait(&tracer->workReady, &tracer->lock);
+        }
+        if (tracer->taken == tracer->produced)
+        {
+            break;
+        }
+        Stretch *stretch = &tracer->ring[tracer->taken++ % tracer->ringSize];
+        pthread_mutex_unlock(&tracer->lock);
+
+        replay_stretch(tracer, stretch);
+
+        pthread_mutex_lock(&tracer->lock);
+        stretch->done = 1;
+        // whoever finds the head of the ring done writes it; a worker already writing picks this one up too
+        if (!tracer->writing)
+        {
+            write_stretches(tracer);
+        }
+    }
+    pthread_mutex_unlock(&tracer->lock);
+    return NULL;
+}
+
+/*
+ * Hand a copy of the machine as it is now to the workers, waiting for a free slot
+ */
+void add_checkpoint(ParallelTracer *tracer, MachineState *CPU)
+{
+    pthread_mutex_lock(&tracer->lock);
+    while (tracer->produced - tracer->written == (unsigned long long)tracer->ringSize)
+    {
+        pthread_cond_wait(&tracer->stretchWritten, &tracer->lock);
+    }
+    Stretch *stretch = &tracer->ring[tracer->produced % tracer->ringSize];
+    pthread_mutex_unlock(&tracer->lock);
+
+    memcpy(stretch->checkpoint, CPU, sizeof(MachineState));
+    stretch->checkpoint->superblocks = NULL;
+    stretch->checkpoint->eventHandler = NULL;
+    // the fast-forward already reported whatever happens
+    stretch->checkpoint->verbosity = VERBOSITY_QUIET;
+
+    pthread_mutex_lock(&tracer->lock);
+    tracer->produced++;
+    pthread_cond_signal(&tracer->workReady);
+    pthread_mutex_unlock(&tracer->lock);
+}
+
+int ParallelTrace(MachineState *CPU, FILE *output, unsigned long long interval, int threads)
+{
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+
+    ParallelTracer tracer;
+    memset(&tracer, 0, sizeof(tracer));
+    tracer.interval = interval != 0 ? interval : 1;
+    tracer.sink = CPU->traceSink;
+    tracer.output = output;
+    // a few checkpoints per thread, so workers don't wait on the one writing out a long stretch
+    tracer.ringSize = threads * 3;
+    tracer.ring = (Stretch *)calloc(tracer.ringSize, sizeof(Stretch));
+    for (int i = 0; i < tracer.ringSize; i++)
+    {
+        tracer.ring[i].checkpoint = (MachineState *)malloc(sizeof(MachineState));
+    }
+    pthread_mutex_init(&tracer.lock, NULL);
+    pthread_cond_init(&tracer.workReady, NULL);
+    pthread_cond_init(&tracer.stretchWritten, NULL);
+    pthread_t *workers = (pthread_t *)malloc(threads * sizeof(pthread_t));
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_create(&workers[i], NULL, replay_worker, &tracer);
+    }
+
+    // fast-forward untraced; superblocks must stop exactly at each checkpoint
+    CPU->traceSink = NULL;
+    unsigned long long next = CPU->instructionCount + tracer.interval;
+    if (CPU->superblocks != NULL)
+    {
+        CPU->superblocks->stepLimit = next;
+    }
+    add_checkpoint(&tracer, CPU);
+    int status;
+    while ((status = UpdateMachineState(CPU, NULL)) == LC4_OK)
+    {
+        if (CPU->instructionCount == next)
+        {
+            add_checkpoint(&tracer, CPU);
+            next += tracer.interval;
+            if (CPU->superblocks != NULL)
+            {
+                CPU->superblocks->stepLimit = next;
+            }
+        }
+    }
+    CPU->traceSink = tracer.sink;
+
+    pthread_mutex_lock(&tracer.lock);
+    tracer.finished = 1;
+    pthread_cond_broadcast(&tracer.workReady);
+    pthread_mutex_unlock(&tracer.lock);
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+
+    for (int i = 0; i < tracer.ringSize; i++)
+    {
+        free(tracer.ring[i].checkpoint);
+    }
+    free(tracer.ring);
+    free(workers);
+    pthread_mutex_destroy(&tracer.lock);
+    pthread_cond_destroy(&tracer.workReady);
+    pthread_cond_destroy(&tracer.stretchWritten);
+    return status;
+}
@@ -0,0 +1,25 @@
+// parallel-trace.h: write the trace of one long run on all cores.
+// The run is fast-forwarded without a trace (with superblocks, if the machine has a cache), and a
+// copy of the whole MachineState is kept every interval steps. Each stretch between two of these
+// checkpoints is then replayed with WriteOut on a worker thread into memory, and the stretches are
+// written to the output in order, so the file is the same as a serial trace. Replay starts as soon
+// as a checkpoint exists, and at most a few checkpoints per thread are held at a time.
+//
+// Replaying is only exact when every step depends on nothing but the MachineState, so the machine
+// must have no devices, HLE traps, caches or heatmap attached.
+
+#ifndef PARALLEL_TRACE_H
+#define PARALLEL_TRACE_H
+
+#include "LC4.h"
+
+// Nonzero if the machine can be traced this way
+int CanTraceInParallel(MachineState *CPU);
+
+// Run CPU to the end and trace it to output with threads threads, checkpointing every interval
+// steps. If CPU->traceSink is set it must write to the FILE passed as its context (BinaryTraceSink);
+// each stretch then gets the sink with its own buffer, and output is where they are collected.
+// Leaves CPU in its final state and returns the status that stopped it, like UpdateMachineState.
+int ParallelTrace(MachineState *CPU, FILE *output, unsigned long long interval, int threads);
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ * perf-counters.c: perf_event_open counters for the benchmark harness
+ */
+
+#include "perf-counters.h"
+#include <linux/perf_event.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+const char *PerfCounterNames[PERF_NUM_COUNTERS] = {"cycles", "instructions", "branch-misses",
+                                                   "L1D-misses", "L1I-misses", "LLC-misses"};
+
+#define CACHE_READ_MISS(cache) ((cache) | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+
+int open_counter(unsigned int type, unsigned long long config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    // this thread, on any CPU
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+PerfCounters *OpenPerfCounters()
+{
+    PerfCounters *counters = (PerfCounters *)malloc(sizeof(PerfCounters));
+    counters->fd[PERF_CYCLES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    counters->fd[PERF_INSTRUCTIONS] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    counters->fd[PERF_BRANCH_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    counters->fd[PERF_L1D_MISSES] = open_counter(PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D));
+    counters->fd[PERF_L1I_MISSES] = open_counter(PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1I));
+    counters->fd[PERF_LLC_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    return counters;
+}
+
+void ClosePerfCounters(PerfCounters *counters)
+{
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+    {
+        if (counters->fd[i] >= 0)
+        {
+            close(counters->fd[i]);
+        }
+    }
+    free(counters);
+}
+
+int PerfCounterAvailable(PerfCounters *counters, PerfCounter counter)
+{
+    return counters->fd[counter] >= 0;
+}
+
+void StartPerfCounters(PerfCounters *counters)
+{
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+    {
+        if (counters->fd[i] >= 0)
+        {
+            ioctl(counters->fd[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(counters->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &counters->started);
+}
+
+void StopPerfCounters(PerfCounters *counters, PerfSample *sample)
+{
+    struct timespec stopped;
+    clock_gettime(CLOCK_MONOTONIC, &stopped);
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+    {
+        if (counters->fd[i] >= 0)
+        {
+            ioctl(counters->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+    sample->seconds += (stopped.tv_sec - counters->started.tv_sec) + (stopped.tv_nsec - counters->started.tv_nsec) / 1e9;
+
+    for (int i = 0; i < PERF_NUM_COUNTERS; i++)
+    {
+        // value, time enabled, time running; with more counters than the PMU has, each one only
+        // runs part of the time and is extrapolated
+        unsigned long long values[3];
+        if (counters->fd[i] < 0 || read(counters->fd[i], values, sizeof(values)) != sizeof(values))
+        {
+            continue;
+        }
+        if (values[2] != 0)
+        {
+            sample->value[i] += (double)values[0] * values[1] / values[2];
+        }
+    }
+}
@@ -0,0 +1,46 @@
+// perf-counters.h: host hardware counters (Linux perf_event_open) around a phase of the simulator,
+// e.g. the loader or a run of the interpreter, so engine changes can be judged by more than wall time.
+// Counters are per-thread and user space only. Any counter the kernel or CPU refuses (missing PMU,
+// perf_event_paranoid, a VM) is simply unavailable; wall time is always measured.
+
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <time.h>
+
+typedef enum
+{
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_BRANCH_MISSES,
+    PERF_L1D_MISSES, // L1 data cache read misses
+    PERF_L1I_MISSES, // L1 instruction cache read misses
+    PERF_LLC_MISSES, // last level cache misses
+    PERF_NUM_COUNTERS
+} PerfCounter;
+
+extern const char *PerfCounterNames[PERF_NUM_COUNTERS];
+
+typedef struct
+{
+    int fd[PERF_NUM_COUNTERS]; // -1 when the counter is unavailable
+    struct timespec started;
+} PerfCounters;
+
+// Counts accumulated over one or more Start/Stop intervals
+typedef struct
+{
+    double value[PERF_NUM_COUNTERS]; // scaled up when the kernel had to multiplex the counters
+    double seconds;
+} PerfSample;
+
+// Never returns NULL; check PerfCounterAvailable for each counter
+PerfCounters *OpenPerfCounters();
+void ClosePerfCounters(PerfCounters *counters);
+int PerfCounterAvailable(PerfCounters *counters, PerfCounter counter);
+
+// Count from zero until StopPerfCounters, which adds the counts to sample
+void StartPerfCounters(PerfCounters *counters);
+void StopPerfCounters(PerfCounters *counters, PerfSample *sample);
+
+#endif
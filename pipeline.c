@@ -0,0 +1,233 @@
+/*
+ * pipeline.c: 5-stage pipeline timing model with load-use and branch mispredict accounting
+ */
+
+#include "pipeline.h"
+
+PipelineModel *CreatePipelineModel(PredictorType predictor, unsigned int btbEntries)
+{
+    PipelineModel *model = (PipelineModel *)calloc(1, sizeof(PipelineModel));
+    model->predictor = predictor;
+
+    // round the table size up to a power of 2 so we can index with a mask
+    unsigned int entries = 1;
+    while (entries < btbEntries)
+    {
+        entries <<= 1;
+    }
+    model->btbEntries = entries;
+    model->btbTag = (unsigned short int *)calloc(entries, sizeof(unsigned short int));
+    model->btbTarget = (unsigned short int *)calloc(entries, sizeof(unsigned short int));
+    model->btbValid = (unsigned char *)calloc(entries, 1);
+    // 2-bit counters start weakly not-taken
+    model->counters = (unsigned char *)malloc(entries);
+    memset(model->counters, 1, entries);
+    return model;
+}
+
+void FreePipelineModel(PipelineModel *model)
+{
+    free(model->btbTag);
+    free(model->btbTarget);
+    free(model->btbValid);
+    free(model->counters);
+    free(model);
+}
+
+/*
+ * Registers an instruction reads in X (bitmask), and in M (only STR's data register).
+ */
+unsigned char sources_x(unsigned short int insn, unsigned char *sourcesM)
+{
+    unsigned char r1 = (insn >> 9) & 0x7; // bits 9-11
+    unsigned char r2 = (insn >> 6) & 0x7; // bits 6-8
+    unsigned char r3 = insn & 0x7;        // bits 0-2
+    *sourcesM = 0;
+
+    switch (insn >> 12)
+    {
+    case 1:
+        // ADD/MUL/SUB/DIV Rs Rt, or ADD Rs IMM5
+        return (insn & 0x20) ? (1 << r2) : (1 << r2) | (1 << r3);
+    case 2:
+        // CMP/CMPU Rs Rt, or CMPI/CMPIU Rs IMM7
+        return (insn & 0x100) ? (1 << r1) : (1 << r1) | (1 << r3);
+    case 4:
+        // JSRR Rs, or JSR
+        return (insn & 0x800) ? 0 : (1 << r2);
+    case 5:
+        // AND Rs IMM5, NOT Rs, or AND/OR/XOR Rs Rt
+        if ((insn & 0x20) || ((insn >> 3) & 0x3) == 1)
+        {
+            return 1 << r2;
+        }
+        return (1 << r2) | (1 << r3);
+    case 6:
+        // LDR: base register
+        return 1 << r2;
+    case 7:
+        // STR: base register in X, data register only in M
+        *sourcesM = 1 << r1;
+        return 1 << r2;
+    case 8:
+        // RTI jumps to R7
+        return 1 << 7;
+    case 10:
+        // shifts read Rs, MOD reads Rs and Rt
+        return ((insn >> 4) & 0x3) == 3 ? (1 << r2) | (1 << r3) : (1 << r2);
+    case 12:
+        // JMPR Rs, or JMP
+        return (insn & 0x800) ? 0 : (1 << r2);
+    case 13:
+        // HICONST keeps the low byte of Rd
+        return 1 << r1;
+    default:
+        // BR, CONST, TRAP read no registers
+        return 0;
+    }
+}
+
+/*
+ * Predict the next PC for the instruction at pc.
+ */
+unsigned short int predict(PipelineModel *model, unsigned short int pc, unsigned short int insn)
+{
+    unsigned int index = pc & (model->btbEntries - 1);
+    if (model->predictor == PREDICT_NOT_TAKEN || !model->btbValid[index] || model->btbTag[index] != pc)
+    {
+        return pc + 1;
+    }
+    // conditional branches (BR with any condition bits) go by their counter under the 2-bit scheme
+    if (model->predictor == PREDICT_2BIT && (insn >> 12) == 0 && model->counters[index] < 2)
+    {
+        return pc + 1;
+    }
+    return model->btbTarget[index];
+}
+
+/*
+ * Train the predictor with the actual outcome.
+ */
+void train(PipelineModel *model, unsigned short int pc, unsigned short int insn, unsigned short int nextPC)
+{
+    unsigned int index = pc & (model->btbEntries - 1);
+    int taken = nextPC != (unsigned short int)(pc + 1);
+
+    if (model->predictor == PREDICT_2BIT && (insn >> 12) == 0)
+    {
+        if (taken && model->counters[index] < 3)
+            model->counters[index]++;
+        if (!taken && model->counters[index] > 0)
+            model->counters[index]--;
+    }
+
+    if (taken)
+    {
+        model->btbValid[index] = 1;
+        model->btbTag[index] = pc;
+        model->btbTarget[index] = nextPC;
+    }
+    else if (model->predictor == PREDICT_BTB && model->btbTag[index] == pc)
+    {
+        // a plain BTB predicts taken on every hit, so forget branches that fall through
+        model->btbValid[index] = 0;
+    }
+}
+
+void PipelineStep(PipelineModel *model, unsigned short int pc, unsigned short int insn, unsigned short int nextPC)
+{
+    PipelinePCStats *stats = &model->pc[pc];
+    unsigned int cycles = 1;
+
+    // the first instruction pays for filling the pipeline
+    if (model->instructions == 0)
+    {
+        cycles += PIPELINE_DEPTH - 1;
+    }
+
+    // load-use: the LDR's value is ready after M, so an instruction that needs it in X waits.
+    // STR's data register is only needed in M and gets the value through the W->M bypass.
+    unsigned char sourcesM;
+    unsigned char sourcesX = sources_x(insn, &sourcesM);
+    if (model->lastWasLoad && (sourcesX & (1 << model->lastLoadReg)))
+    {
+        cycles += LOAD_USE_PENALTY;
+        model->loadUseStalls++;
+        stats->loadUseStalls++;
+    }
+
+    // control flow: anything other than PC + 1 must have been predicted at fetch
+    unsigned char opcode = insn >> 12;
+    if (opcode == 0 || opcode == 4 || opcode == 8 || opcode == 12 || opcode == 15)
+    {
+        model->controlInstructions++;
+        if (predict(model, pc, insn) != nextPC)
+        {
+            cycles += MISPREDICT_PENALTY;
+            model->mispredicts++;
+            stats->mispredicts++;
+        }
+        train(model, pc, insn, nextPC);
+    }
+
+    model->lastWasLoad = opcode == 6;
+    model->lastLoadReg = (insn >> 9) & 0x7;
+
+    model->instructions++;
+    model->cycles += cycles;
+    stats->count++;
+}
+
+// model being reported, for compare_pcs
+PipelineModel *sortModel;
+
+// busiest PCs first
+int compare_pcs(const void *a, const void *b)
+{
+    PipelineModel *model = sortModel;
+    PipelinePCStats *x = &model->pc[*(const unsigned short int *)a];
+    PipelinePCStats *y = &model->pc[*(const unsigned short int *)b];
+    unsigned long long cx = x->count + x->loadUseStalls * LOAD_USE_PENALTY + x->mispredicts * MISPREDICT_PENALTY;
+    unsigned long long cy = y->count + y->loadUseStalls * LOAD_USE_PENALTY + y->mispredicts * MISPREDICT_PENALTY;
+    return cx < cy ? 1 : cx > cy ? -1 : 0;
+}
+
+void WritePipelineReport(PipelineModel *model, FILE *output)
+{
+    static const char *names[] = {"not-taken", "btb", "2bit"};
+    fprintf(output, "predictor: %s", names[model->predictor]);
+    if (model->predictor != PREDICT_NOT_TAKEN)
+    {
+        fprintf(output, " (%u entries)", model->btbEntries);
+    }
+    fprintf(output, "\n");
+    fprintf(output, "instructions: %llu\n", model->instructions);
+    fprintf(output, "cycles: %llu\n", model->cycles);
+    fprintf(output, "CPI: %.3f\n", model->instructions ? (double)model->cycles / model->instructions : 0.0);
+    fprintf(output, "load-use stalls: %llu (%llu cycles)\n", model->loadUseStalls, model->loadUseStalls * LOAD_USE_PENALTY);
+    fprintf(output, "control instructions: %llu, mispredicted: %llu (%llu cycles)\n",
+            model->controlInstructions, model->mispredicts, model->mispredicts * MISPREDICT_PENALTY);
+
+    // collect the PCs that ran and sort them by the cycles they cost
+    unsigned short int *pcs = (unsigned short int *)malloc(65536 * sizeof(unsigned short int));
+    int n = 0;
+    for (int pc = 0; pc < 65536; pc++)
+    {
+        if (model->pc[pc].count != 0)
+        {
+            pcs[n++] = pc;
+        }
+    }
+    sortModel = model;
+    qsort(pcs, n, sizeof(unsigned short int), compare_pcs);
+
+    fprintf(output, "\n  PC     count        cycles       CPI    load-use  mispredicts\n");
+    for (int i = 0; i < n; i++)
+    {
+        PipelinePCStats *stats = &model->pc[pcs[i]];
+        unsigned long long cycles = stats->count + stats->loadUseStalls * LOAD_USE_PENALTY + stats->mispredicts * MISPREDICT_PENALTY;
+        fprintf(output, "%04X %12llu %12llu %8.3f %10llu %12llu\n", pcs[i], stats->count, cycles,
+                (double)cycles / stats->count, stats->loadUseStalls, stats->mispredicts);
+    }
+    free(pcs);
+}
@@ -0,0 +1,64 @@
+// pipeline.h: cycle-level timing model of a classic 5-stage (F D X M W) LC4 pipeline.
+// The model is fed the executed instruction stream after the fact, so it never changes what the
+// simulator computes. It assumes full bypassing, so the only stalls are:
+//   - load-use: an instruction that needs an LDR result in X right after the LDR waits 1 cycle
+//   - mispredicts: control flow is resolved in X, so a wrong next-PC guess costs 2 cycles
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "LC4.h"
+
+#define PIPELINE_DEPTH 5
+#define LOAD_USE_PENALTY 1
+#define MISPREDICT_PENALTY 2
+
+typedef enum
+{
+    PREDICT_NOT_TAKEN, // always fetch PC + 1
+    PREDICT_BTB,       // branch target buffer: predict the last target whenever the PC hits
+    PREDICT_2BIT       // BTB for targets plus a table of 2-bit saturating counters for direction
+} PredictorType;
+
+// per-PC counters
+typedef struct
+{
+    unsigned long long count;
+    unsigned long long loadUseStalls;
+    unsigned long long mispredicts;
+} PipelinePCStats;
+
+typedef struct
+{
+    PredictorType predictor;
+
+    // BTB and counter tables have btbEntries entries (a power of 2), indexed by the low PC bits
+    unsigned int btbEntries;
+    unsigned short int *btbTag;
+    unsigned short int *btbTarget;
+    unsigned char *btbValid;
+    unsigned char *counters;
+
+    // the previous instruction, to detect load-use hazards
+    int lastWasLoad;
+    unsigned char lastLoadReg;
+
+    unsigned long long instructions;
+    unsigned long long cycles;
+    unsigned long long loadUseStalls;
+    unsigned long long controlInstructions;
+    unsigned long long mispredicts;
+
+    PipelinePCStats pc[65536];
+} PipelineModel;
+
+PipelineModel *CreatePipelineModel(PredictorType predictor, unsigned int btbEntries);
+void FreePipelineModel(PipelineModel *model);
+
+// Account for one executed instruction: insn was executed at pc and the next PC was nextPC.
+void PipelineStep(PipelineModel *model, unsigned short int pc, unsigned short int insn, unsigned short int nextPC);
+
+// Write totals, CPI and the per-PC stall breakdown (busiest PCs first).
+void WritePipelineReport(PipelineModel *model, FILE *output);
+
+#endif
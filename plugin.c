@@ -0,0 +1,122 @@
+/*
+ * plugin.c: in-process trace consumers, fed batches of TraceRecords
+ */
+
+#include "plugin.h"
+#include <dlfcn.h>
+
+PluginSet *CreatePluginSet()
+{
+    return (PluginSet *)calloc(1, sizeof(PluginSet));
+}
+
+int AddPlugin(PluginSet *set, const LC4Plugin *plugin)
+{
+    if (set->numPlugins == MAX_PLUGINS)
+    {
+        return -1;
+    }
+    set->handles[set->numPlugins] = NULL;
+    set->plugins[set->numPlugins++] = *plugin;
+    return 0;
+}
+
+int LoadPlugin(PluginSet *set, const char *filename, const char *args)
+{
+    if (set->numPlugins == MAX_PLUGINS)
+    {
+        fprintf(stderr, "Error loading plugin %s: at most %d plugins\n", filename, MAX_PLUGINS);
+        return -1;
+    }
+
+    void *handle = dlopen(filename, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL)
+    {
+        fprintf(stderr, "Error loading plugin %s: %s\n", filename, dlerror());
+        return -1;
+    }
+    LC4PluginInitFunction init = (LC4PluginInitFunction)dlsym(handle, "LC4PluginInit");
+    if (init == NULL)
+    {
+        fprintf(stderr, "Error loading plugin %s: no LC4PluginInit\n", filename);
+        dlclose(handle);
+        return -1;
+    }
+
+    LC4Plugin plugin;
+    memset(&plugin, 0, sizeof(plugin));
+    plugin.name = filename;
+    if (init(args, &plugin) != 0 || plugin.records == NULL)
+    {
+        fprintf(stderr, "Error loading plugin %s: initialization failed\n", filename);
+        dlclose(handle);
+        return -1;
+    }
+
+    set->handles[set->numPlugins] = handle;
+    set->plugins[set->numPlugins++] = plugin;
+    return 0;
+}
+
+/*
+ * Hand the batch to every plugin and start a new one.
+ */
+void flush_batch(PluginSet *set)
+{
+    if (set->batched == 0)
+    {
+        return;
+    }
+    for (int i = 0; i < set->numPlugins; i++)
+    {
+        set->plugins[i].records(set->plugins[i].context, set->batch, set->batched);
+    }
+    set->batched = 0;
+}
+
+void PluginTraceSink(MachineState *CPU, void *context)
+{
+    PluginSet *set = (PluginSet *)context;
+    FillTraceRecord(CPU, &set->batch[set->batched]);
+    if (++set->batched == PLUGIN_BATCH_RECORDS)
+    {
+        flush_batch(set);
+    }
+    if (set->next != NULL)
+    {
+        set->next(CPU, set->nextContext);
+    }
+}
+
+void AttachPlugins(PluginSet *set, MachineState *CPU)
+{
+    set->next = CPU->traceSink;
+    set->nextContext = CPU->traceContext;
+    CPU->traceSink = PluginTraceSink;
+    CPU->traceContext = set;
+}
+
+void FinishPlugins(PluginSet *set, MachineState *CPU)
+{
+    flush_batch(set);
+    for (int i = 0; i < set->numPlugins; i++)
+    {
+        if (set->plugins[i].finish != NULL)
+        {
+            set->plugins[i].finish(set->plugins[i].context, CPU);
+        }
+    }
+    for (int i = 0; i < set->numPlugins; i++)
+    {
+        if (set->handles[i] != NULL)
+        {
+            dlclose(set->handles[i]);
+        }
+    }
+    if (CPU->traceSink == PluginTraceSink)
+    {
+        CPU->traceSink = set->next;
+        CPU->traceContext = set->nextContext;
+    }
+    free(set);
+}
@@ -0,0 +1,68 @@
+// plugin.h: trace consumers that run inside the simulator. A plugin gets the TraceRecord of every
+// traced step (the fields WriteOut prints, see trace-record.h) in batches of up to
+// PLUGIN_BATCH_RECORDS, straight from the run loop, so analyses need no text trace to parse.
+//
+// A plugin is a struct of callbacks, added with AddPlugin, or a shared object loaded with
+// LoadPlugin that exports
+//     int LC4PluginInit(const char *args, LC4Plugin *plugin);
+// which fills in the callbacks and returns 0, or nonzero to refuse to load.
+//
+// AttachPlugins installs the plugins as CPU->traceSink. A sink that was already there (a binary
+// trace or a verifier) still gets every step, after the plugins' record is taken.
+
+#ifndef PLUGIN_H
+#define PLUGIN_H
+
+#include "trace-record.h"
+
+#define MAX_PLUGINS 8
+#define PLUGIN_BATCH_RECORDS 4096
+
+typedef struct LC4Plugin
+{
+    const char *name;
+    void *context;
+
+    // the next count records, in step order; the array is reused after the call returns
+    void (*records)(void *context, const TraceRecord *records, int count);
+
+    // optional, called once after the last batch with the machine as it stopped
+    void (*finish)(void *context, MachineState *CPU);
+} LC4Plugin;
+
+typedef int (*LC4PluginInitFunction)(const char *args, LC4Plugin *plugin);
+
+typedef struct
+{
+    LC4Plugin plugins[MAX_PLUGINS];
+    void *handles[MAX_PLUGINS]; // dlopen handles, NULL for plugins added with AddPlugin
+    int numPlugins;
+
+    TraceRecord batch[PLUGIN_BATCH_RECORDS];
+    int batched;
+
+    // the sink that was attached before the plugins
+    LC4TraceSink next;
+    void *nextContext;
+} PluginSet;
+
+PluginSet *CreatePluginSet();
+
+// Returns 0 on success, -1 if the set is full
+int AddPlugin(PluginSet *set, const LC4Plugin *plugin);
+
+// Load a shared object (a path; see dlopen) and initialize it with args, which may be NULL.
+// Returns 0 on success, -1 after printing why it failed.
+int LoadPlugin(PluginSet *set, const char *filename, const char *args);
+
+// Make the plugins CPU's traceSink, chaining to the sink already attached
+void AttachPlugins(PluginSet *set, MachineState *CPU);
+
+// Deliver the records still batched, call every finish callback, then unload and free everything.
+// Puts the chained sink back as CPU's traceSink.
+void FinishPlugins(PluginSet *set, MachineState *CPU);
+
+// traceSink of the plugins, with the PluginSet as context
+void PluginTraceSink(MachineState *CPU, void *context);
+
+#endif
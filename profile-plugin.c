@@ -0,0 +1,82 @@
+/*
+ * profile-plugin.c: example plugin (see plugin.h). Counts how often every PC ran and how many
+ * register, NZP and memory writes there were, then prints the hottest PCs when the run ends.
+ *
+ * Build: clang -shared -fPIC profile-plugin.c -o profile-plugin.so
+ * Use:   ./trace2 -plugin ./profile-plugin.so[:report.txt] none os.obj prog.obj
+ */
+
+#include "plugin.h"
+
+#define HOT_PCS 10
+
+typedef struct
+{
+    FILE *report;
+    unsigned long long steps;
+    unsigned long long regWrites;
+    unsigned long long nzpWrites;
+    unsigned long long stores;
+    unsigned long long hits[65536];
+} Profile;
+
+void profile_records(void *context, const TraceRecord *records, int count)
+{
+    Profile *profile = (Profile *)context;
+    for (int i = 0; i < count; i++)
+    {
+        profile->hits[records[i].pc]++;
+        profile->regWrites += records[i].regWE;
+        profile->nzpWrites += records[i].nzpWE;
+        profile->stores += records[i].dataWE;
+    }
+    profile->steps += count;
+}
+
+void profile_finish(void *context, MachineState *CPU)
+{
+    Profile *profile = (Profile *)context;
+    fprintf(profile->report, "%llu steps, %llu register writes, %llu NZP writes, %llu stores\n", profile->steps,
+            profile->regWrites, profile->nzpWrites, profile->stores);
+
+    // pick the hottest PCs one at a time, clearing each one once printed
+    for (int n = 0; n < HOT_PCS; n++)
+    {
+        int hottest = 0;
+        for (int pc = 1; pc < 65536; pc++)
+        {
+            if (profile->hits[pc] > profile->hits[hottest])
+            {
+                hottest = pc;
+            }
+        }
+        if (profile->hits[hottest] == 0)
+        {
+            break;
+        }
+        fprintf(profile->report, "x%04X %llu\n", hottest, profile->hits[hottest]);
+        profile->hits[hottest] = 0;
+    }
+
+    if (profile->report != stdout)
+    {
+        fclose(profile->report);
+    }
+    free(profile);
+}
+
+int LC4PluginInit(const char *args, LC4Plugin *plugin)
+{
+    Profile *profile = (Profile *)calloc(1, sizeof(Profile));
+    profile->report = args != NULL ? fopen(args, "w") : stdout;
+    if (profile->report == NULL)
+    {
+        free(profile);
+        return -1;
+    }
+    plugin->name = "profile";
+    plugin->context = profile;
+    plugin->records = profile_records;
+    plugin->finish = profile_finish;
+    return 0;
+}
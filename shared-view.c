@@ -0,0 +1,145 @@
+/*
+ * shared-view.c: MachineState in shared memory, with a seqlock-protected register snapshot
+ */
+
+#include "shared-view.h"
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// POSIX shared memory names are "/name"; anything else with a '/' is a file
+int is_shm_name(const char *name)
+{
+    return name[0] == '/' && strchr(name + 1, '/') == NULL;
+}
+
+SharedView *map_view(const char *name, int create)
+{
+    size_t size = SHARED_VIEW_HEADER_BYTES + sizeof(MachineState);
+    int flags = create ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY;
+    int fd = is_shm_name(name) ? shm_open(name, flags, 0644) : open(name, flags, 0644);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    if (create && ftruncate(fd, size) != 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    void *base = mmap(NULL, size, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    SharedView *view = (SharedView *)malloc(sizeof(SharedView));
+    view->header = (SharedViewHeader *)base;
+    view->machine = (MachineState *)((char *)base + SHARED_VIEW_HEADER_BYTES);
+    view->size = size;
+    view->nextPublish = 0;
+    return view;
+}
+
+SharedView *CreateSharedView(const char *name, unsigned long long interval)
+{
+    SharedView *view = map_view(name, 1);
+    if (view == NULL)
+    {
+        return NULL;
+    }
+
+    SharedViewHeader *header = view->header;
+    header->stateSize = sizeof(MachineState);
+    header->memoryOffset = SHARED_VIEW_HEADER_BYTES + offsetof(MachineState, memory);
+    header->stateOffset = SHARED_VIEW_HEADER_BYTES;
+    header->sequence = 0;
+    header->publishes = 0;
+    header->interval = interval != 0 ? interval : 1;
+    // the magic goes last, so a reader never sees a half-initialized header as valid
+    __atomic_store_n(&header->magic, SHARED_VIEW_MAGIC, __ATOMIC_RELEASE);
+    return view;
+}
+
+/*
+ * Seqlock writer: make the sequence odd, write the snapshot, make it even again.
+ */
+void PublishSharedView(SharedView *view, int status)
+{
+    SharedViewHeader *header = view->header;
+    MachineState *CPU = view->machine;
+    unsigned int sequence = header->sequence;
+
+    __atomic_store_n(&header->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    header->snapshot.PC = CPU->PC;
+    header->snapshot.PSR = CPU->PSR;
+    for (int i = 0; i < 8; i++)
+    {
+        header->snapshot.R[i] = CPU->R[i];
+    }
+    header->snapshot.instructionCount = CPU->instructionCount;
+    header->snapshot.status = status;
+    header->snapshot.finished = status != 0;
+    header->publishes++;
+
+    __atomic_store_n(&header->sequence, sequence + 2, __ATOMIC_RELEASE);
+    view->nextPublish = CPU->instructionCount + header->interval;
+}
+
+void SharedViewStep(SharedView *view)
+{
+    if (view->machine->instructionCount >= view->nextPublish)
+    {
+        PublishSharedView(view, 0);
+    }
+}
+
+void CloseSharedView(SharedView *view)
+{
+    munmap(view->header, view->size);
+    free(view);
+}
+
+SharedView *OpenSharedView(const char *name)
+{
+    SharedView *view = map_view(name, 0);
+    if (view == NULL)
+    {
+        return NULL;
+    }
+    SharedViewHeader *header = view->header;
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != SHARED_VIEW_MAGIC ||
+        header->stateSize != sizeof(MachineState) || header->memoryOffset != SHARED_VIEW_HEADER_BYTES + offsetof(MachineState, memory))
+    {
+        CloseSharedView(view);
+        return NULL;
+    }
+    return view;
+}
+
+/*
+ * Seqlock reader: retry until the sequence was even and unchanged around the copy.
+ */
+void ReadSharedSnapshot(SharedView *view, SharedSnapshot *snapshot)
+{
+    SharedViewHeader *header = view->header;
+    while (1)
+    {
+        unsigned int before = __atomic_load_n(&header->sequence, __ATOMIC_ACQUIRE);
+        if (before & 1)
+        {
+            continue;
+        }
+        memcpy(snapshot, (const void *)&header->snapshot, sizeof(SharedSnapshot));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&header->sequence, __ATOMIC_RELAXED) == before)
+        {
+            return;
+        }
+    }
+}
@@ -0,0 +1,73 @@
+// shared-view.h: the running machine, visible to other processes through shared memory.
+// The simulator's MachineState itself lives in a shared mapping (a POSIX shared memory object
+// or an mmap'd file), after a one-page header. Memory and registers are therefore always live
+// for readers, with no copying by the simulator. Every so often the simulator also publishes a
+// consistent snapshot of the registers and instruction count into the header under a seqlock,
+// which readers use when they need values that belong together.
+
+#ifndef SHARED_VIEW_H
+#define SHARED_VIEW_H
+
+#include "LC4.h"
+
+#define SHARED_VIEW_MAGIC 0x4C43345649455731ULL // "LC4VIEW1"
+#define SHARED_VIEW_HEADER_BYTES 4096
+
+typedef struct
+{
+    unsigned short int PC;
+    unsigned short int PSR;
+    unsigned short int R[8];
+    unsigned long long instructionCount;
+    // 0 while running, otherwise the LC4Status the run stopped with
+    int status;
+    int finished;
+} SharedSnapshot;
+
+typedef struct
+{
+    unsigned long long magic;
+    // so readers can check they were built against the same MachineState
+    unsigned int stateSize;
+    unsigned int memoryOffset;
+    unsigned int stateOffset;
+
+    // seqlock: odd while the simulator is writing snapshot
+    unsigned int sequence;
+    SharedSnapshot snapshot;
+
+    // number of snapshots published and the simulator's publishing interval in instructions
+    unsigned long long publishes;
+    unsigned long long interval;
+} SharedViewHeader;
+
+typedef struct
+{
+    SharedViewHeader *header;
+    // the machine, inside the mapping
+    MachineState *machine;
+    size_t size;
+    unsigned long long nextPublish;
+} SharedView;
+
+// Create the shared mapping and the machine in it. name is a POSIX shared memory name when it
+// starts with '/' and has no other '/' (e.g. "/lc4"), otherwise a file path (so "lc4" is a file).
+// Publishes every interval instructions. Returns NULL on failure (errno is set).
+SharedView *CreateSharedView(const char *name, unsigned long long interval);
+
+// Call after every step; publishes a snapshot when one is due.
+void SharedViewStep(SharedView *view);
+
+// Write a snapshot now. A nonzero status marks the run as finished.
+void PublishSharedView(SharedView *view, int status);
+
+// Unmap the view. The shared object or file stays for readers until they're done with it.
+void CloseSharedView(SharedView *view);
+
+// Reader side: map an existing view read-only. Returns NULL on failure or a mismatched layout.
+SharedView *OpenSharedView(const char *name);
+
+// Read a consistent snapshot, retrying while the simulator is in the middle of writing one.
+void ReadSharedSnapshot(SharedView *view, SharedSnapshot *snapshot);
+
+#endif
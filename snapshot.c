@@ -0,0 +1,45 @@
+/*
+ * snapshot.c: snapshots restored by copying back only the pages written since
+ */
+
+#include "snapshot.h"
+#include <stddef.h>
+
+Snapshot *TakeSnapshot(MachineState *CPU)
+{
+    Snapshot *snapshot = (Snapshot *)calloc(1, sizeof(Snapshot));
+    snapshot->saved = (MachineState *)malloc(sizeof(MachineState));
+    CPU->snapshot = snapshot;
+    memcpy(snapshot->saved, CPU, sizeof(MachineState));
+    return snapshot;
+}
+
+void MarkSnapshotDirty(Snapshot *snapshot, unsigned short int address)
+{
+    unsigned char page = address >> 8;
+    if (!snapshot->dirty[page])
+    {
+        snapshot->dirty[page] = 1;
+        snapshot->dirtyList[snapshot->numDirty++] = page;
+    }
+}
+
+void RestoreSnapshot(Snapshot *snapshot, MachineState *CPU)
+{
+    // everything before memory is registers, control signals and options: copy it all
+    memcpy(CPU, snapshot->saved, offsetof(MachineState, memory));
+    for (int i = 0; i < snapshot->numDirty; i++)
+    {
+        int page = snapshot->dirtyList[i];
+        memcpy(&CPU->memory[page << 8], &snapshot->saved->memory[page << 8], 256 * sizeof(unsigned short int));
+        snapshot->dirty[page] = 0;
+    }
+    snapshot->numDirty = 0;
+}
+
+void FreeSnapshot(Snapshot *snapshot, MachineState *CPU)
+{
+    CPU->snapshot = NULL;
+    free(snapshot->saved);
+    free(snapshot);
+}
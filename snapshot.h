@@ -0,0 +1,32 @@
+// snapshot.h: a saved machine that can be restored many times per second, e.g. by the fuzzer.
+// While a snapshot is attached as CPU->snapshot, every store marks its 256-word page dirty, and
+// RestoreSnapshot copies back only the registers and the dirty pages instead of all of memory.
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "LC4.h"
+
+typedef struct Snapshot
+{
+    MachineState *saved;
+
+    // pages stored to since the snapshot was taken or last restored
+    unsigned char dirty[256];
+    unsigned char dirtyList[256];
+    int numDirty;
+} Snapshot;
+
+// Save CPU as it is now and attach the snapshot to it
+Snapshot *TakeSnapshot(MachineState *CPU);
+
+// Put CPU back the way it was when the snapshot was taken
+void RestoreSnapshot(Snapshot *snapshot, MachineState *CPU);
+
+// Detach and free the snapshot
+void FreeSnapshot(Snapshot *snapshot, MachineState *CPU);
+
+// Called for every store while the snapshot is attached
+void MarkSnapshotDirty(Snapshot *snapshot, unsigned short int address);
+
+#endif
@@ -0,0 +1,400 @@
+/*
+ * superblock.c: forming and running superblocks of hot loops
+ */
+
+#include "superblock.h"
+#include "devices.h"
+
+SuperblockCache *CreateSuperblockCache()
+{
+    SuperblockCache *cache = (SuperblockCache *)calloc(1, sizeof(SuperblockCache));
+    cache->stepLimit = ~0ULL;
+    return cache;
+}
+
+void FreeSuperblockCache(SuperblockCache *cache)
+{
+    InvalidateSuperblocks(cache, 0x0000, 0xFFFF);
+    free(cache);
+}
+
+void InvalidateSuperblocks(SuperblockCache *cache, unsigned short int lo, unsigned short int hi)
+{
+    for (int pc = 0; pc < 65536; pc++)
+    {
+        Superblock *block = cache->blocks[pc];
+        if (block != NULL && block->lo <= hi && block->hi >= lo)
+        {
+            free(block);
+            cache->blocks[pc] = NULL;
+        }
+    }
+}
+
+// can the instruction at pc be fetched in this privilege mode (same checks as UpdateMachineState)
+int is_code(unsigned short int pc, int privileged)
+{
+    if (pc < 0x2000)
+    {
+        return 1;
+    }
+    return pc >= 0x8000 && pc <= 0x9FFF && privileged && pc != 0x80FF;
+}
+
+/*
+ * Form a superblock starting at start, following the profiled direction of each branch.
+ */
+Superblock *form_superblock(MachineState *CPU, SuperblockCache *cache, unsigned short int start)
+{
+    int privileged = (CPU->PSR & 0x8000) != 0;
+    Superblock *block = (Superblock *)malloc(sizeof(Superblock));
+    block->start = start;
+    block->lo = start;
+    block->hi = start;
+    block->needsPrivilege = start >= 0x8000;
+    block->length = 0;
+
+    unsigned short int pc = start;
+    while (block->length < SB_MAX_OPS && is_code(pc, privileged))
+    {
+        const DecodedInsn *d = &DecodeTable[CPU->memory[pc]];
+        unsigned short int next = pc + 1;
+
+        // indirect jumps, privilege changes and invalid opcodes end the block
+        if (d->op == OP_JMPR || d->op == OP_JSRR || d->op == OP_RTI || d->op == OP_TRAP || d->op == OP_INVALID)
+        {
+            break;
+        }
+
+        SuperblockOp *op = &block->ops[block->length];
+        op->pc = pc;
+        op->d = *d;
+        op->taken = 0;
+        if (d->op == OP_BR)
+        {
+            // follow the direction the branch went most often; without a profile, backward is taken
+            unsigned short int target = pc + 1 + d->imm;
+            if (d->rd == 0)
+                op->taken = 0;
+            else if (d->rd == 7)
+                op->taken = 1;
+            else if (cache->takenCount[pc] + cache->notTakenCount[pc] != 0)
+                op->taken = cache->takenCount[pc] >= cache->notTakenCount[pc];
+            else
+                op->taken = target <= pc;
+            if (op->taken)
+            {
+                next = target;
+            }
+        }
+        else if (d->op == OP_JMP || d->op == OP_JSR)
+        {
+            next = pc + 1 + d->imm;
+        }
+        block->length++;
+
+        if (pc < block->lo)
+            block->lo = pc;
+        if (pc > block->hi)
+            block->hi = pc;
+        if (pc >= 0x8000)
+            block->needsPrivilege = 1;
+
+        // stop once the loop closes
+        if (next == start)
+        {
+            break;
+        }
+        pc = next;
+    }
+
+    if (block->length == 0)
+    {
+        free(block);
+        return NULL;
+    }
+    cache->formed++;
+    return block;
+}
+
+void ProfileSuperblocks(MachineState *CPU, unsigned short int pc, const DecodedInsn *d)
+{
+    SuperblockCache *cache = CPU->superblocks;
+    unsigned short int next = CPU->PC;
+
+    if (d->op == OP_BR)
+    {
+        unsigned short int *count = next == (unsigned short int)(pc + 1) ? &cache->notTakenCount[pc] : &cache->takenCount[pc];
+        if (*count == 0xFFFF)
+        {
+            // keep the ratio when the counters saturate
+            cache->takenCount[pc] >>= 1;
+            cache->notTakenCount[pc] >>= 1;
+        }
+        (*count)++;
+    }
+
+    // a backward branch or jump: its target is probably a loop head
+    if (next <= pc && (d->op == OP_BR || d->op == OP_JMP) && cache->blocks[next] == NULL)
+    {
+        cache->hotness[next]++;
+        if (cache->hotness[next] >= SB_HOT_THRESHOLD)
+        {
+            cache->hotness[next] = 0;
+            cache->blocks[next] = form_superblock(CPU, cache, next);
+        }
+    }
+}
+
+// NZP bits for a result, the same way SetNZP computes them
+#define NZP_OF(value) ((unsigned short int)(value) == 0 ? 2 : (((value) & 0x8000) ? 4 : 1))
+
+// the effect of SetNZP when NZP_WE is set
+#define SET_NZP(CPU, value)                                    \
+    do                                                         \
+    {                                                          \
+        unsigned short int nzp = NZP_OF(value);                \
+        (CPU)->PSR = ((CPU)->PSR & 0xFFF8) | nzp;              \
+        (CPU)->NZPVal = nzp;                                   \
+    } while (0)
+
+// would a data access fault or need a device? Then the interpreter has to do it.
+int data_access_needs_interpreter(MachineState *CPU, unsigned short int address)
+{
+    if (address >= 0xA000 && !(CPU->PSR & 0x8000))
+        return 1;
+    if (address < 0x2000 || (address >= 0x8000 && address <= 0x9FFF))
+        return 1;
+    return CPU->mmioPage[address >> 8];
+}
+
+/*
+ * Execute the superblock at CPU->PC. Every instruction has the same effect on registers, PSR,
+ * memory and control signals as in the interpreter, minus the trace output.
+ */
+int RunSuperblock(MachineState *CPU)
+{
+    SuperblockCache *cache = CPU->superblocks;
+    Superblock *block = cache->blocks[CPU->PC];
+
+    // per-access observers need the interpreter
+    if (block == NULL || CPU->icache || CPU->dcache || CPU->heatmap || CPU->snapshot || CPU->coverage ||
+        CPU->traceSink || (block->needsPrivilege && !(CPU->PSR & 0x8000)) || CPU->instructionCount + block->length > cache->stepLimit)
+    {
+        return 0;
+    }
+    cache->entered++;
+
+    int executed = 0;
+    for (int i = 0; i < block->length; i++)
+    {
+        SuperblockOp *op = &block->ops[i];
+        const DecodedInsn *d = &op->d;
+        unsigned short int pc = op->pc;
+        unsigned short int next = pc + 1;
+        unsigned short int address;
+        short int result;
+
+        switch (d->op)
+        {
+        case OP_BR:
+            CPU->NZP_WE = 0;
+            CPU->DATA_WE = 0;
+            CPU->regFile_WE = 0;
+            if ((CPU->PSR & 0x7) & d->rd)
+            {
+                next = pc + 1 + d->imm;
+            }
+            break;
+        case OP_ADD:
+        case OP_MUL:
+        case OP_SUB:
+        case OP_DIV:
+        case OP_ADDI:
+            CPU->rdMux_CTL = d->rd;
+            CPU->rsMux_CTL = d->rs;
+            if (d->op == OP_ADDI)
+            {
+                result = CPU->R[d->rs] + d->imm;
+            }
+            else
+            {
+                CPU->rtMux_CTL = d->rt;
+                if (d->op == OP_ADD)
+                    result = CPU->R[d->rs] + CPU->R[d->rt];
+                else if (d->op == OP_MUL)
+                    result = CPU->R[d->rs] * CPU->R[d->rt];
+                else if (d->op == OP_SUB)
+                    result = CPU->R[d->rs] - CPU->R[d->rt];
+                else
+                    result = CPU->R[d->rs] / CPU->R[d->rt];
+            }
+            CPU->regInputVal = result;
+            CPU->R[d->rd] = result;
+            CPU->NZP_WE = 1;
+            CPU->DATA_WE = 0;
+            CPU->regFile_WE = 1;
+            SET_NZP(CPU, (unsigned short int)result);
+            break;
+        case OP_CMP:
+        case OP_CMPU:
+        case OP_CMPI:
+        case OP_CMPIU:
+            CPU->rsMux_CTL = d->rd;
+            CPU->NZP_WE = 1;
+            CPU->DATA_WE = 0;
+            CPU->regFile_WE = 0;
+            if (d->op == OP_CMP || d->op == OP_CMPU)
+            {
+                CPU->rtMux_CTL = d->rt;
+                result = CPU->R[d->rd] - CPU->R[d->rt];
+            }
+            else
+            {
+                result = CPU->R[d->rd] - d->imm;
+            }
+            SET_NZP(CPU, (unsigned short int)result);
+            break;
+        case OP_JSR:
+            CPU->NZP_WE = 0;
+            CPU->DATA_WE = 0;
+            CPU->regFile_WE = 0;
+            CPU->R[7] = pc + 1;
+            next = pc + 1 + d->imm;
+            break;
+        case OP_AND:
+        case OP_NOT:
+        case OP_OR:
+        case OP_XOR:
+        case OP_ANDI:
+            CPU->NZP_WE = 1;
+            CPU->DATA_WE = 0;
+            CPU->regFile_WE = 1;
+            CPU->rdMux_CTL = d->rd;
+            CPU->rsMux_CTL = d->rs;
+            if (d->op == OP_ANDI)
+            {
+                result = CPU->R[d->rs] & d->imm;
+            }
+            else
+            {
+                CPU->rtMux_CTL = d->rt;
+                if (d->op == OP_NOT)
+                    result = ~CPU->R[d->rs];
+                else if (d->op == OP_OR)
+                    result = CPU->R[d->rs] | CPU->R[d->rt];
+                else if (d->op == OP_XOR)
+                    result = CPU->R[d->rs] ^ CPU->R[d->rt];
+                else
+                    result = CPU->R[d->rs] & CPU->R[d->rt];
+            }
+            CPU->regInputVal = result;
+            CPU->R[d->rd] = result;
+            SET_NZP(CPU, CPU->R[d->rd]);
+            break;
+        case OP_LDR:
+            address = CPU->R[d->rs] + d->imm;
+            if (data_access_needs_interpreter(CPU, address))
+            {
+                goto side_exit;
+            }
+            CPU->NZP_WE = 1;
+            CPU->DATA_WE = 0;
+            CPU->regFile_WE = 1;
+            CPU->rdMux_CTL = d->rd;
+            CPU->rsMux_CTL = d->rs;
+            CPU->R[d->rd] = CPU->memory[address];
+            CPU->regInputVal = CPU->R[d->rd];
+            break;
+        case OP_STR:
+            address = CPU->R[d->rs] + d->imm;
+            // stores being reported go through the interpreter's event path
+            if (data_access_needs_interpreter(CPU, address) || CPU->verbosity >= VERBOSITY_STORES)
+            {
+                goto side_exit;
+            }
+            CPU->NZP_WE = 0;
+            CPU->DATA_WE = 1;
+            CPU->regFile_WE = 0;
+            CPU->rtMux_CTL = d->rd;
+            CPU->rsMux_CTL = d->rs;
+            CPU->dmemAddr = address;
+            CPU->dmemValue = CPU->R[d->rd];
+            CPU->memory[address] = CPU->dmemValue;
+            CPU->storeGeneration++;
+            break;
+        case OP_CONST:
+            CPU->rdMux_CTL = d->rd;
+            CPU->R[d->rd] = d->imm;
+            CPU->DATA_WE = 0;
+            CPU->regFile_WE = 1;
+            CPU->NZP_WE = 1;
+            CPU->regInputVal = d->imm;
+            SET_NZP(CPU, (unsigned short int)d->imm);
+            break;
+        case OP_SLL:
+        case OP_SRL:
+        case OP_SRA:
+        case OP_MOD:
+            CPU->NZP_WE = 1;
+            CPU->DATA_WE = 0;
+            CPU->regFile_WE = 1;
+            CPU->rdMux_CTL = d->rd;
+            CPU->rsMux_CTL = d->rs;
+            if (d->op == OP_SLL)
+                CPU->R[d->rd] = CPU->R[d->rs] << d->imm;
+            else if (d->op == OP_MOD)
+            {
+                CPU->rtMux_CTL = d->rt;
+                CPU->R[d->rd] = CPU->R[d->rs] % CPU->R[d->rt];
+            }
+            else
+                CPU->R[d->rd] = CPU->R[d->rs] >> d->imm;
+            CPU->regInputVal = CPU->R[d->rd];
+            SET_NZP(CPU, CPU->R[d->rd]);
+            break;
+        case OP_JMP:
+            CPU->NZP_WE = 0;
+            CPU->DATA_WE = 0;
+            CPU->regFile_WE = 0;
+            next = pc + 1 + d->imm;
+            break;
+        case OP_HICONST:
+            CPU->NZP_WE = 1;
+            CPU->DATA_WE = 0;
+            CPU->regFile_WE = 1;
+            CPU->rdMux_CTL = d->rd;
+            CPU->regInputVal = (CPU->R[d->rd] & 0xFF) | (d->imm << 8);
+            CPU->R[d->rd] = CPU->regInputVal;
+            SET_NZP(CPU, CPU->regInputVal);
+            break;
+        }
+
+        CPU->PC = next;
+        executed++;
+
+        // a branch that went the cold way leaves the superblock
+        if (d->op == OP_BR && (next != (unsigned short int)(pc + 1)) != op->taken)
+        {
+            cache->sideExits++;
+            break;
+        }
+        continue;
+
+    side_exit:
+        // let the interpreter run this access (and raise its exception, if any)
+        CPU->PC = pc;
+        cache->sideExits++;
+        break;
+    }
+
+    // WriteOut clears the data signals after every instruction that doesn't store
+    if (executed != 0 && !CPU->DATA_WE)
+    {
+        CPU->dmemAddr = 0;
+        CPU->dmemValue = 0;
+    }
+    CPU->instructionCount += executed;
+    cache->instructions += executed;
+    return executed;
+}
@@ -0,0 +1,73 @@
+// superblock.h: profile-guided superblock (trace) cache for untraced runs.
+// While profiling, the interpreter counts how often each backward branch/jump target is reached
+// and which way each BR goes. Once a target is hot, a superblock is formed from it: a straight
+// line of pre-decoded instructions following the dominant direction of every branch, up to the
+// point where the loop closes. Running a superblock skips the per-instruction fetch, PC region
+// checks, decode dispatch and trace output. Branches that go the cold way, and loads or stores
+// that would fault or touch a device, leave the superblock and continue in the interpreter.
+
+#ifndef SUPERBLOCK_H
+#define SUPERBLOCK_H
+
+#include "LC4.h"
+
+// a target becomes hot after this many backward branches to it
+#define SB_HOT_THRESHOLD 50
+#define SB_MAX_OPS 64
+
+typedef struct
+{
+    unsigned short int pc;
+    DecodedInsn d;
+    // for BR: the direction the superblock follows (1 = taken)
+    unsigned char taken;
+} SuperblockOp;
+
+typedef struct
+{
+    unsigned short int start;
+    // lowest and highest address of the instructions in the block
+    unsigned short int lo;
+    unsigned short int hi;
+    // blocks in OS code may only be entered with PSR[15] set
+    unsigned char needsPrivilege;
+    int length;
+    SuperblockOp ops[SB_MAX_OPS];
+} Superblock;
+
+typedef struct SuperblockCache
+{
+    // superblock starting at each PC, or NULL
+    Superblock *blocks[65536];
+
+    // profile: backward branch arrivals per target, and taken/not-taken counts per BR
+    unsigned short int hotness[65536];
+    unsigned short int takenCount[65536];
+    unsigned short int notTakenCount[65536];
+
+    // superblocks are only entered if they can't run past this instructionCount (e.g. the next
+    // traced step). CreateSuperblockCache sets it to the maximum.
+    unsigned long long stepLimit;
+
+    unsigned long long formed;
+    unsigned long long entered;
+    unsigned long long sideExits;
+    unsigned long long instructions;
+} SuperblockCache;
+
+SuperblockCache *CreateSuperblockCache();
+void FreeSuperblockCache(SuperblockCache *cache);
+
+// Run the superblock at CPU->PC, if there is one and it may be entered.
+// Returns the number of instructions executed, 0 if the interpreter has to run this instruction.
+int RunSuperblock(MachineState *CPU);
+
+// Called by the interpreter after it executed d at pc (CPU->PC is already the next PC).
+void ProfileSuperblocks(MachineState *CPU, unsigned short int pc, const DecodedInsn *d);
+
+// Drop every superblock with an instruction in lo..hi. Stores to code addresses raise an
+// exception, so the interpreter never needs this; anything else that rewrites code memory
+// (e.g. loading an object file into a running machine) must call it.
+void InvalidateSuperblocks(SuperblockCache *cache, unsigned short int lo, unsigned short int hi);
+
+#endif
@@ -0,0 +1,635 @@
+/*
+ * trace-compress.c: chunked LZ compression of traces on a thread pool, and the parallel decompressor
+ */
+
+#define _GNU_SOURCE
+#include "trace-compress.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 14
+#define LZ_MAX_OFFSET 65535
+
+#define CHUNK_HEADER_BYTES 8
+#define INDEX_ENTRY_BYTES 16
+#define TRAILER_BYTES 16
+
+// largest chunk size the decompressor accepts, so a corrupt header can't ask for huge buffers
+#define MAX_CHUNK_SIZE (64 << 20)
+
+void store_u32(unsigned char *p, unsigned int value)
+{
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+    p[2] = (value >> 16) & 0xFF;
+    p[3] = value >> 24;
+}
+
+void store_u64(unsigned char *p, unsigned long long value)
+{
+    store_u32(p, value & 0xFFFFFFFF);
+    store_u32(p + 4, value >> 32);
+}
+
+unsigned int load_u32(const unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (unsigned int)p[3] << 24;
+}
+
+unsigned long long load_u64(const unsigned char *p)
+{
+    return load_u32(p) | (unsigned long long)load_u32(p + 4) << 32;
+}
+
+/*
+ * LZ codec
+ */
+
+unsigned int LZCompressBound(unsigned int n)
+{
+    return n + n / 255 + 16;
+}
+
+unsigned int lz_hash(const unsigned char *p)
+{
+    unsigned int value;
+    memcpy(&value, p, 4);
+    return (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+unsigned char *lz_put_length(unsigned char *op, unsigned int length)
+{
+    while (length >= 255)
+    {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = length;
+    return op;
+}
+
+/*
+ * Emit literals followed by a match of matchLength at offset back (matchLength 0 for the last sequence)
+ */
+unsigned char *lz_put_sequence(unsigned char *op, const unsigned char *literals, unsigned int numLiterals,
+                               unsigned int offset, unsigned int matchLength)
+{
+    unsigned char *token = op++;
+    unsigned int matchCode = matchLength != 0 ? matchLength - LZ_MIN_MATCH : 0;
+    *token = (numLiterals < 15 ? numLiterals : 15) << 4 | (matchCode < 15 ? matchCode : 15);
+    if (numLiterals >= 15)
+    {
+        op = lz_put_length(op, numLiterals - 15);
+    }
+    memcpy(op, literals, numLiterals);
+    op += numLiterals;
+
+    if (matchLength != 0)
+    {
+        *op++ = offset & 0xFF;
+        *op++ = offset >> 8;
+        if (matchCode >= 15)
+        {
+            op = lz_put_length(op, matchCode - 15);
+        }
+    }
+    return op;
+}
+
+unsigned int LZCompress(const unsigned char *in, unsigned int n, unsigned char *out)
+{
+    // position + 1 of the last place each hash of 4 bytes was seen (0 = never)
+    unsigned int table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    const unsigned char *ip = in;
+    const unsigned char *anchor = in;
+    const unsigned char *end = in + n;
+    unsigned char *op = out;
+    while (end - ip >= LZ_MIN_MATCH)
+    {
+        unsigned int hash = lz_hash(ip);
+        unsigned int candidate = table[hash];
+        table[hash] = ip - in + 1;
+        if (candidate != 0)
+        {
+            const unsigned char *match = in + candidate - 1;
+            if (ip - match <= LZ_MAX_OFFSET && memcmp(match, ip, LZ_MIN_MATCH) == 0)
+            {
+                unsigned int length = LZ_MIN_MATCH;
+                while (ip + length < end && match[length] == ip[length])
+                {
+                    length++;
+                }
+                op = lz_put_sequence(op, anchor, ip - anchor, ip - match, length);
+                ip += length;
+                anchor = ip;
+                continue;
+            }
+        }
+        ip++;
+    }
+    op = lz_put_sequence(op, anchor, end - anchor, 0, 0);
+    return op - out;
+}
+
+int LZDecompress(const unsigned char *in, unsigned int n, unsigned char *out, unsigned int capacity)
+{
+    const unsigned char *ip = in;
+    const unsigned char *end = in + n;
+    unsigned char *op = out;
+    unsigned char *outEnd = out + capacity;
+    while (ip < end)
+    {
+        unsigned int token = *ip++;
+        unsigned int numLiterals = token >> 4;
+        if (numLiterals == 15)
+        {
+            unsigned int more;
+            do
+            {
+                if (ip >= end)
+                    return -1;
+                more = *ip++;
+                numLiterals += more;
+            } while (more == 255);
+        }
+        if (numLiterals > (unsigned int)(end - ip) || numLiterals > (unsigned int)(outEnd - op))
+        {
+            return -1;
+        }
+        memcpy(op, ip, numLiterals);
+        ip += numLiterals;
+        op += numLiterals;
+
+        // the last sequence has no match
+        if (ip == end)
+        {
+            break;
+        }
+
+        if (end - ip < 2)
+        {
+            return -1;
+        }
+        unsigned int offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        unsigned int length = (token & 15) + LZ_MIN_MATCH;
+        if ((token & 15) == 15)
+        {
+            unsigned int more;
+            do
+            {
+                if (ip >= end)
+                    return -1;
+                more = *ip++;
+                length += more;
+            } while (more == 255);
+        }
+        if (offset == 0 || offset > (unsigned int)(op - out) || length > (unsigned int)(outEnd - op))
+        {
+            return -1;
+        }
+
+        // byte by byte, since the match may overlap what it is producing
+        const unsigned char *match = op - offset;
+        for (unsigned int i = 0; i < length; i++)
+        {
+            op[i] = match[i];
+        }
+        op += length;
+    }
+    return op - out;
+}
+
+/*
+ * Compressing writer. Chunks live in a ring: the writer fills the chunk at filled, workers
+ * compress chunks in [taken, filled), and the writer writes chunks out in order from written.
+ */
+
+typedef struct
+{
+    unsigned char *raw;
+    unsigned int rawLength;
+    unsigned char *packed;
+    unsigned int packedLength; // == rawLength if it didn't compress and is stored raw
+    int compressed;
+} Chunk;
+
+typedef struct
+{
+    FILE *file;
+    unsigned int chunkSize;
+    Chunk *ring;
+    int ringSize;
+    unsigned long long filled;
+    unsigned long long taken;
+    unsigned long long written;
+    int closing;
+    pthread_mutex_t lock;
+    pthread_cond_t workReady;
+    pthread_cond_t chunkDone;
+    pthread_t *workers;
+    int numWorkers;
+
+    // where the next chunk goes in the file, and the index entries so far
+    unsigned long long offset;
+    unsigned char *index;
+    unsigned int numChunks;
+    unsigned int indexCapacity;
+    int error;
+} Compressor;
+
+void *compress_worker(void *arg)
+{
+    Compressor *c = (Compressor *)arg;
+    pthread_mutex_lock(&c->lock);
+    while (1)
+    {
+        while (c->taken == c->filled && !c->closing)
+        {
+            pthread_cond_wait(&c->workReady, &c->lock);
+        }
+        if (c->taken == c->filled)
+        {
+            break;
+        }
+        Chunk *chunk = &c->ring[c->taken++ % c->ringSize];
+        pthread_mutex_unlock(&c->lock);
+
+        chunk->packedLength = LZCompress(chunk->raw, chunk->rawLength, chunk->packed);
+        if (chunk->packedLength >= chunk->rawLength)
+        {
+            chunk->packedLength = chunk->rawLength;
+        }
+
+        pthread_mutex_lock(&c->lock);
+        chunk->compressed = 1;
+        pthread_cond_broadcast(&c->chunkDone);
+    }
+    pthread_mutex_unlock(&c->lock);
+    return NULL;
+}
+
+void write_chunk(Compressor *c, Chunk *chunk)
+{
+    unsigned char header[CHUNK_HEADER_BYTES];
+    store_u32(header, chunk->rawLength);
+    store_u32(header + 4, chunk->packedLength);
+    const unsigned char *data = chunk->packedLength == chunk->rawLength ? chunk->raw : chunk->packed;
+    if (fwrite(header, 1, CHUNK_HEADER_BYTES, c->file) != CHUNK_HEADER_BYTES ||
+        fwrite(data, 1, chunk->packedLength, c->file) != chunk->packedLength)
+    {
+        c->error = 1;
+    }
+
+    if (c->numChunks == c->indexCapacity)
+    {
+        c->indexCapacity = c->indexCapacity * 2 + 64;
+        c->index = (unsigned char *)realloc(c->index, (size_t)c->indexCapacity * INDEX_ENTRY_BYTES);
+    }
+    unsigned char *entry = c->index + (size_t)c->numChunks * INDEX_ENTRY_BYTES;
+    store_u64(entry, c->offset);
+    store_u32(entry + 8, chunk->rawLength);
+    store_u32(entry + 12, chunk->packedLength);
+    c->numChunks++;
+    c->offset += CHUNK_HEADER_BYTES + chunk->packedLength;
+}
+
+/*
+ * Write the compressed chunks at the head of the ring. With wait, wait for the head chunk if it isn't done yet.
+ */
+void write_finished(Compressor *c, int wait)
+{
+    pthread_mutex_lock(&c->lock);
+    while (c->written < c->filled)
+    {
+        Chunk *chunk = &c->ring[c->written % c->ringSize];
+        if (!chunk->compressed)
+        {
+            if (!wait)
+            {
+                break;
+            }
+            pthread_cond_wait(&c->chunkDone, &c->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&c->lock);
+        write_chunk(c, chunk);
+        pthread_mutex_lock(&c->lock);
+        chunk->compressed = 0;
+        chunk->rawLength = 0;
+        c->written++;
+        wait = 0;
+    }
+    pthread_mutex_unlock(&c->lock);
+}
+
+void submit_chunk(Compressor *c)
+{
+    pthread_mutex_lock(&c->lock);
+    c->filled++;
+    pthread_cond_signal(&c->workReady);
+    pthread_mutex_unlock(&c->lock);
+    write_finished(c, 0);
+}
+
+ssize_t compressor_write(void *cookie, const char *buffer, size_t size)
+{
+    Compressor *c = (Compressor *)cookie;
+    size_t done = 0;
+    while (done < size)
+    {
+        // only this thread changes filled and written, so they can be read without the lock
+        if (c->filled - c->written == (unsigned long long)c->ringSize)
+        {
+            write_finished(c, 1);
+        }
+        Chunk *chunk = &c->ring[c->filled % c->ringSize];
+        size_t n = size - done;
+        if (n > c->chunkSize - chunk->rawLength)
+        {
+            n = c->chunkSize - chunk->rawLength;
+        }
+        memcpy(chunk->raw + chunk->rawLength, buffer + done, n);
+        chunk->rawLength += n;
+        done += n;
+        if (chunk->rawLength == c->chunkSize)
+        {
+            submit_chunk(c);
+        }
+    }
+    // fopencookie wants 0, not -1, for an error
+    return c->error ? 0 : (ssize_t)size;
+}
+
+int compressor_close(void *cookie)
+{
+    Compressor *c = (Compressor *)cookie;
+    if (c->ring[c->filled % c->ringSize].rawLength > 0)
+    {
+        submit_chunk(c);
+    }
+    while (c->written < c->filled)
+    {
+        write_finished(c, 1);
+    }
+
+    pthread_mutex_lock(&c->lock);
+    c->closing = 1;
+    pthread_cond_broadcast(&c->workReady);
+    pthread_mutex_unlock(&c->lock);
+    for (int i = 0; i < c->numWorkers; i++)
+    {
+        pthread_join(c->workers[i], NULL);
+    }
+
+    unsigned char trailer[TRAILER_BYTES];
+    store_u64(trailer, c->offset);
+    store_u32(trailer + 8, c->numChunks);
+    memcpy(trailer + 12, TRACE_INDEX_MAGIC, 4);
+    if (fwrite(c->index, INDEX_ENTRY_BYTES, c->numChunks, c->file) != c->numChunks ||
+        fwrite(trailer, 1, TRAILER_BYTES, c->file) != TRAILER_BYTES)
+    {
+        c->error = 1;
+    }
+    if (fclose(c->file) != 0)
+    {
+        c->error = 1;
+    }
+
+    int result = c->error ? -1 : 0;
+    for (int i = 0; i < c->ringSize; i++)
+    {
+        free(c->ring[i].raw);
+        free(c->ring[i].packed);
+    }
+    free(c->ring);
+    free(c->workers);
+    free(c->index);
+    pthread_mutex_destroy(&c->lock);
+    pthread_cond_destroy(&c->workReady);
+    pthread_cond_destroy(&c->chunkDone);
+    free(c);
+    return result;
+}
+
+FILE *OpenCompressedTrace(const char *filename, int threads, unsigned int chunkSize)
+{
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL)
+    {
+        return NULL;
+    }
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+    if (chunkSize == 0 || chunkSize > MAX_CHUNK_SIZE)
+    {
+        chunkSize = TRACE_CHUNK_SIZE;
+    }
+
+    unsigned char header[8];
+    memcpy(header, TRACE_COMPRESS_MAGIC, 4);
+    store_u32(header + 4, chunkSize);
+    fwrite(header, 1, sizeof(header), file);
+
+    Compressor *c = (Compressor *)calloc(1, sizeof(Compressor));
+    c->file = file;
+    c->chunkSize = chunkSize;
+    c->offset = sizeof(header);
+    // two chunks per worker keeps every worker busy while the oldest one is written
+    c->ringSize = threads * 2;
+    c->ring = (Chunk *)calloc(c->ringSize, sizeof(Chunk));
+    for (int i = 0; i < c->ringSize; i++)
+    {
+        c->ring[i].raw = (unsigned char *)malloc(chunkSize);
+        c->ring[i].packed = (unsigned char *)malloc(LZCompressBound(chunkSize));
+    }
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->workReady, NULL);
+    pthread_cond_init(&c->chunkDone, NULL);
+    c->numWorkers = threads;
+    c->workers = (pthread_t *)malloc(threads * sizeof(pthread_t));
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_create(&c->workers[i], NULL, compress_worker, c);
+    }
+
+    cookie_io_functions_t functions = {NULL, compressor_write, NULL, compressor_close};
+    FILE *trace = fopencookie(c, "w", functions);
+    setvbuf(trace, NULL, _IOFBF, 1 << 16);
+    return trace;
+}
+
+/*
+ * Parallel decompressor: chunks are decompressed a batch at a time, a few per thread, and the
+ * batch is written out in order before the next one starts.
+ */
+
+typedef struct
+{
+    int fd;
+    unsigned long long fileSize;
+    unsigned int chunkSize;
+    const unsigned char *index;
+    unsigned int first; // the batch is chunks [first, end)
+    unsigned int end;
+    unsigned int next;
+    unsigned char **outputs; // one chunkSize buffer per chunk of the batch
+    unsigned int *lengths;
+    pthread_mutex_t lock;
+    int error;
+} Decompressor;
+
+int decompress_chunk(Decompressor *d, unsigned int i, unsigned char *output, unsigned char *packed)
+{
+    const unsigned char *entry = d->index + (size_t)i * INDEX_ENTRY_BYTES;
+    unsigned long long offset = load_u64(entry);
+    unsigned int rawLength = load_u32(entry + 8);
+    unsigned int packedLength = load_u32(entry + 12);
+    if (rawLength > d->chunkSize || packedLength > rawLength ||
+        offset + CHUNK_HEADER_BYTES + packedLength > d->fileSize)
+    {
+        return -1;
+    }
+
+    if (pread(d->fd, packed, CHUNK_HEADER_BYTES + packedLength, offset) != CHUNK_HEADER_BYTES + packedLength ||
+        load_u32(packed) != rawLength || load_u32(packed + 4) != packedLength)
+    {
+        return -1;
+    }
+    if (packedLength == rawLength)
+    {
+        memcpy(output, packed + CHUNK_HEADER_BYTES, rawLength);
+        return rawLength;
+    }
+    return LZDecompress(packed + CHUNK_HEADER_BYTES, packedLength, output, d->chunkSize);
+}
+
+void *decompress_worker(void *arg)
+{
+    Decompressor *d = (Decompressor *)arg;
+    unsigned char *packed = (unsigned char *)malloc(CHUNK_HEADER_BYTES + d->chunkSize);
+    while (1)
+    {
+        pthread_mutex_lock(&d->lock);
+        unsigned int i = d->next++;
+        pthread_mutex_unlock(&d->lock);
+        if (i >= d->end)
+        {
+            break;
+        }
+
+        int length = decompress_chunk(d, i, d->outputs[i - d->first], packed);
+        const unsigned char *entry = d->index + (size_t)i * INDEX_ENTRY_BYTES;
+        if (length < 0 || (unsigned int)length != load_u32(entry + 8))
+        {
+            pthread_mutex_lock(&d->lock);
+            d->error = 1;
+            pthread_mutex_unlock(&d->lock);
+            continue;
+        }
+        d->lengths[i - d->first] = length;
+    }
+    free(packed);
+    return NULL;
+}
+
+int DecompressTrace(const char *filename, FILE *output, int threads)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+
+    struct stat st;
+    unsigned char header[8];
+    unsigned char trailer[TRAILER_BYTES];
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)(sizeof(header) + TRAILER_BYTES) ||
+        pread(fd, header, sizeof(header), 0) != sizeof(header) ||
+        pread(fd, trailer, TRAILER_BYTES, st.st_size - TRAILER_BYTES) != TRAILER_BYTES ||
+        memcmp(header, TRACE_COMPRESS_MAGIC, 4) != 0 || memcmp(trailer + 12, TRACE_INDEX_MAGIC, 4) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    Decompressor d;
+    memset(&d, 0, sizeof(d));
+    d.fd = fd;
+    d.fileSize = st.st_size;
+    d.chunkSize = load_u32(header + 4);
+    unsigned long long indexOffset = load_u64(trailer);
+    unsigned int numChunks = load_u32(trailer + 8);
+    if (d.chunkSize == 0 || d.chunkSize > MAX_CHUNK_SIZE ||
+        indexOffset + (unsigned long long)numChunks * INDEX_ENTRY_BYTES + TRAILER_BYTES != d.fileSize)
+    {
+        close(fd);
+        return -1;
+    }
+
+    unsigned char *index = (unsigned char *)malloc((size_t)numChunks * INDEX_ENTRY_BYTES + 1);
+    if (pread(fd, index, (size_t)numChunks * INDEX_ENTRY_BYTES, indexOffset) != (ssize_t)numChunks * INDEX_ENTRY_BYTES)
+    {
+        free(index);
+        close(fd);
+        return -1;
+    }
+    d.index = index;
+
+    unsigned int batchSize = threads * 4;
+    d.outputs = (unsigned char **)malloc(batchSize * sizeof(unsigned char *));
+    d.lengths = (unsigned int *)malloc(batchSize * sizeof(unsigned int));
+    for (unsigned int i = 0; i < batchSize; i++)
+    {
+        d.outputs[i] = (unsigned char *)malloc(d.chunkSize);
+    }
+    pthread_mutex_init(&d.lock, NULL);
+    pthread_t *workers = (pthread_t *)malloc(threads * sizeof(pthread_t));
+
+    for (d.first = 0; d.first < numChunks && !d.error; d.first = d.end)
+    {
+        d.end = d.first + batchSize < numChunks ? d.first + batchSize : numChunks;
+        d.next = d.first;
+        for (int t = 0; t < threads; t++)
+        {
+            pthread_create(&workers[t], NULL, decompress_worker, &d);
+        }
+        for (int t = 0; t < threads; t++)
+        {
+            pthread_join(workers[t], NULL);
+        }
+        for (unsigned int i = d.first; i < d.end && !d.error; i++)
+        {
+            unsigned int length = d.lengths[i - d.first];
+            if (fwrite(d.outputs[i - d.first], 1, length, output) != length)
+            {
+                d.error = 1;
+            }
+        }
+    }
+
+    pthread_mutex_destroy(&d.lock);
+    for (unsigned int i = 0; i < batchSize; i++)
+    {
+        free(d.outputs[i]);
+    }
+    free(d.outputs);
+    free(d.lengths);
+    free(workers);
+    free(index);
+    close(fd);
+    return d.error ? -1 : 0;
+}
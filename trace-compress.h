@@ -0,0 +1,43 @@
+// trace-compress.h: compressed trace files, written and read on several threads.
+// The trace byte stream (text or binary records, the format doesn't matter) is cut into chunks of
+// a fixed size that are compressed independently with a small built-in LZ codec, so each chunk
+// can be compressed, and later decompressed, on any thread. Chunks are written in order, and an
+// index at the end of the file locates each one.
+//
+// File format (all integers little-endian):
+//   header:  "LC4Z", u32 chunk size
+//   chunks:  u32 raw length, u32 packed length, packed bytes (stored raw when packed length == raw length)
+//   index:   for each chunk: u64 file offset of its header, u32 raw length, u32 packed length
+//   trailer: u64 file offset of the index, u32 number of chunks, "LC4X"
+//
+// LZ block format: sequences of a token byte (high nibble literal count, low nibble match length - 4,
+// 15 meaning more length bytes follow, each adding up to 255), the literals, then a u16 match offset.
+// The last sequence has literals only.
+
+#ifndef TRACE_COMPRESS_H
+#define TRACE_COMPRESS_H
+
+#include <stdio.h>
+
+#define TRACE_COMPRESS_MAGIC "LC4Z"
+#define TRACE_INDEX_MAGIC "LC4X"
+#define TRACE_CHUNK_SIZE (1 << 20)
+
+// Largest packed size of n bytes
+unsigned int LZCompressBound(unsigned int n);
+
+// Compress n bytes from in into out (LZCompressBound(n) bytes). Returns the packed length.
+unsigned int LZCompress(const unsigned char *in, unsigned int n, unsigned char *out);
+
+// Decompress a block into out, which holds capacity bytes. Returns the raw length, or -1 if the block is corrupt.
+int LZDecompress(const unsigned char *in, unsigned int n, unsigned char *out, unsigned int capacity);
+
+// Create a compressed trace file. Returns a FILE to write the trace into like any other (it is
+// written by threads worker threads as chunks fill up); fclose finishes the file. NULL on error.
+FILE *OpenCompressedTrace(const char *filename, int threads, unsigned int chunkSize);
+
+// Decompress a whole compressed trace into output using threads threads. Returns 0, or -1 if the
+// file isn't a compressed trace or is corrupt.
+int DecompressTrace(const char *filename, FILE *output, int threads);
+
+#endif
@@ -0,0 +1,214 @@
+/*
+ * trace-filter.c: step windows, PC ranges, opcode filter and sampling for the trace
+ */
+
+#include "trace-filter.h"
+#include "loader.h"
+#include <ctype.h>
+
+TraceFilter *CreateTraceFilter()
+{
+    TraceFilter *filter = (TraceFilter *)calloc(1, sizeof(TraceFilter));
+    filter->sampleEvery = 1;
+    return filter;
+}
+
+void FreeTraceFilter(TraceFilter *filter)
+{
+    free(filter);
+}
+
+int AddStepWindow(TraceFilter *filter, const char *spec)
+{
+    char *end;
+    unsigned long long start = strtoull(spec, &end, 0);
+    if (end == spec || *end != ':' || filter->numWindows == MAX_STEP_WINDOWS)
+    {
+        return -1;
+    }
+    const char *endSpec = end + 1;
+    unsigned long long stop = ~0ULL;
+    if (*endSpec != '\0')
+    {
+        stop = strtoull(endSpec, &end, 0);
+        if (*end != '\0' || stop <= start)
+        {
+            return -1;
+        }
+    }
+
+    // insert in order of start, then merge windows that overlap or touch
+    int i = filter->numWindows;
+    while (i > 0 && filter->windowStart[i - 1] > start)
+    {
+        filter->windowStart[i] = filter->windowStart[i - 1];
+        filter->windowEnd[i] = filter->windowEnd[i - 1];
+        i--;
+    }
+    filter->windowStart[i] = start;
+    filter->windowEnd[i] = stop;
+    filter->numWindows++;
+
+    int n = 0;
+    for (i = 1; i < filter->numWindows; i++)
+    {
+        if (filter->windowStart[i] <= filter->windowEnd[n])
+        {
+            if (filter->windowEnd[i] > filter->windowEnd[n])
+                filter->windowEnd[n] = filter->windowEnd[i];
+        }
+        else
+        {
+            n++;
+            filter->windowStart[n] = filter->windowStart[i];
+            filter->windowEnd[n] = filter->windowEnd[i];
+        }
+    }
+    filter->numWindows = n + 1;
+    return 0;
+}
+
+// address of a symbol, or of a hex address written as x3000, 0x3000 or 3000; -1 if neither
+int parse_location(const char *text)
+{
+    int address = LookupSymbol(text);
+    if (address >= 0)
+    {
+        return address;
+    }
+
+    if (text[0] == 'x' || text[0] == 'X')
+        text++;
+    else if (text[0] == '0' && (text[1] == 'x' || text[1] == 'X'))
+        text += 2;
+    char *end;
+    unsigned long value = strtoul(text, &end, 16);
+    if (end == text || *end != '\0' || value > 0xFFFF)
+    {
+        return -1;
+    }
+    return value;
+}
+
+int AddPCRange(TraceFilter *filter, const char *spec)
+{
+    char lo_text[SYMBOL_NAME_LENGTH + 8];
+    const char *dash = strchr(spec, '-');
+    int lo, hi;
+
+    if (dash == NULL)
+    {
+        // a lone symbol runs up to the next symbol, or the end of its 8K region
+        lo = LookupSymbol(spec);
+        if (lo < 0)
+        {
+            return -1;
+        }
+        hi = NextSymbolAddress(lo);
+        hi = hi >= 0 && hi <= (lo | 0x1FFF) ? hi - 1 : (lo | 0x1FFF);
+    }
+    else
+    {
+        if (dash - spec >= (int)sizeof(lo_text))
+        {
+            return -1;
+        }
+        memcpy(lo_text, spec, dash - spec);
+        lo_text[dash - spec] = '\0';
+        lo = parse_location(lo_text);
+        hi = parse_location(dash + 1);
+        if (lo < 0 || hi < lo)
+        {
+            return -1;
+        }
+    }
+
+    filter->hasRanges = 1;
+    memset(filter->pcTraced + lo, 1, hi - lo + 1);
+    return 0;
+}
+
+int SetOpcodeFilter(TraceFilter *filter, const char *list)
+{
+    char name[16];
+    while (*list != '\0')
+    {
+        int n = 0;
+        while (*list != '\0' && *list != ',')
+        {
+            if (n == (int)sizeof(name) - 1)
+            {
+                return -1;
+            }
+            name[n++] = toupper((unsigned char)*list++);
+        }
+        name[n] = '\0';
+        if (*list == ',')
+        {
+            list++;
+        }
+
+        // a mnemonic selects every op with that name, e.g. ADD is both ADD forms
+        int found = 0;
+        for (int op = 0; op < OP_INVALID; op++)
+        {
+            if (strcmp(DecodedOpNames[op], name) == 0)
+            {
+                filter->opTraced[op] = 1;
+                found = 1;
+            }
+        }
+        if (!found)
+        {
+            return -1;
+        }
+        filter->hasOpcodes = 1;
+    }
+    return 0;
+}
+
+/*
+ * Move to the first window that hasn't ended by step. Steps only increase, so this never goes back.
+ * Returns 0 if there is no such window.
+ */
+int current_window(TraceFilter *filter, unsigned long long step)
+{
+    while (filter->window < filter->numWindows && filter->windowEnd[filter->window] <= step)
+    {
+        filter->window++;
+    }
+    return filter->window < filter->numWindows;
+}
+
+int TraceFilterStep(TraceFilter *filter, MachineState *CPU)
+{
+    unsigned long long step = CPU->instructionCount;
+    if (filter->numWindows != 0 && (!current_window(filter, step) || step < filter->windowStart[filter->window]))
+    {
+        return 0;
+    }
+    if (filter->hasRanges && !filter->pcTraced[CPU->PC])
+    {
+        return 0;
+    }
+    if (filter->hasOpcodes && !filter->opTraced[DecodeTable[CPU->memory[CPU->PC]].op])
+    {
+        return 0;
+    }
+    return filter->sampleEvery <= 1 || step % filter->sampleEvery == 0;
+}
+
+unsigned long long TraceFilterFastSteps(TraceFilter *filter, MachineState *CPU)
+{
+    unsigned long long step = CPU->instructionCount;
+    if (filter->hasRanges || filter->hasOpcodes || filter->sampleEvery > 1 || filter->numWindows == 0)
+    {
+        return 0;
+    }
+    if (!current_window(filter, step))
+    {
+        // past the last window: nothing is traced any more
+        return ~0ULL - step;
+    }
+    return step < filter->windowStart[filter->window] ? filter->windowStart[filter->window] - step : 0;
+}
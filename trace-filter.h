@@ -0,0 +1,59 @@
+// trace-filter.h: decides which steps get a WriteOut record.
+// A step is traced when it passes every filter that is set:
+//   - step windows: its step number (instructions executed before it) is in one of [start, end)
+//   - PC ranges: its PC is in one of the ranges (addresses or symbols)
+//   - opcodes: its instruction is one of the listed mnemonics
+//   - sampling: its step number is a multiple of N
+// Untraced steps run with output NULL. When only step windows are set, the gaps between them
+// can also run as superblocks, up to the start of the next window (see TraceFilterFastSteps).
+
+#ifndef TRACE_FILTER_H
+#define TRACE_FILTER_H
+
+#include "LC4.h"
+
+#define MAX_STEP_WINDOWS 64
+
+typedef struct
+{
+    // sorted, non-overlapping after the last AddStepWindow
+    int numWindows;
+    unsigned long long windowStart[MAX_STEP_WINDOWS];
+    unsigned long long windowEnd[MAX_STEP_WINDOWS];
+    // window the last query was in or before, so sequential queries don't search
+    int window;
+
+    // pcTraced[pc] is nonzero for PCs in a range, when there are ranges
+    int hasRanges;
+    unsigned char pcTraced[65536];
+
+    // opTraced[op] is nonzero for the selected DecodedOps, when there is an opcode filter
+    int hasOpcodes;
+    unsigned char opTraced[OP_INVALID + 1];
+
+    // trace every sampleEvery-th step (0 or 1 = every step)
+    unsigned long long sampleEvery;
+} TraceFilter;
+
+TraceFilter *CreateTraceFilter();
+void FreeTraceFilter(TraceFilter *filter);
+
+// Add a step window "start:end" ([start, end)) or "start:" (to the end). Returns -1 if malformed.
+int AddStepWindow(TraceFilter *filter, const char *spec);
+
+// Add a PC range "lo-hi" (inclusive), where each end is a hex address (x3000, 0x3000 or 3000) or a
+// symbol, or a lone symbol, which covers the symbol up to the next symbol. Needs the object files
+// loaded first, for the symbols. Returns -1 if malformed or a symbol is unknown.
+int AddPCRange(TraceFilter *filter, const char *spec);
+
+// Trace only the comma-separated mnemonics in list, e.g. "LDR,STR,JSR". Returns -1 for an unknown one.
+int SetOpcodeFilter(TraceFilter *filter, const char *list);
+
+// Should the step about to run on CPU be traced?
+int TraceFilterStep(TraceFilter *filter, MachineState *CPU);
+
+// Number of steps from CPU's current step that are certain not to be traced and may run as
+// superblocks: the distance to the next step window. 0 when other filters make that unknown.
+unsigned long long TraceFilterFastSteps(TraceFilter *filter, MachineState *CPU);
+
+#endif
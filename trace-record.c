@@ -0,0 +1,300 @@
+/*
+ * trace-record.c: trace records in text and binary form, and in-process trace verification
+ */
+
+#include "trace-record.h"
+
+void FillTraceRecord(MachineState *CPU, TraceRecord *record)
+{
+    record->pc = CPU->PC;
+    record->instruction = CPU->memory[CPU->PC];
+    record->regWE = CPU->regFile_WE;
+    record->reg = CPU->regFile_WE == 0 ? 0 : CPU->rdMux_CTL;
+    record->regValue = CPU->regFile_WE == 0 ? 0 : CPU->regInputVal;
+    record->nzpWE = CPU->NZP_WE;
+    record->nzp = CPU->NZP_WE == 0 ? 0 : CPU->NZPVal;
+    record->dataWE = CPU->DATA_WE;
+    // WriteOut has already cleared these when DATA_WE is 0
+    record->dataAddr = CPU->dmemAddr;
+    record->dataValue = CPU->dmemValue;
+}
+
+void FormatTraceRecord(const TraceRecord *record, char *line)
+{
+    char bits[17];
+    for (int i = 0; i < 16; i++)
+    {
+        bits[i] = (record->instruction >> (15 - i)) & 1 ? '1' : '0';
+    }
+    bits[16] = '\0';
+    sprintf(line, "%04X %s %X %X %04X %X %X %X %04X %04X\n", record->pc, bits, record->regWE, record->reg,
+            record->regValue, record->nzpWE, record->nzp, record->dataWE, record->dataAddr, record->dataValue);
+}
+
+// value of the n hex digits at p, or -1 if one isn't a hex digit
+int hex_field(const char *p, int n)
+{
+    int value = 0;
+    for (int i = 0; i < n; i++)
+    {
+        char c = p[i];
+        if (c >= '0' && c <= '9')
+            value = value * 16 + c - '0';
+        else if (c >= 'A' && c <= 'F')
+            value = value * 16 + c - 'A' + 10;
+        else if (c >= 'a' && c <= 'f')
+            value = value * 16 + c - 'a' + 10;
+        else
+            return -1;
+    }
+    return value;
+}
+
+/*
+ * WriteOut lines have fixed columns:
+ * PPPP BBBBBBBBBBBBBBBB W R VVVV W N W AAAA DDDD
+ */
+int ParseTraceRecord(const char *line, TraceRecord *record)
+{
+    if (strlen(line) < 46)
+    {
+        return -1;
+    }
+
+    // the spaces between the fields
+    static const int spaces[] = {4, 21, 23, 25, 30, 32, 34, 36, 41};
+    for (int i = 0; i < 9; i++)
+    {
+        if (line[spaces[i]] != ' ')
+        {
+            return -1;
+        }
+    }
+
+    int instruction = 0;
+    for (int i = 5; i < 21; i++)
+    {
+        if (line[i] != '0' && line[i] != '1')
+        {
+            return -1;
+        }
+        instruction = instruction * 2 + line[i] - '0';
+    }
+
+    int pc = hex_field(line, 4);
+    int regWE = hex_field(line + 22, 1);
+    int reg = hex_field(line + 24, 1);
+    int regValue = hex_field(line + 26, 4);
+    int nzpWE = hex_field(line + 31, 1);
+    int nzp = hex_field(line + 33, 1);
+    int dataWE = hex_field(line + 35, 1);
+    int dataAddr = hex_field(line + 37, 4);
+    int dataValue = hex_field(line + 42, 4);
+    if (pc < 0 || regWE < 0 || reg < 0 || regValue < 0 || nzpWE < 0 || nzp < 0 || dataWE < 0 || dataAddr < 0 || dataValue < 0)
+    {
+        return -1;
+    }
+
+    record->pc = pc;
+    record->instruction = instruction;
+    record->regWE = regWE;
+    record->reg = reg;
+    record->regValue = regValue;
+    record->nzpWE = nzpWE;
+    record->nzp = nzp;
+    record->dataWE = dataWE;
+    record->dataAddr = dataAddr;
+    record->dataValue = dataValue;
+    return 0;
+}
+
+void WriteTraceHeader(FILE *file)
+{
+    fwrite(TRACE_BINARY_MAGIC, 1, 4, file);
+}
+
+/*
+ * Binary record: pc, instruction, regValue, dataAddr, dataValue as little-endian 16-bit words,
+ * then regWE | nzpWE << 1 | dataWE << 2, then reg | nzp << 4.
+ */
+void WriteTraceRecord(const TraceRecord *record, FILE *file)
+{
+    unsigned char bytes[TRACE_RECORD_BYTES];
+    unsigned short int words[5] = {record->pc, record->instruction, record->regValue, record->dataAddr, record->dataValue};
+    for (int i = 0; i < 5; i++)
+    {
+        bytes[2 * i] = words[i] & 0xFF;
+        bytes[2 * i + 1] = words[i] >> 8;
+    }
+    bytes[10] = (record->regWE & 1) | (record->nzpWE & 1) << 1 | (record->dataWE & 1) << 2;
+    bytes[11] = (record->reg & 0xF) | (record->nzp & 0xF) << 4;
+    fwrite(bytes, 1, TRACE_RECORD_BYTES, file);
+}
+
+int OpenTraceReader(TraceReader *reader, const char *filename)
+{
+    reader->file = fopen(filename, "rb");
+    if (reader->file == NULL)
+    {
+        return -1;
+    }
+
+    char magic[4];
+    reader->binary = fread(magic, 1, 4, reader->file) == 4 && memcmp(magic, TRACE_BINARY_MAGIC, 4) == 0;
+    if (!reader->binary)
+    {
+        rewind(reader->file);
+    }
+    return 0;
+}
+
+int ReadTraceRecord(TraceReader *reader, TraceRecord *record)
+{
+    if (reader->binary)
+    {
+        unsigned char bytes[TRACE_RECORD_BYTES];
+        size_t n = fread(bytes, 1, TRACE_RECORD_BYTES, reader->file);
+        if (n == 0)
+        {
+            return 0;
+        }
+        if (n != TRACE_RECORD_BYTES)
+        {
+            return -1;
+        }
+        record->pc = bytes[0] | bytes[1] << 8;
+        record->instruction = bytes[2] | bytes[3] << 8;
+        record->regValue = bytes[4] | bytes[5] << 8;
+        record->dataAddr = bytes[6] | bytes[7] << 8;
+        record->dataValue = bytes[8] | bytes[9] << 8;
+        record->regWE = bytes[10] & 1;
+        record->nzpWE = (bytes[10] >> 1) & 1;
+        record->dataWE = (bytes[10] >> 2) & 1;
+        record->reg = bytes[11] & 0xF;
+        record->nzp = bytes[11] >> 4;
+        return 1;
+    }
+
+    char line[128];
+    if (fgets(line, sizeof(line), reader->file) == NULL)
+    {
+        return 0;
+    }
+    return ParseTraceRecord(line, record) == 0 ? 1 : -1;
+}
+
+void CloseTraceReader(TraceReader *reader)
+{
+    fclose(reader->file);
+}
+
+void print_field_diff(FILE *output, const char *name, int digits, unsigned int expected, unsigned int actual)
+{
+    if (expected != actual)
+    {
+        fprintf(output, "  %-12s expected %0*X, got %0*X\n", name, digits, expected, digits, actual);
+    }
+}
+
+void PrintTraceDiff(const TraceRecord *expected, const TraceRecord *actual, FILE *output)
+{
+    print_field_diff(output, "PC", 4, expected->pc, actual->pc);
+    print_field_diff(output, "instruction", 4, expected->instruction, actual->instruction);
+    print_field_diff(output, "regFile WE", 1, expected->regWE, actual->regWE);
+    print_field_diff(output, "register", 1, expected->reg, actual->reg);
+    print_field_diff(output, "reg value", 4, expected->regValue, actual->regValue);
+    print_field_diff(output, "NZP WE", 1, expected->nzpWE, actual->nzpWE);
+    print_field_diff(output, "NZP", 1, expected->nzp, actual->nzp);
+    print_field_diff(output, "data WE", 1, expected->dataWE, actual->dataWE);
+    print_field_diff(output, "data addr", 4, expected->dataAddr, actual->dataAddr);
+    print_field_diff(output, "data value", 4, expected->dataValue, actual->dataValue);
+}
+
+int TraceRecordsEqual(const TraceRecord *a, const TraceRecord *b)
+{
+    return a->pc == b->pc && a->instruction == b->instruction && a->regWE == b->regWE && a->reg == b->reg &&
+           a->regValue == b->regValue && a->nzpWE == b->nzpWE && a->nzp == b->nzp && a->dataWE == b->dataWE &&
+           a->dataAddr == b->dataAddr && a->dataValue == b->dataValue;
+}
+
+/*
+ * traceSink of the verifier: compare the record WriteOut would write with the next reference record.
+ */
+void verify_sink(MachineState *CPU, void *context)
+{
+    TraceVerifier *verifier = (TraceVerifier *)context;
+    if (verifier->mismatch)
+    {
+        return;
+    }
+    verifier->step++;
+    FillTraceRecord(CPU, &verifier->actual);
+
+    int status = ReadTraceRecord(&verifier->reference, &verifier->expected);
+    if (status == 1 && TraceRecordsEqual(&verifier->expected, &verifier->actual))
+    {
+        return;
+    }
+
+    verifier->mismatch = 1;
+    char line[48];
+    FormatTraceRecord(&verifier->actual, line);
+    if (status == 0)
+    {
+        fprintf(verifier->report, "Trace mismatch at step %llu: the reference ended, but the program executed\n  %s",
+                verifier->step, line);
+    }
+    else if (status < 0)
+    {
+        fprintf(verifier->report, "Trace mismatch at step %llu: malformed reference record\n", verifier->step);
+    }
+    else
+    {
+        char expectedLine[48];
+        FormatTraceRecord(&verifier->expected, expectedLine);
+        fprintf(verifier->report, "Trace mismatch at step %llu:\n  expected %s  got      %s", verifier->step,
+                expectedLine, line);
+        PrintTraceDiff(&verifier->expected, &verifier->actual, verifier->report);
+    }
+}
+
+TraceVerifier *CreateTraceVerifier(MachineState *CPU, const char *filename, FILE *report)
+{
+    TraceVerifier *verifier = (TraceVerifier *)calloc(1, sizeof(TraceVerifier));
+    if (OpenTraceReader(&verifier->reference, filename) != 0)
+    {
+        free(verifier);
+        return NULL;
+    }
+    verifier->report = report;
+    CPU->traceSink = verify_sink;
+    CPU->traceContext = verifier;
+    return verifier;
+}
+
+int FinishTraceVerifier(TraceVerifier *verifier, MachineState *CPU, int cutShort)
+{
+    int status = verifier->mismatch || cutShort ? 0 : ReadTraceRecord(&verifier->reference, &verifier->expected);
+    if (status != 0)
+    {
+        char line[48];
+        FormatTraceRecord(&verifier->expected, line);
+        fprintf(verifier->report, "Trace mismatch after step %llu: the program stopped, but the reference continues\n  %s",
+                verifier->step, status > 0 ? line : "(malformed record)\n");
+        verifier->mismatch = 1;
+    }
+
+    int mismatch = verifier->mismatch;
+    CloseTraceReader(&verifier->reference);
+    CPU->traceSink = NULL;
+    CPU->traceContext = NULL;
+    free(verifier);
+    return mismatch;
+}
+
+void BinaryTraceSink(MachineState *CPU, void *context)
+{
+    TraceRecord record;
+    FillTraceRecord(CPU, &record);
+    WriteTraceRecord(&record, (FILE *)context);
+}
@@ -0,0 +1,89 @@
+// trace-record.h: one line of the WriteOut trace as a struct, in text or binary form.
+// A TraceRecord holds exactly the fields WriteOut prints, so a record filled from the machine
+// compares equal to the record parsed from the line WriteOut would have written.
+// The binary form is TRACE_RECORD_BYTES bytes per record after a TRACE_BINARY_MAGIC header.
+//
+// TraceVerifier compares the machine against a reference trace as it runs, through
+// CPU->traceSink, and stops at the first record that differs.
+
+#ifndef TRACE_RECORD_H
+#define TRACE_RECORD_H
+
+#include "LC4.h"
+
+#define TRACE_BINARY_MAGIC "LC4T"
+#define TRACE_RECORD_BYTES 12
+
+typedef struct
+{
+    unsigned short int pc;
+    unsigned short int instruction;
+    unsigned char regWE;
+    unsigned char reg;           // 0 when regWE is 0
+    unsigned short int regValue; // 0 when regWE is 0
+    unsigned char nzpWE;
+    unsigned char nzp; // 0 when nzpWE is 0
+    unsigned char dataWE;
+    unsigned short int dataAddr;
+    unsigned short int dataValue;
+} TraceRecord;
+
+// Fill record with what WriteOut would print for the current state
+void FillTraceRecord(MachineState *CPU, TraceRecord *record);
+
+// Text form, the same line WriteOut writes (with the newline). line must hold 48 characters.
+void FormatTraceRecord(const TraceRecord *record, char *line);
+
+// Parse a WriteOut line. Returns 0 on success, -1 if the line is malformed.
+int ParseTraceRecord(const char *line, TraceRecord *record);
+
+// Binary form. Write the header once with WriteTraceHeader before the first record.
+void WriteTraceHeader(FILE *file);
+void WriteTraceRecord(const TraceRecord *record, FILE *file);
+
+typedef struct
+{
+    FILE *file;
+    int binary;
+} TraceReader;
+
+// Open a text or binary trace, telling them apart by the header. Returns -1 if it can't be opened.
+int OpenTraceReader(TraceReader *reader, const char *filename);
+
+// Read the next record. Returns 1 on success, 0 at the end of the trace, -1 if the record is malformed.
+int ReadTraceRecord(TraceReader *reader, TraceRecord *record);
+void CloseTraceReader(TraceReader *reader);
+
+// Nonzero if every field of a and b is the same
+int TraceRecordsEqual(const TraceRecord *a, const TraceRecord *b);
+
+// Print each field that differs between the expected and actual record
+void PrintTraceDiff(const TraceRecord *expected, const TraceRecord *actual, FILE *output);
+
+typedef struct
+{
+    TraceReader reference;
+
+    // records compared so far
+    unsigned long long step;
+
+    // set at the first divergence; the run should stop
+    int mismatch;
+    TraceRecord expected;
+    TraceRecord actual;
+
+    // where the divergence is reported
+    FILE *report;
+} TraceVerifier;
+
+// Start verifying CPU against the trace in filename. Returns NULL if it can't be opened.
+TraceVerifier *CreateTraceVerifier(MachineState *CPU, const char *filename, FILE *report);
+
+// Call once the machine stopped. Reports a reference that goes on longer than the run, unless
+// cutShort says a budget stopped the run before its end. Returns 0 if every record matched.
+int FinishTraceVerifier(TraceVerifier *verifier, MachineState *CPU, int cutShort);
+
+// traceSink that writes binary records to the FILE * passed as context
+void BinaryTraceSink(MachineState *CPU, void *context);
+
+#endif
@@ -4,31 +4,344 @@
  */
 
 #include "loader.h"
+#include "devices.h"
+#include "video-out.h"
+#include "pipeline.h"
+#include "cache.h"
+#include "superblock.h"
+#include "trace-record.h"
+#include "trace-filter.h"
+#include "shared-view.h"
+#include "heatmap.h"
+#include "trace-compress.h"
+#include "parallel-trace.h"
+#include "watchdog.h"
+#include "plugin.h"
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 // Global variable defining the current state of the machine
 MachineState *CPU;
 
+void PrintUsage()
+{
+    printf("Invalid arguments. Usage: ./trace [options] <outputfile> <file1> [file2] ...\n");
+    printf("<outputfile> can be none to run without writing a trace\n");
+    printf("Options:\n");
+    printf("  -hle                      service common OS traps natively (NZP and OS scratch registers are left as they were)\n");
+    printf("  -console <file>           console device reading keyboard input from file (- for stdin)\n");
+    printf("  -timer <instructions/ms>  timer device (0 = wall clock time)\n");
+    printf("  -screen <file.ppm>        framebuffer device, final screen written to file\n");
+    printf("  -video <pattern>          write a PPM frame (e.g. frame%%05d.ppm) whenever the screen changes\n");
+    printf("  -video-pipe <command>     pipe raw 128x124 RGB24 frames into command (e.g. ffmpeg)\n");
+    printf("  -video-every <N>          check the screen for changes every N instructions\n");
+    printf("  -pipeline <report>        model a 5-stage pipeline and write CPI and stalls per PC to report\n");
+    printf("  -predictor <type>         branch predictor for -pipeline: not-taken (default), btb or 2bit\n");
+    printf("  -btb-entries <N>          BTB / counter table size for -pipeline (default 256)\n");
+    printf("  -icache <config>          simulate an instruction cache, config is words:ways:block[:lru|fifo|random]\n");
+    printf("  -dcache <config>          simulate a data cache for LDR/STR, same config format\n");
+    printf("  -cache-report <file>      where to write the cache statistics (default stdout)\n");
+    printf("  -superblocks              run hot loops as superblocks while nothing is traced\n");
+    printf("  -verify <trace>           compare against a reference trace (text or binary) as it runs, stop at the first mismatch\n");
+    printf("  -binary-trace             write outputfile as binary trace records instead of text\n");
+    printf("  -trace-steps <start:end>  only trace steps start to end-1 (repeatable; start: traces to the end)\n");
+    printf("  -trace-pc <range>         only trace PCs in lo-hi (hex addresses or symbols) or a symbol (repeatable)\n");
+    printf("  -trace-ops <list>         only trace these mnemonics, e.g. LDR,STR,JSR\n");
+    printf("  -trace-every <N>          only trace every Nth step\n");
+    printf("  -shm <name>               put the machine in shared memory (/name) or a mapped file for monitors\n");
+    printf("  -shm-every <N>            publish a register snapshot for -shm every N instructions (default 10000)\n");
+    printf("  -heatmap <file>           record LDR/STR addresses per page and line over time, see lc4heat\n");
+    printf("  -heatmap-epoch <N>        instructions per heatmap epoch (default 100000)\n");
+    printf("  -compress <threads>       compress outputfile in chunks on this many threads (read it with lc4unz)\n");
+    printf("  -parallel-trace <threads> run untraced with checkpoints, then write the trace between them on threads\n");
+    printf("  -checkpoint-every <N>     steps between -parallel-trace checkpoints (default 100000)\n");
+    printf("  -max-steps <N>            stop after N steps\n");
+    printf("  -max-seconds <S>          stop after S seconds of wall clock time\n");
+    printf("  -detect-loops             stop when the program is provably stuck in an infinite loop\n");
+    printf("  -plugin <file.so[:args]>  feed every traced step to a plugin, see plugin.h (repeatable)\n");
+    printf("  -v <level>                0 = quiet, 1 = report exceptions (default), 2 = also every STR\n");
+}
+
 int main(int argc, char **argv)
 {
+    // Options come before the output file and all start with '-'
+    int argi = 1;
+    int hleTraps = 0;
+    char *console_filename = NULL;
+    char *screen_filename = NULL;
+    int timer = 0;
+    unsigned long instructionsPerMs = 0;
+    char *video_pattern = NULL;
+    char *video_command = NULL;
+    unsigned long long video_interval = 0;
+    char *pipeline_filename = NULL;
+    PredictorType predictor = PREDICT_NOT_TAKEN;
+    unsigned int btbEntries = 256;
+    char *icache_config = NULL;
+    char *dcache_config = NULL;
+    char *cache_filename = NULL;
+    int superblocks = 0;
+    int verbosity = VERBOSITY_EXCEPTIONS;
+    char *verify_filename = NULL;
+    int binaryTrace = 0;
+    TraceFilter *filter = NULL;
+    // PC ranges can name symbols, so they are added once the object files are loaded
+    char *pc_ranges[MAX_STEP_WINDOWS];
+    int num_pc_ranges = 0;
+    char *shm_name = NULL;
+    unsigned long long shm_interval = 10000;
+    char *heatmap_filename = NULL;
+    unsigned long long heatmap_epoch = 100000;
+    int compress_threads = 0;
+    int parallel_threads = 0;
+    unsigned long long checkpoint_interval = 100000;
+    unsigned long long max_steps = 0;
+    double max_seconds = 0;
+    int detect_loops = 0;
+    char *plugin_specs[MAX_PLUGINS];
+    int num_plugins = 0;
+    while (argi < argc && argv[argi][0] == '-')
+    {
+        if (strcmp(argv[argi], "-hle") == 0)
+        {
+            // service common traps natively instead of running the OS handlers
+            hleTraps = 1;
+        }
+        else if (strcmp(argv[argi], "-console") == 0 && argi + 1 < argc)
+        {
+            // keyboard input comes from this file ("-" for stdin), display output goes to stdout
+            console_filename = argv[++argi];
+        }
+        else if (strcmp(argv[argi], "-timer") == 0 && argi + 1 < argc)
+        {
+            // timer device; a nonzero rate runs it on simulated time instead of wall clock time
+            timer = 1;
+            instructionsPerMs = strtoul(argv[++argi], NULL, 0);
+        }
+        else if (strcmp(argv[argi], "-screen") == 0 && argi + 1 < argc)
+        {
+            // framebuffer device; the final screen is written to this file as a PPM
+            screen_filename = argv[++argi];
+        }
+        else if (strcmp(argv[argi], "-video") == 0 && argi + 1 < argc)
+        {
+            video_pattern = argv[++argi];
+        }
+        else if (strcmp(argv[argi], "-video-pipe") == 0 && argi + 1 < argc)
+        {
+            video_command = argv[++argi];
+        }
+        else if (strcmp(argv[argi], "-video-every") == 0 && argi + 1 < argc)
+        {
+            video_interval = strtoull(argv[++argi], NULL, 0);
+        }
+        else if (strcmp(argv[argi], "-pipeline") == 0 && argi + 1 < argc)
+        {
+            pipeline_filename = argv[++argi];
+        }
+        else if (strcmp(argv[argi], "-predictor") == 0 && argi + 1 < argc)
+        {
+            argi++;
+            if (strcmp(argv[argi], "not-taken") == 0)
+                predictor = PREDICT_NOT_TAKEN;
+            else if (strcmp(argv[argi], "btb") == 0)
+                predictor = PREDICT_BTB;
+            else if (strcmp(argv[argi], "2bit") == 0)
+                predictor = PREDICT_2BIT;
+            else
+            {
+                printf("Unknown predictor %s\n", argv[argi]);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[argi], "-btb-entries") == 0 && argi + 1 < argc)
+        {
+            btbEntries = strtoul(argv[++argi], NULL, 0);
+        }
+        else if (strcmp(argv[argi], "-icache") == 0 && argi + 1 < argc)
+        {
+            icache_config = argv[++argi];
+        }
+        else if (strcmp(argv[argi], "-dcache") == 0 && argi + 1 < argc)
+        {
+            dcache_config = argv[++argi];
+        }
+        else if (strcmp(argv[argi], "-cache-report") == 0 && argi + 1 < argc)
+        {
+            cache_filename = argv[++argi];
+        }
+        else if (strcmp(argv[argi], "-superblocks") == 0)
+        {
+            superblocks = 1;
+        }
+        else if (strcmp(argv[argi], "-verify") == 0 && argi + 1 < argc)
+        {
+            verify_filename = argv[++argi];
+        }
+        else if (strcmp(argv[argi], "-binary-trace") == 0)
+        {
+            binaryTrace = 1;
+        }
+        else if (strcmp(argv[argi], "-trace-steps") == 0 && argi + 1 < argc)
+        {
+            if (filter == NULL)
+                filter = CreateTraceFilter();
+            if (AddStepWindow(filter, argv[++argi]) != 0)
+            {
+                printf("Invalid step window %s\n", argv[argi]);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[argi], "-trace-pc") == 0 && argi + 1 < argc && num_pc_ranges < MAX_STEP_WINDOWS)
+        {
+            if (filter == NULL)
+                filter = CreateTraceFilter();
+            pc_ranges[num_pc_ranges++] = argv[++argi];
+        }
+        else if (strcmp(argv[argi], "-trace-ops") == 0 && argi + 1 < argc)
+        {
+            if (filter == NULL)
+                filter = CreateTraceFilter();
+            if (SetOpcodeFilter(filter, argv[++argi]) != 0)
+            {
+                printf("Invalid opcode list %s\n", argv[argi]);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[argi], "-trace-every") == 0 && argi + 1 < argc)
+        {
+            if (filter == NULL)
+                filter = CreateTraceFilter();
+            filter->sampleEvery = strtoull(argv[++argi], NULL, 0);
+        }
+        else if (strcmp(argv[argi], "-shm") == 0 && argi + 1 < argc)
+        {
+            shm_name = argv[++argi];
+        }
+        else if (strcmp(argv[argi], "-shm-every") == 0 && argi + 1 < argc)
+        {
+            shm_interval = strtoull(argv[++argi], NULL, 0);
+        }
+        else if (strcmp(argv[argi], "-heatmap") == 0 && argi + 1 < argc)
+        {
+            heatmap_filename = argv[++argi];
+        }
+        else if (strcmp(argv[argi], "-heatmap-epoch") == 0 && argi + 1 < argc)
+        {
+            heatmap_epoch = strtoull(argv[++argi], NULL, 0);
+        }
+        else if (strcmp(argv[argi], "-compress") == 0 && argi + 1 < argc)
+        {
+            compress_threads = atoi(argv[++argi]);
+        }
+        else if (strcmp(argv[argi], "-parallel-trace") == 0 && argi + 1 < argc)
+        {
+            parallel_threads = atoi(argv[++argi]);
+        }
+        else if (strcmp(argv[argi], "-checkpoint-every") == 0 && argi + 1 < argc)
+        {
+            checkpoint_interval = strtoull(argv[++argi], NULL, 0);
+        }
+        else if (strcmp(argv[argi], "-max-steps") == 0 && argi + 1 < argc)
+        {
+            max_steps = strtoull(argv[++argi], NULL, 0);
+        }
+        else if (strcmp(argv[argi], "-max-seconds") == 0 && argi + 1 < argc)
+        {
+            max_seconds = atof(argv[++argi]);
+        }
+        else if (strcmp(argv[argi], "-detect-loops") == 0)
+        {
+            detect_loops = 1;
+        }
+        else if (strcmp(argv[argi], "-plugin") == 0 && argi + 1 < argc && num_plugins < MAX_PLUGINS)
+        {
+            plugin_specs[num_plugins++] = argv[++argi];
+        }
+        else if (strcmp(argv[argi], "-v") == 0 && argi + 1 < argc)
+        {
+            verbosity = atoi(argv[++argi]);
+        }
+        else
+        {
+            printf("Unknown option %s\n", argv[argi]);
+            PrintUsage();
+            return -1;
+        }
+        argi++;
+    }
+
     // Check if at least 2 arguments are provided
-    if (argc < 3)
+    if (argc - argi < 2)
     {
-        printf("Invalid arguments. Usage: ./trace <outputfile> <file1> [file2] ...\n");
+        PrintUsage();
         return -1;
     }
 
     // The first arg is output file
-    char *output_filename = argv[1];
+    char *output_filename = argv[argi];
 
-    CPU = (MachineState *)malloc(sizeof(MachineState));
+    // with -shm the machine lives in the shared mapping, where monitors can read it directly
+    SharedView *view = NULL;
+    if (shm_name != NULL)
+    {
+        view = CreateSharedView(shm_name, shm_interval);
+        if (view == NULL)
+        {
+            perror("Error creating shared view");
+            return 1;
+        }
+        CPU = view->machine;
+    }
+    else
+    {
+        CPU = (MachineState *)malloc(sizeof(MachineState));
+    }
 
     // reset and clear CPU
     Reset(CPU);
     ClearSignals(CPU);
+    CPU->hleTraps = hleTraps;
+    CPU->verbosity = verbosity;
 
-    for (int i = 2; i < argc; i++)
+    if (icache_config != NULL && (CPU->icache = ParseCache("icache", icache_config)) == NULL)
+    {
+        printf("Invalid cache configuration %s\n", icache_config);
+        return -1;
+    }
+    if (dcache_config != NULL && (CPU->dcache = ParseCache("dcache", dcache_config)) == NULL)
+    {
+        printf("Invalid cache configuration %s\n", dcache_config);
+        return -1;
+    }
+    if (heatmap_filename != NULL && (CPU->heatmap = CreateHeatmap(heatmap_filename, heatmap_epoch)) == NULL)
+    {
+        perror("Error opening heatmap file");
+        return 1;
+    }
+
+    if (console_filename != NULL)
+    {
+        int fd = strcmp(console_filename, "-") == 0 ? 0 : open(console_filename, O_RDONLY);
+        if (fd < 0)
+        {
+            perror("Error opening console input");
+            return 1;
+        }
+        AttachDevice(CPU, CreateConsoleDevice(fd, stdout));
+    }
+    if (timer)
+    {
+        AttachDevice(CPU, CreateTimerDevice(instructionsPerMs));
+    }
+    if (screen_filename != NULL || video_pattern != NULL || video_command != NULL)
+    {
+        AttachDevice(CPU, CreateFramebufferDevice());
+    }
+
+    for (int i = argi + 1; i < argc; i++)
     {
         char *filename = argv[i];
         int out = ReadObjectFile(filename, CPU);
@@ -44,21 +357,307 @@ int main(int argc, char **argv)
         }
     }
 
-    FILE *output_file = fopen(output_filename, "w");
+    for (int i = 0; i < num_pc_ranges; i++)
+    {
+        if (AddPCRange(filter, pc_ranges[i]) != 0)
+        {
+            printf("Invalid PC range or unknown symbol %s\n", pc_ranges[i]);
+            return -1;
+        }
+    }
+
+    // "none" runs without a trace
+    FILE *output_file = NULL;
+    if (strcmp(output_filename, "none") != 0)
+    {
+        if (compress_threads > 0)
+            output_file = OpenCompressedTrace(output_filename, compress_threads, TRACE_CHUNK_SIZE);
+        else
+            output_file = fopen(output_filename, "w");
+        if (output_file == NULL)
+        {
+            perror("Error opening output file");
+            return 1;
+        }
+    }
+    if (superblocks)
+    {
+        if (pipeline_filename != NULL)
+        {
+            printf("-superblocks can't be used with -pipeline\n");
+            return -1;
+        }
+        CPU->superblocks = CreateSuperblockCache();
+        if (max_steps != 0)
+        {
+            // a superblock must not run past the step budget
+            CPU->superblocks->stepLimit = max_steps;
+        }
+    }
+
+    // a binary trace is written through the trace sink, so WriteOut gets no text output
+    FILE *text_output = output_file;
+    if (binaryTrace && output_file != NULL)
+    {
+        WriteTraceHeader(output_file);
+        CPU->traceSink = BinaryTraceSink;
+        CPU->traceContext = output_file;
+        text_output = NULL;
+    }
+
+    TraceVerifier *verifier = NULL;
+    if (verify_filename != NULL)
+    {
+        if (CPU->traceSink != NULL)
+        {
+            printf("-verify can't be used with -binary-trace\n");
+            return -1;
+        }
+        verifier = CreateTraceVerifier(CPU, verify_filename, stdout);
+        if (verifier == NULL)
+        {
+            perror("Error opening reference trace");
+            return 1;
+        }
+    }
+
+    // frame capture starts from the screen as loaded
+    VideoOut *video = NULL;
+    FILE *video_pipe = NULL;
+    if (video_pattern != NULL || video_command != NULL)
+    {
+        if (video_command != NULL)
+        {
+            video_pipe = popen(video_command, "w");
+            if (video_pipe == NULL)
+            {
+                perror("Error starting video command");
+                return 1;
+            }
+        }
+        video = CreateVideoOut(CPU, video_pattern, video_pipe, video_interval);
+    }
+
+    PipelineModel *pipeline = NULL;
+    if (pipeline_filename != NULL)
+    {
+        pipeline = CreatePipelineModel(predictor, btbEntries);
+    }
+
+    Watchdog *watchdog = NULL;
+    if (max_steps != 0 || max_seconds > 0 || detect_loops)
+    {
+        watchdog = CreateWatchdog(max_steps, max_seconds, detect_loops);
+    }
+
+    // plugins chain to the binary trace or verifier sink, if there is one
+    PluginSet *plugins = NULL;
+    if (num_plugins > 0)
+    {
+        plugins = CreatePluginSet();
+        for (int i = 0; i < num_plugins; i++)
+        {
+            char *args = strchr(plugin_specs[i], ':');
+            if (args != NULL)
+            {
+                *args++ = '\0';
+            }
+            if (LoadPlugin(plugins, plugin_specs[i], args) != 0)
+            {
+                return 1;
+            }
+        }
+        AttachPlugins(plugins, CPU);
+    }
+
+    // the trace sink, if any, is only attached for traced steps
+    LC4TraceSink sink = CPU->traceSink;
 
-    while (1)
+    int status = LC4_OK;
+    if (parallel_threads > 0)
     {
-        int status = UpdateMachineState(CPU, output_file);
-        if (status == 1)
+        // every step is replayed from a checkpoint, so nothing may watch or feed the run as it goes
+        if (!CanTraceInParallel(CPU) || filter != NULL || verifier != NULL || pipeline != NULL || video != NULL ||
+            view != NULL || watchdog != NULL || plugins != NULL || output_file == NULL)
+        {
+            printf("-parallel-trace needs an output file, and can't be used with devices, -hle, caches, -heatmap, "
+                   "trace filters, -verify, -pipeline, -video, -shm, budgets or plugins\n");
+            return -1;
+        }
+        status = ParallelTrace(CPU, output_file, checkpoint_interval, parallel_threads);
+    }
+    while (parallel_threads == 0)
+    {
+        unsigned short int pc = CPU->PC;
+        int traced = filter == NULL || TraceFilterStep(filter, CPU);
+        if (!traced && CPU->superblocks != NULL)
+        {
+            // superblocks may run up to the next step that could be traced
+            CPU->superblocks->stepLimit = CPU->instructionCount + TraceFilterFastSteps(filter, CPU);
+            if (max_steps != 0 && CPU->superblocks->stepLimit > max_steps)
+            {
+                CPU->superblocks->stepLimit = max_steps;
+            }
+        }
+        CPU->traceSink = traced ? sink : NULL;
+        status = UpdateMachineState(CPU, traced ? text_output : NULL);
+        if (status != LC4_OK || (verifier != NULL && verifier->mismatch))
         {
             break;
         }
+        if (watchdog != NULL && (status = WatchdogStep(watchdog, CPU, pc)) != LC4_OK)
+        {
+            break;
+        }
+        if (pipeline != NULL)
+        {
+            PipelineStep(pipeline, pc, CPU->memory[pc], CPU->PC);
+        }
+        if (video != NULL)
+        {
+            VideoOutStep(video, CPU);
+        }
+        if (view != NULL)
+        {
+            SharedViewStep(view);
+        }
+    }
+
+    if (view != NULL)
+    {
+        // the final snapshot tells monitors the run is over
+        PublishSharedView(view, status != LC4_OK ? status : LC4_HALT);
+    }
+
+    if (video != NULL)
+    {
+        FinishVideoOut(video, CPU);
+    }
+    if (video_pipe != NULL)
+    {
+        pclose(video_pipe);
+    }
+    if (pipeline != NULL)
+    {
+        FILE *pipeline_file = fopen(pipeline_filename, "w");
+        if (pipeline_file == NULL)
+        {
+            perror("Error opening pipeline report");
+        }
+        else
+        {
+            WritePipelineReport(pipeline, pipeline_file);
+            fclose(pipeline_file);
+        }
+        FreePipelineModel(pipeline);
     }
 
     // int status = UpdateMachineState(CPU, output_file);
 
-    fclose(output_file);
-    free(CPU);
+    // with -compress, write errors only show up when the last block is flushed here
+    int output_error = output_file != NULL && fclose(output_file) != 0;
+    if (output_error)
+    {
+        perror("Error writing output file");
+    }
+
+    if (plugins != NULL)
+    {
+        FinishPlugins(plugins, CPU);
+    }
+
+    int result = 0;
+    if (watchdog != NULL)
+    {
+        if (status >= LC4_STEP_LIMIT)
+        {
+            fprintf(stderr, "Stopped at PC x%04X after %llu steps: %s\n", CPU->PC, CPU->instructionCount,
+                    LC4StatusMessage(status));
+            result = 2;
+        }
+        FreeWatchdog(watchdog);
+    }
+
+    if (verifier != NULL)
+    {
+        unsigned long long steps = verifier->step;
+        // a run a budget cut short isn't expected to reach the end of the reference
+        int mismatch = FinishTraceVerifier(verifier, CPU, result == 2);
+        if (mismatch == 0)
+        {
+            printf("Trace matches the reference (%llu steps)\n", steps);
+        }
+        else
+        {
+            // a mismatch outranks the watchdog's 2
+            result = mismatch;
+        }
+    }
+    if (output_error && result == 0)
+    {
+        result = 1;
+    }
+
+    if (filter != NULL)
+    {
+        FreeTraceFilter(filter);
+    }
+
+    if (CPU->superblocks != NULL)
+    {
+        SuperblockCache *cache = CPU->superblocks;
+        printf("superblocks: %llu formed, %llu entered, %llu side exits, %llu of %llu instructions\n",
+               cache->formed, cache->entered, cache->sideExits, cache->instructions, CPU->instructionCount);
+        FreeSuperblockCache(cache);
+    }
+
+    if (screen_filename != NULL)
+    {
+        FILE *screen_file = fopen(screen_filename, "wb");
+        if (screen_file == NULL)
+        {
+            perror("Error opening screen file");
+        }
+        else
+        {
+            WriteScreenPPM(CPU, screen_file);
+            fclose(screen_file);
+        }
+    }
+
+    if (CPU->icache != NULL || CPU->dcache != NULL)
+    {
+        FILE *cache_file = cache_filename != NULL ? fopen(cache_filename, "w") : stdout;
+        if (cache_file == NULL)
+        {
+            perror("Error opening cache report");
+        }
+        else
+        {
+            if (CPU->icache != NULL)
+                WriteCacheReport(CPU->icache, cache_file);
+            if (CPU->dcache != NULL)
+                WriteCacheReport(CPU->dcache, cache_file);
+            if (cache_file != stdout)
+                fclose(cache_file);
+        }
+    }
+    if (CPU->icache != NULL)
+        FreeCache(CPU->icache);
+    if (CPU->dcache != NULL)
+        FreeCache(CPU->dcache);
+    if (CPU->heatmap != NULL)
+        FinishHeatmap(CPU->heatmap, CPU);
+
+    FreeDevices(CPU);
+    if (view != NULL)
+    {
+        CloseSharedView(view);
+    }
+    else
+    {
+        free(CPU);
+    }
 
-    return 0;
+    return result;
 }
\ No newline at end of file
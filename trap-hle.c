@@ -0,0 +1,226 @@
+/*
+ * trap-hle.c: native versions of the common OS trap handlers.
+ * Each handler has the same effect on registers and memory as the OS routine it replaces,
+ * but skips the OS's polling loops on the keyboard/display status registers.
+ */
+
+#include "trap-hle.h"
+#include "cache.h"
+#include "heatmap.h"
+#include "snapshot.h"
+#include <stdio.h>
+
+// read one character from the console device, or stdin if none is attached.
+// The real OS blocks forever at end of input; we return 0.
+unsigned short int hle_getchar(MachineState *CPU)
+{
+    MMIODevice *console = FindDevice(CPU, "console");
+    if (console)
+    {
+        return ConsoleGetChar(console);
+    }
+    int c = getchar();
+    return c == EOF ? 0 : (unsigned short int)c;
+}
+
+void hle_putchar(MachineState *CPU, unsigned short int c)
+{
+    MMIODevice *console = FindDevice(CPU, "console");
+    if (console)
+    {
+        ConsolePutChar(console, c);
+        return;
+    }
+    putchar(c & 0xFF);
+}
+
+// would the OS handler's LDR or STR of address fault? It runs with PSR[15] set, so only code is off limits.
+int hle_in_code(unsigned short int address)
+{
+    return address < 0x2000 || (address >= 0x8000 && address <= 0x9FFF);
+}
+
+// the OS handler's LDR of address, as the data cache and heatmap see it
+unsigned short int hle_load(MachineState *CPU, unsigned short int address)
+{
+    if (CPU->dcache)
+    {
+        CacheAccess(CPU->dcache, address, CPU->PC, 0);
+    }
+    if (CPU->heatmap)
+    {
+        HeatmapAccess(CPU->heatmap, CPU, address, 0);
+    }
+    return CPU->memory[address];
+}
+
+// store through the device layer so devices (e.g. the framebuffer) see the write
+void hle_store(MachineState *CPU, unsigned short int address, unsigned short int value)
+{
+    if (CPU->dcache)
+    {
+        CacheAccess(CPU->dcache, address, CPU->PC, 1);
+    }
+    if (CPU->heatmap)
+    {
+        HeatmapAccess(CPU->heatmap, CPU, address, 1);
+    }
+    if (CPU->snapshot)
+    {
+        MarkSnapshotDirty(CPU->snapshot, address);
+    }
+    if (CPU->mmioPage[address >> 8])
+    {
+        DeviceWrite(CPU, address, value);
+    }
+    else
+    {
+        CPU->memory[address] = value;
+    }
+}
+
+void TrapGetc(MachineState *CPU)
+{
+    CPU->R[0] = hle_getchar(CPU);
+}
+
+void TrapPutc(MachineState *CPU)
+{
+    hle_putchar(CPU, CPU->R[0]);
+}
+
+/*
+ * Returns 0 without printing anything if the string runs into code, where the OS handler's LDR
+ * would fault.
+ */
+int TrapPuts(MachineState *CPU)
+{
+    // print words until we hit a 0, wrapping around the end of memory like the OS would
+    unsigned short int address = CPU->R[0];
+    for (unsigned int i = 0; i < 65536; i++, address++)
+    {
+        if (hle_in_code(address))
+        {
+            return 0;
+        }
+        if (CPU->memory[address] == 0)
+        {
+            break;
+        }
+    }
+    for (address = CPU->R[0];; address++)
+    {
+        unsigned short int c = hle_load(CPU, address);
+        if (c == 0)
+        {
+            break;
+        }
+        hle_putchar(CPU, c);
+    }
+    return 1;
+}
+
+/*
+ * Returns 0 if the buffer starts in code, and -1 with *faultAddr set if the line runs into code:
+ * the OS handler has read the same characters and stored the ones before it when its STR faults.
+ */
+int TrapGets(MachineState *CPU, unsigned short int *faultAddr)
+{
+    unsigned short int address = CPU->R[0];
+    unsigned short int length = 0;
+    if (hle_in_code(address))
+    {
+        return 0;
+    }
+    while (1)
+    {
+        unsigned short int c = hle_getchar(CPU);
+        if (c == 0 || c == '\n')
+        {
+            break;
+        }
+        if (hle_in_code(address + length))
+        {
+            *faultAddr = address + length;
+            return -1;
+        }
+        hle_store(CPU, address + length, c);
+        length++;
+    }
+    if (hle_in_code(address + length))
+    {
+        *faultAddr = address + length;
+        return -1;
+    }
+    hle_store(CPU, address + length, 0);
+    CPU->R[1] = length;
+    return 1;
+}
+
+void TrapDrawPixel(MachineState *CPU)
+{
+    unsigned short int col = CPU->R[0];
+    unsigned short int row = CPU->R[1];
+    // the OS silently ignores pixels that are off screen
+    if (col < VIDEO_COLS && row < VIDEO_ROWS)
+    {
+        hle_store(CPU, VIDEO_BASE + row * VIDEO_COLS + col, CPU->R[2]);
+    }
+}
+
+void TrapDrawRect(MachineState *CPU)
+{
+    // clip the rectangle to the screen. Coordinates are signed so rectangles can start off screen.
+    int col0 = (short int)CPU->R[0];
+    int row0 = (short int)CPU->R[1];
+    int col1 = col0 + (short int)CPU->R[2];
+    int row1 = row0 + (short int)CPU->R[3];
+    unsigned short int color = CPU->R[4];
+
+    if (col0 < 0)
+        col0 = 0;
+    if (row0 < 0)
+        row0 = 0;
+    if (col1 > VIDEO_COLS)
+        col1 = VIDEO_COLS;
+    if (row1 > VIDEO_ROWS)
+        row1 = VIDEO_ROWS;
+
+    for (int row = row0; row < row1; row++)
+    {
+        for (int col = col0; col < col1; col++)
+        {
+            hle_store(CPU, VIDEO_BASE + row * VIDEO_COLS + col, color);
+        }
+    }
+}
+
+/*
+ * Run the native handler for trapVector, if there is one.
+ */
+int ServiceTrapHLE(MachineState *CPU, unsigned char trapVector, unsigned short int *faultAddr)
+{
+    switch (trapVector)
+    {
+    case TRAP_GETC:
+        TrapGetc(CPU);
+        break;
+    case TRAP_PUTC:
+        TrapPutc(CPU);
+        break;
+    case TRAP_PUTS:
+        return TrapPuts(CPU);
+    case TRAP_GETS:
+        return TrapGets(CPU, faultAddr);
+    case TRAP_DRAW_PIXEL:
+        TrapDrawPixel(CPU);
+        break;
+    case TRAP_DRAW_RECT:
+        TrapDrawRect(CPU);
+        break;
+    default:
+        // no native handler: let the OS code run
+        return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,30 @@
+// trap-hle.h: high-level emulation (HLE) of the common OS trap handlers.
+// When CPU->hleTraps is set, TRAP instructions whose vector has a native handler are serviced
+// here in C instead of jumping into the OS, then return to user code the way the OS's RTI would.
+// A native handler sets only the outputs listed with its vector below. The OS routines also
+// leave NZP set by their last instruction and clobber the registers they use as scratch; here
+// NZP and the other registers keep the values the TRAP left them with, so a program that reads
+// them after a TRAP can behave differently with HLE. The data cache and heatmap still see the
+// handler's loads and stores of user memory, attributed to the handler's entry point.
+
+#ifndef TRAP_HLE_H
+#define TRAP_HLE_H
+
+#include "LC4.h"
+#include "devices.h"
+
+// Trap vectors of the OS jump table at x8000. Edit these to match your OS if it differs.
+#define TRAP_GETC 0x00       // R0 = next character from the console
+#define TRAP_PUTC 0x01       // write character R0 to the console
+#define TRAP_PUTS 0x02       // write the null-terminated string starting at address R0
+#define TRAP_GETS 0x03       // read a line into address R0 (null-terminated), R1 = its length
+#define TRAP_DRAW_PIXEL 0x04 // video[R1][R0] = R2 (row R1, column R0, color R2)
+#define TRAP_DRAW_RECT 0x05  // fill rectangle at column R0, row R1, width R2, height R3 with color R4
+
+// Services the trap natively if a handler exists for trapVector.
+// Returns 1 if the trap was handled (the caller then performs the RTI), 0 to run the OS handler,
+// which includes traps whose memory accesses would fault before they had any effect. Returns -1
+// when the handler got as far as a store to code at *faultAddr, which the OS's STR would fault on.
+int ServiceTrapHLE(MachineState *CPU, unsigned char trapVector, unsigned short int *faultAddr);
+
+#endif
@@ -0,0 +1,93 @@
+/*
+ * video-out.c: frame capture from the framebuffer device
+ */
+
+#include "video-out.h"
+
+VideoOut *CreateVideoOut(MachineState *CPU, const char *ppmPattern, FILE *raw, unsigned long long interval)
+{
+    MMIODevice *device = FindDevice(CPU, "framebuffer");
+    if (device == NULL)
+    {
+        return NULL;
+    }
+
+    VideoOut *video = (VideoOut *)malloc(sizeof(VideoOut));
+    video->ppmPattern = ppmPattern;
+    video->raw = raw;
+    video->interval = interval;
+    video->nextCheck = CPU->instructionCount;
+    video->frames = 0;
+    video->fb = (Framebuffer *)device->state;
+
+    // convert the whole screen once; after this only dirty regions are converted
+    for (int row = 0; row < VIDEO_ROWS; row++)
+    {
+        for (int col = 0; col < VIDEO_COLS; col++)
+        {
+            PixelToRGB(CPU->memory[VIDEO_BASE + row * VIDEO_COLS + col], video->rgb[row][col]);
+        }
+    }
+    ClearFramebufferDirty(video->fb);
+    return video;
+}
+
+/*
+ * Re-encode the dirty region, write the frame out and mark the framebuffer clean.
+ */
+void emit_frame(VideoOut *video, MachineState *CPU)
+{
+    Framebuffer *fb = video->fb;
+    for (int row = fb->dirtyTop; row <= fb->dirtyBottom; row++)
+    {
+        for (int col = fb->dirtyLeft[row]; col <= fb->dirtyRight[row]; col++)
+        {
+            PixelToRGB(CPU->memory[VIDEO_BASE + row * VIDEO_COLS + col], video->rgb[row][col]);
+        }
+    }
+    ClearFramebufferDirty(fb);
+
+    if (video->ppmPattern != NULL)
+    {
+        char filename[4096];
+        snprintf(filename, sizeof(filename), video->ppmPattern, video->frames);
+        FILE *file = fopen(filename, "wb");
+        if (file == NULL)
+        {
+            perror("Error opening frame file");
+        }
+        else
+        {
+            fprintf(file, "P6\n%d %d\n255\n", VIDEO_COLS, VIDEO_ROWS);
+            fwrite(video->rgb, 1, sizeof(video->rgb), file);
+            fclose(file);
+        }
+    }
+    if (video->raw != NULL)
+    {
+        fwrite(video->rgb, 1, sizeof(video->rgb), video->raw);
+    }
+    video->frames++;
+}
+
+void VideoOutStep(VideoOut *video, MachineState *CPU)
+{
+    if (CPU->instructionCount < video->nextCheck)
+    {
+        return;
+    }
+    video->nextCheck = CPU->instructionCount + video->interval;
+    if (video->fb->changed)
+    {
+        emit_frame(video, CPU);
+    }
+}
+
+void FinishVideoOut(VideoOut *video, MachineState *CPU)
+{
+    if (video->fb->changed)
+    {
+        emit_frame(video, CPU);
+    }
+    free(video);
+}
@@ -0,0 +1,38 @@
+// video-out.h: writes the framebuffer out as a sequence of frames.
+// Frames are only produced when STRs changed the screen, and only the dirty region recorded by the
+// framebuffer device is re-encoded, so capture costs about as much as the drawing itself.
+
+#ifndef VIDEO_OUT_H
+#define VIDEO_OUT_H
+
+#include "LC4.h"
+#include "devices.h"
+
+typedef struct
+{
+    // frames go to numbered PPM files (printf pattern such as "frame%05d.ppm"), to a stream of
+    // raw 24-bit RGB frames (e.g. a pipe into ffmpeg), or both. Either may be NULL.
+    const char *ppmPattern;
+    FILE *raw;
+
+    // check for changes every interval instructions (0 or 1 = after every instruction)
+    unsigned long long interval;
+    unsigned long long nextCheck;
+
+    int frames;
+    Framebuffer *fb;
+
+    // screen converted to RGB, kept up to date one dirty region at a time
+    unsigned char rgb[VIDEO_ROWS][VIDEO_COLS][3];
+} VideoOut;
+
+// Start capturing frames from the framebuffer device attached to CPU. Returns NULL if there is none.
+VideoOut *CreateVideoOut(MachineState *CPU, const char *ppmPattern, FILE *raw, unsigned long long interval);
+
+// Call after every instruction. Emits a frame if a check is due and the screen changed.
+void VideoOutStep(VideoOut *video, MachineState *CPU);
+
+// Emit any last change and free the video output. Does not close raw.
+void FinishVideoOut(VideoOut *video, MachineState *CPU);
+
+#endif
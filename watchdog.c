@@ -0,0 +1,91 @@
+/*
+ * watchdog.c: step and time budgets, and infinite loop detection
+ */
+
+#include "watchdog.h"
+
+// the clock is only read this often, in instructions
+#define CLOCK_CHECK_INTERVAL 65536
+
+double monotonic_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+Watchdog *CreateWatchdog(unsigned long long stepLimit, double seconds, int detectLoops)
+{
+    Watchdog *watchdog = (Watchdog *)calloc(1, sizeof(Watchdog));
+    watchdog->stepLimit = stepLimit;
+    watchdog->deadline = seconds > 0 ? monotonic_seconds() + seconds : 0;
+    watchdog->detectLoops = detectLoops;
+    watchdog->epoch = 1;
+    return watchdog;
+}
+
+void FreeWatchdog(Watchdog *watchdog)
+{
+    free(watchdog);
+}
+
+/*
+ * Remember the current state. Returns 1 if it was already seen since the last store.
+ */
+int seen_state(Watchdog *watchdog, MachineState *CPU)
+{
+    // a store or device access since the table was filled makes the old states meaningless
+    if (CPU->storeGeneration != watchdog->generation || watchdog->used >= WATCHDOG_TABLE_SIZE / 2)
+    {
+        watchdog->generation = CPU->storeGeneration;
+        watchdog->epoch++;
+        watchdog->used = 0;
+    }
+
+    unsigned int hash = CPU->PC * 0x9E3779B1u ^ CPU->PSR;
+    for (int i = 0; i < 8; i++)
+    {
+        hash = (hash ^ CPU->R[i]) * 0x01000193u;
+    }
+
+    // open addressing; the table is never more than half full
+    for (unsigned int slot = hash % WATCHDOG_TABLE_SIZE;; slot = (slot + 1) % WATCHDOG_TABLE_SIZE)
+    {
+        WatchdogState *state = &watchdog->table[slot];
+        if (state->epoch != watchdog->epoch)
+        {
+            state->epoch = watchdog->epoch;
+            state->PC = CPU->PC;
+            state->PSR = CPU->PSR;
+            memcpy(state->R, CPU->R, sizeof(state->R));
+            watchdog->used++;
+            return 0;
+        }
+        if (state->PC == CPU->PC && state->PSR == CPU->PSR && memcmp(state->R, CPU->R, sizeof(state->R)) == 0)
+        {
+            return 1;
+        }
+    }
+}
+
+int WatchdogStep(Watchdog *watchdog, MachineState *CPU, unsigned short int pc)
+{
+    if (watchdog->stepLimit != 0 && CPU->instructionCount >= watchdog->stepLimit)
+    {
+        return LC4_STEP_LIMIT;
+    }
+    if (watchdog->deadline != 0 && CPU->instructionCount >= watchdog->nextClockCheck)
+    {
+        watchdog->nextClockCheck = CPU->instructionCount + CLOCK_CHECK_INTERVAL;
+        if (monotonic_seconds() >= watchdog->deadline)
+        {
+            return LC4_TIME_LIMIT;
+        }
+    }
+    // every loop goes backward somewhere, so checking there is enough to catch it
+    if (watchdog->detectLoops && CPU->PC <= pc && seen_state(watchdog, CPU))
+    {
+        return LC4_INFINITE_LOOP;
+    }
+    return LC4_OK;
+}
@@ -0,0 +1,47 @@
+// watchdog.h: stop runaway programs. A watchdog enforces a step budget and a wall clock budget,
+// and can prove that a program is stuck in an infinite loop: whenever control goes backward it
+// hashes the architectural state (PC, PSR, R0-R7). If the same state comes back and nothing has
+// touched memory or a device since (CPU->storeGeneration is unchanged), the program will repeat
+// the same steps forever. Loops that poll a device, or that count, are never reported; they
+// only end at a budget.
+
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include "LC4.h"
+#include <time.h>
+
+// states remembered since the last store; when full, the table starts over
+#define WATCHDOG_TABLE_SIZE 4096
+
+typedef struct
+{
+    unsigned long long epoch; // the entry is valid if this is the watchdog's current epoch, which never wraps
+    unsigned short int PC;
+    unsigned short int PSR;
+    unsigned short int R[8];
+} WatchdogState;
+
+typedef struct
+{
+    unsigned long long stepLimit; // stop once instructionCount reaches this (0 = no limit)
+    double deadline;              // CLOCK_MONOTONIC seconds to stop at (0 = no limit)
+    unsigned long long nextClockCheck;
+    int detectLoops;
+
+    // the states in the table were all seen at this store generation
+    unsigned long long generation;
+    unsigned long long epoch;
+    unsigned int used;
+    WatchdogState table[WATCHDOG_TABLE_SIZE];
+} Watchdog;
+
+// seconds of 0 means no time budget, stepLimit of 0 no step budget
+Watchdog *CreateWatchdog(unsigned long long stepLimit, double seconds, int detectLoops);
+void FreeWatchdog(Watchdog *watchdog);
+
+// Call after every UpdateMachineState that returned LC4_OK; pc is the PC the step started at.
+// Returns LC4_OK, or LC4_STEP_LIMIT, LC4_TIME_LIMIT or LC4_INFINITE_LOOP.
+int WatchdogStep(Watchdog *watchdog, MachineState *CPU, unsigned short int pc);
+
+#endif